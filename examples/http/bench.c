@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Fetch tiles from a local stand-in server which serves the same canned tile
+ * for every request after a fixed latency. Usage:
+ *   bench [latency-ms] [requests] [tile-kb] */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <grits.h>
+
+/* Stand-in server */
+static gint        requests = 200;
+static SoupServer *server;
+static gint        latency  = 100;
+static gchar      *tile;
+static gsize       tile_size;
+static GHashTable *conns;
+static gint        served;
+static gint64      served_bytes;
+static gint        version  = 0;
+
+static gboolean unpause_cb(gpointer message)
+{
+	soup_server_unpause_message(server, message);
+	return FALSE;
+}
+
+static void tile_cb(SoupServer *server, SoupMessage *message,
+		const char *path, GHashTable *query,
+		SoupClientContext *client, gpointer data)
+{
+	/* Count connections by the client port */
+	SoupAddress *addr = soup_client_context_get_address(client);
+	g_hash_table_insert(conns,
+			GINT_TO_POINTER(soup_address_get_port(addr)), NULL);
+	served++;
+
+	/* Tiles above the requested count are missing */
+	const char *i = query ? g_hash_table_lookup(query, "i") : NULL;
+	if (i && atoi(i) >= requests) {
+		soup_message_set_status(message, SOUP_STATUS_NOT_FOUND);
+		return;
+	}
+
+	/* Send validators once the tiles have a version */
+	gchar *etag = g_strdup_printf("\"v%d\"", version);
+	const char *match = soup_message_headers_get_one(
+			message->request_headers, "If-None-Match");
+	if (version && match && g_str_equal(match, etag)) {
+		soup_message_set_status(message, SOUP_STATUS_NOT_MODIFIED);
+	} else {
+		soup_message_set_status(message, SOUP_STATUS_OK);
+		soup_message_set_response(message, "image/png",
+				SOUP_MEMORY_STATIC, tile, tile_size);
+		served_bytes += tile_size;
+	}
+	if (version)
+		soup_message_headers_replace(message->response_headers,
+				"ETag", etag);
+	g_free(etag);
+
+	soup_server_pause_message(server, message);
+	GSource *source = g_timeout_source_new(latency);
+	g_source_set_callback(source, unpause_cb, message, NULL);
+	g_source_attach(source, soup_server_get_async_context(server));
+	g_source_unref(source);
+}
+
+static gpointer server_thread(gpointer loop)
+{
+	g_main_loop_run(loop);
+	return NULL;
+}
+
+static gint server_start(void)
+{
+	GMainContext *context = g_main_context_new();
+	server = soup_server_new(
+			"port",          0,
+			"async-context", context,
+			NULL);
+	soup_server_add_handler(server, "/tile", tile_cb, NULL, NULL);
+	soup_server_run_async(server);
+	g_thread_new("server", server_thread, g_main_loop_new(context, FALSE));
+	return soup_server_get_port(server);
+}
+
+/* Clients */
+static gchar    *base;
+static gint      fetched;
+static gint      done;
+static GMutex    done_lock;
+static GCond     done_cond;
+
+static void fetch_done(GritsHttp *http, gchar *path, gpointer data)
+{
+	g_mutex_lock(&done_lock);
+	if (path)
+		fetched++;
+	done++;
+	g_cond_signal(&done_cond);
+	g_mutex_unlock(&done_lock);
+	g_free(path);
+}
+
+static void fetch_one(GritsHttp *http, gint i, gboolean async,
+		GritsCacheType mode)
+{
+	gchar *uri   = g_strdup_printf("%s/tile?i=%d", base, i);
+	gchar *local = g_strdup_printf("%d.png", i);
+	if (async) {
+		grits_http_fetch_async(http, uri, local, mode,
+				NULL, fetch_done, NULL);
+	} else {
+		gchar *path = grits_http_fetch(http, uri, local, mode,
+				NULL, NULL);
+		fetch_done(http, path, NULL);
+	}
+	g_free(uri);
+	g_free(local);
+}
+
+/* Blocking fetches from a pool of threads, like the tile loaders */
+static GritsHttp *pool_http;
+static void pool_func(gpointer i, gpointer data)
+{
+	fetch_one(pool_http, GPOINTER_TO_INT(i)-1, FALSE, GRITS_REFRESH);
+}
+
+static void wait_done(gint count)
+{
+	g_mutex_lock(&done_lock);
+	while (done < count)
+		g_cond_wait(&done_cond, &done_lock);
+	g_mutex_unlock(&done_lock);
+}
+
+static void run(const gchar *name, gint threads, gint per_host)
+{
+	grits_http_set_limits(per_host, 64);
+	GritsHttp *http = grits_http_new("bench/");
+	g_hash_table_remove_all(conns);
+	fetched = done = served = 0;
+
+	gint64 start = g_get_monotonic_time();
+	if (threads > 0) {
+		pool_http = http;
+		GThreadPool *pool = g_thread_pool_new(pool_func, NULL,
+				threads, FALSE, NULL);
+		for (int i = 0; i < requests; i++)
+			g_thread_pool_push(pool, GINT_TO_POINTER(i+1), NULL);
+		g_thread_pool_free(pool, FALSE, TRUE);
+	} else {
+		for (int i = 0; i < requests; i++)
+			fetch_one(http, i, TRUE, GRITS_REFRESH);
+		wait_done(requests);
+	}
+	gdouble secs = (g_get_monotonic_time() - start) / 1e6;
+
+	g_print("%-14s per_host=%2d: %4d/%d tiles in %6.2fs, %7.1f tiles/s, "
+			"%2d connections\n",
+			name, per_host, fetched, requests, secs, fetched/secs,
+			g_hash_table_size(conns));
+	grits_http_free(http);
+}
+
+/* Several layers asking for the same tiles at once, and then for tiles which
+ * are missing from the server, twice */
+static void run_shared(gint copies)
+{
+	GritsHttp *http = grits_http_new("bench/");
+	fetched = done = served = 0;
+	for (int i = 0; i < requests; i++)
+		for (int c = 0; c < copies; c++)
+			fetch_one(http, i, TRUE, GRITS_REFRESH);
+	wait_done(requests*copies);
+	g_print("shared x%d:     %4d/%d tiles, %4d served\n",
+			copies, fetched, requests*copies, served);
+
+	fetched = done = served = 0;
+	for (int pass = 1; pass <= 2; pass++) {
+		for (int i = 0; i < requests; i++)
+			fetch_one(http, requests+i, TRUE, GRITS_ONCE);
+		wait_done(requests*pass);
+	}
+	g_print("missing x2:     %4d/%d tiles, %4d served\n",
+			fetched, requests*2, served);
+	grits_http_free(http);
+}
+
+/* Refresh tiles which have validators, the second pass is unchanged and the
+ * third pass is after the tiles change on the server */
+static void run_refresh(void)
+{
+	GritsHttp *http = grits_http_new("bench/");
+	version = 1;
+	for (int pass = 1; pass <= 3; pass++) {
+		if (pass == 3)
+			version++;
+		fetched = done = served = 0;
+		served_bytes = 0;
+		gint64 start = g_get_monotonic_time();
+		for (int i = 0; i < requests; i++)
+			fetch_one(http, i, TRUE, GRITS_REFRESH);
+		wait_done(requests);
+		gdouble secs = (g_get_monotonic_time() - start) / 1e6;
+		g_print("refresh %d:      %4d/%d tiles in %6.2fs, %7dkB sent\n",
+				pass, fetched, requests, secs,
+				(gint)(served_bytes/1024));
+	}
+	grits_http_free(http);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) latency  = atoi(argv[1]);
+	if (argc > 2) requests = atoi(argv[2]);
+	tile_size = (argc > 3 ? atoi(argv[3]) : 16) * 1024;
+	tile      = g_malloc0(tile_size);
+	conns     = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	base = g_strdup_printf("http://127.0.0.1:%d", server_start());
+	g_print("%d requests, %dms latency, %dkB tiles\n",
+			requests, latency, (gint)tile_size/1024);
+
+	/* Idle connections are kept open between runs, so the limits have to
+	 * increase from one run to the next */
+	run("1 thread",     1, 1);
+	run("async",        0, 2);
+	run("4 threads",    4, 6);
+	run("async",        0, 6);
+	run("16 threads",  16, 16);
+	run("async",        0, 16);
+	run("async",        0, 64);
+	run_shared(4);
+	run_refresh();
+	return 0;
+}
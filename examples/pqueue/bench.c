@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include "gpqueue.h"
+
+/* Built twice, against the Fibonacci heap and the d-ary heap */
+#ifdef FIBONACCI
+#define NAME "fib "
+#else
+#define NAME "heap"
+#endif
+
+/* Number of split/merge operations in the churn test */
+#define CHURN 100000
+
+/* Something like a RoamTriangle */
+typedef struct {
+	gdouble       error;
+	GPQueueHandle handle;
+} Item;
+
+/* Largest error first, like tri_cmp */
+static gint item_cmp(Item *a, Item *b, gpointer data)
+{
+	if      (a->error < b->error) return  1;
+	else if (a->error > b->error) return -1;
+	else                          return  0;
+}
+
+static gdouble elapsed(gint64 start)
+{
+	return (g_get_monotonic_time() - start) / 1000.0;
+}
+
+/* Small changes to every error, as when the camera moves a little */
+static void pan(Item *items, gint count)
+{
+	for (int i = 0; i < count; i++)
+		items[i].error *= g_random_double_range(0.9, 1.1);
+}
+
+/* Check that items come out in order */
+static gboolean check(GPQueue *pqueue)
+{
+	Item *prev = g_pqueue_pop(pqueue);
+	while (!g_pqueue_is_empty(pqueue)) {
+		Item *item = g_pqueue_pop(pqueue);
+		if (item->error > prev->error)
+			return FALSE;
+		prev = item;
+	}
+	return TRUE;
+}
+
+static void test(gint count)
+{
+	GPQueue *pqueue = g_pqueue_new((GCompareDataFunc)item_cmp, NULL);
+	Item    *items  = g_new0(Item, count + CHURN*2);
+	gint     nitems = count;
+	gint64   start;
+
+	/* Build the initial mesh */
+	start = g_get_monotonic_time();
+	for (int i = 0; i < count; i++) {
+		items[i].error  = g_random_double_range(0, 1000);
+		items[i].handle = g_pqueue_push(pqueue, &items[i]);
+	}
+	gdouble push = elapsed(start);
+
+	/* Update every priority, as roam_sphere_update_errors does */
+	pan(items, count);
+	start = g_get_monotonic_time();
+	for (int i = 0; i < count; i++)
+		g_pqueue_priority_changed(pqueue, items[i].handle);
+	gdouble changed = elapsed(start);
+
+	/* Or rebuild the whole queue at once */
+	gdouble rebuild = 0;
+#ifndef FIBONACCI
+	pan(items, count);
+	start = g_get_monotonic_time();
+	g_pqueue_rebuild(pqueue);
+	rebuild = elapsed(start);
+#endif
+
+	/* Split the worst item into two children, or merge a random one */
+	start = g_get_monotonic_time();
+	for (int i = 0; i < CHURN; i++) {
+		if (i % 3 != 2) {
+			Item *top = g_pqueue_pop(pqueue);
+			for (int j = 0; j < 2; j++) {
+				Item *kid   = &items[nitems++];
+				kid->error  = top->error * g_random_double_range(0.2, 0.6);
+				kid->handle = g_pqueue_push(pqueue, kid);
+			}
+			top->handle = NULL;
+		} else {
+			Item *item = &items[g_random_int_range(0, nitems)];
+			if (item->handle)
+				g_pqueue_remove(pqueue, item->handle);
+			item->handle = NULL;
+		}
+	}
+	gdouble churn = elapsed(start);
+
+	/* Drain */
+	start = g_get_monotonic_time();
+	gboolean ok = check(pqueue);
+	gdouble pop = elapsed(start);
+
+	g_print("%s %7d items: push=%8.3fms changed=%8.3fms rebuild=%8.3fms "
+			"churn=%8.3fms pop=%8.3fms %s\n",
+			NAME, count, push, changed, rebuild, churn, pop,
+			ok ? "ok" : "OUT OF ORDER");
+
+	g_pqueue_free(pqueue);
+	g_free(items);
+}
+
+int main(int argc, char **argv)
+{
+	gint counts[] = {2000, 20000, 200000};
+	for (int i = 0; i < G_N_ELEMENTS(counts); i++)
+		test(counts[i]);
+	return 0;
+}
@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <glib.h>
+#include <GL/glu.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "grits-util.h"
+#include "roam.h"
+#include "../tester.h"
+
+/* Number of timed passes for each test */
+#define PASSES 20
+
+/* Camera elevation used by grow and time_errors */
+static gdouble elev = EARTH_R;
+
+/* Split the sphere until it has at least target polygons */
+static void grow(RoamSphere *sphere, gint target)
+{
+	gint next = sphere->polys;
+	while (sphere->polys < target) {
+		if (sphere->polys >= next) {
+			grits_tester_set_view(sphere->view, 40, -100, elev, 0);
+			roam_sphere_update_errors(sphere);
+			next = sphere->polys * 2;
+		}
+		roam_sphere_split_one(sphere);
+	}
+}
+
+/* Time update_errors while panning the camera */
+static gdouble time_errors(RoamSphere *sphere)
+{
+	gint64 start = g_get_monotonic_time();
+	for (int i = 0; i < PASSES; i++) {
+		grits_tester_set_view(sphere->view,
+				40, -100 + i*0.1*elev/EARTH_R, elev, 0);
+		roam_sphere_update_errors(sphere);
+	}
+	return (g_get_monotonic_time() - start) / 1000.0 / PASSES;
+}
+
+static void test_layout(gint target)
+{
+	RoamSphere *sphere = roam_sphere_new();
+	sphere->incremental = FALSE;
+	grow(sphere, target);
+
+	sphere->packed.enabled = FALSE;
+	gdouble pointers = time_errors(sphere);
+	sphere->packed.enabled = TRUE;
+	gdouble packed   = time_errors(sphere);
+
+	g_print("layout  %7d polys: pointers=%8.3fms packed=%8.3fms (%.2fx)\n",
+			sphere->polys, pointers, packed, pointers/packed);
+	roam_sphere_free(sphere);
+}
+
+/* Time update_errors with 1 to N threads */
+static void test_threads(gint target, gint cpus)
+{
+	RoamSphere *sphere = roam_sphere_new();
+	sphere->incremental = FALSE;
+	grow(sphere, target);
+
+	gdouble serial = 0;
+	for (int threads = 1; threads <= cpus; threads++) {
+		roam_sphere_set_threads(sphere, threads);
+		gdouble time = time_errors(sphere);
+		if (threads == 1)
+			serial = time;
+		g_print("threads %7d polys: threads=%-2d %8.3fms (%.2fx)\n",
+				sphere->polys, threads, time, serial/time);
+	}
+	roam_sphere_free(sphere);
+}
+
+/* Compare full and incremental updates for small pans, the mesh is grown
+ * from high up and then viewed from closer to the ground. Incremental updates
+ * are exact, refreshing the edges of the view less often is not. */
+static void test_incremental(gint target, gdouble near)
+{
+	RoamSphere *sphere = roam_sphere_new();
+	grow(sphere, target);
+
+	elev = near;
+	sphere->incremental = FALSE;
+	gdouble full = time_errors(sphere);
+	sphere->incremental = TRUE;
+	time_errors(sphere); // let the update settle
+	gdouble incremental = time_errors(sphere);
+	gint evaluated = sphere->packed.ntlist;
+	sphere->refresh = 4;
+	gdouble refresh = time_errors(sphere);
+	elev = EARTH_R;
+
+	g_print("incr    %7d polys: elev=%7.0fkm full=%8.3fms incremental=%8.3fms "
+			"(%.2fx) evaluated=%d refresh=%8.3fms (%.2fx) evaluated=%d\n",
+			sphere->polys, near/1000, full, incremental, full/incremental,
+			evaluated, refresh, full/refresh, sphere->packed.ntlist);
+	roam_sphere_free(sphere);
+}
+
+/* Look at the other side of the globe from where the mesh was grown */
+static void test_culling(gint target)
+{
+	RoamSphere *sphere = roam_sphere_new();
+	grow(sphere, target);
+
+	gdouble times[2];
+	for (int i = 0; i < 2; i++) {
+		/* Views before the first pass let the update settle */
+		sphere->incremental = i;
+		gint64 start = 0;
+		for (int j = -PASSES; j < PASSES; j++) {
+			if (j == 0)
+				start = g_get_monotonic_time();
+			grits_tester_set_view(sphere->view, 40, 80 + j*0.1, EARTH_R*2, 0);
+			roam_sphere_update_errors(sphere);
+		}
+		times[i] = (g_get_monotonic_time() - start) / 1000.0 / PASSES;
+	}
+
+	g_print("culling %7d polys: full=%8.3fms culled=%8.3fms (%.2fx) "
+			"evaluated=%d frustum=%d horizon=%d\n",
+			sphere->polys, times[0], times[1], times[0]/times[1],
+			sphere->culling.evaluated, sphere->culling.frustum,
+			sphere->culling.horizon);
+	roam_sphere_free(sphere);
+}
+
+/* Refine a new sphere frame by frame within a time budget */
+/* Leaf lookup by walking from the roots, for comparison with the index */
+static void walk_intersect(RoamTriangle *tri, GPtrArray *array,
+		gdouble n, gdouble s, gdouble e, gdouble w)
+{
+	if (tri->edge.n <= s || tri->edge.s >= n ||
+	    tri->edge.e <= w || tri->edge.w >= e)
+		return;
+	if (tri->kids[0] && tri->kids[1]) {
+		walk_intersect(tri->kids[0], array, n, s, e, w);
+		walk_intersect(tri->kids[1], array, n, s, e, w);
+	} else {
+		g_ptr_array_add(array, tri);
+	}
+}
+
+static gint ptr_cmp(gconstpointer a, gconstpointer b)
+{
+	gconstpointer pa = *(gpointer*)a, pb = *(gpointer*)b;
+	return pa < pb ? -1 : pa > pb ? 1 : 0;
+}
+
+/* Look up the triangles for an 8x8 grid of tiles around the camera, like
+ * grits_tile_draw does */
+static void test_intersect(gint target, gdouble size)
+{
+	RoamSphere *sphere = roam_sphere_new();
+	grow(sphere, target);
+
+	gdouble tiles[64][4];
+	gint ntiles = 0;
+	gdouble top  = MIN(40 + 4*size, 90);
+	gdouble left = MAX(-100 - 4*size, -180);
+	for (int i = 0; i < 8; i++)
+	for (int j = 0; j < 8; j++) {
+		gdouble *t = tiles[ntiles++];
+		t[0] = top  - i*size; t[1] = t[0] - size;
+		t[3] = left + j*size; t[2] = t[3] + size;
+	}
+
+	GPtrArray *walked = g_ptr_array_new();
+	GPtrArray *found  = g_ptr_array_new();
+	gdouble times[2] = {0, 0};
+	gint results = 0, bad = 0;
+	for (int pass = 0; pass < PASSES; pass++)
+	for (int i = 0; i < ntiles; i++) {
+		gdouble *t = tiles[i];
+		gint64 start = g_get_monotonic_time();
+		g_ptr_array_set_size(walked, 0);
+		for (int r = 0; r < G_N_ELEMENTS(sphere->roots); r++)
+			walk_intersect(sphere->roots[r], walked,
+					t[0], t[1], t[2], t[3]);
+		gint64 mid = g_get_monotonic_time();
+		found = roam_sphere_get_intersect(sphere, FALSE,
+				t[0], t[1], t[2], t[3], found);
+		gint64 end = g_get_monotonic_time();
+		times[0] += (mid - start) / 1000.0 / PASSES;
+		times[1] += (end - mid)   / 1000.0 / PASSES;
+
+		if (pass == 0) {
+			g_ptr_array_sort(walked, ptr_cmp);
+			g_ptr_array_sort(found,  ptr_cmp);
+			results += found->len;
+			if (walked->len != found->len)
+				bad++;
+			else for (guint k = 0; k < found->len; k++)
+				if (walked->pdata[k] != found->pdata[k]) {
+					bad++;
+					break;
+				}
+		}
+	}
+
+	g_print("intersect %7d polys: tiles=%5.2fdeg results=%6d "
+			"walk=%8.3fms index=%8.3fms (%.2fx) mismatched=%d\n",
+			sphere->polys, size, results, times[0], times[1],
+			times[0]/times[1], bad);
+	g_ptr_array_free(walked, TRUE);
+	g_ptr_array_free(found,  TRUE);
+	roam_sphere_free(sphere);
+}
+
+/* Count how often tiles would rebuild their vertex buffers, see
+ * grits_tile_draw_one */
+static void test_version(gint target, gdouble pan)
+{
+	RoamSphere *sphere = roam_sphere_new();
+	grow(sphere, target);
+	roam_sphere_set_budget(sphere, target, 5000, 0);
+
+	/* Let the mesh settle at the starting view */
+	grits_tester_set_view(sphere->view, 40, -100, EARTH_R/4, 0);
+	roam_sphere_update_errors(sphere);
+	for (int i = 0; i < 1000 && roam_sphere_split_merge(sphere); i++)
+		roam_sphere_update_errors(sphere);
+
+	gint versions[64] = {};
+	gint rebuilds = 0;
+	gdouble time = 0;
+	for (int frame = 0; frame < PASSES; frame++) {
+		grits_tester_set_view(sphere->view, 40, -100 + frame*pan, EARTH_R/4, 0);
+		roam_sphere_update_errors(sphere);
+		roam_sphere_split_merge(sphere);
+		gint64 start = g_get_monotonic_time();
+		for (int i = 0; i < 64; i++) {
+			gdouble n = 48 - (i/8)*2, w = -108 + (i%8)*2;
+			gint version = roam_sphere_get_version(sphere,
+					n, n-2, w+2, w);
+			if (version != versions[i])
+				rebuilds++;
+			versions[i] = version;
+		}
+		time += (g_get_monotonic_time() - start) / 1000.0 / PASSES;
+	}
+
+	g_print("version %7d polys: pan=%4.2fdeg rebuilds=%4d/%d check=%8.3fms\n",
+			sphere->polys, pan, rebuilds, 64*PASSES, time);
+	roam_sphere_free(sphere);
+}
+
+static void test_budget(gint target, gint budget)
+{
+	RoamSphere *sphere = roam_sphere_new();
+	roam_sphere_set_budget(sphere, target, budget, 0);
+
+	gint frames = 0;
+	gint64 worst = 0;
+	do {
+		grits_tester_set_view(sphere->view, 40, -100 + frames*0.01, EARTH_R, 0);
+		roam_sphere_update_errors(sphere);
+		roam_sphere_split_merge(sphere);
+		worst = MAX(worst, sphere->stats.time);
+		frames++;
+	} while (!sphere->stats.done && frames < 1000);
+
+	g_print("budget  %7d polys: budget=%5dus frames=%-4d worst=%5dus error=%g\n",
+			sphere->polys, budget, frames, (gint)worst,
+			sphere->stats.error);
+	roam_sphere_free(sphere);
+}
+
+/* Compare batched projection against gluProject */
+static void test_project(gint count)
+{
+	RoamSphere *sphere = roam_sphere_new();
+	grits_tester_set_view(sphere->view, 40, -100, EARTH_R, 0);
+	RoamView *view = sphere->view;
+
+	gdouble (*in)[3]   = g_malloc(sizeof(gdouble[3]) * count);
+	gdouble (*glu)[3]  = g_malloc(sizeof(gdouble[3]) * count);
+	gdouble (*fast)[3] = g_malloc(sizeof(gdouble[3]) * count);
+	for (int i = 0; i < count; i++)
+		lle2xyz(g_random_double_range(-90, 90),
+			g_random_double_range(-180, 180),
+			g_random_double_range(0, 10000),
+			&in[i][0], &in[i][1], &in[i][2]);
+
+	gint64 start = g_get_monotonic_time();
+	for (int p = 0; p < PASSES; p++)
+		for (int i = 0; i < count; i++)
+			gluProject(in[i][0], in[i][1], in[i][2],
+				view->model, view->proj, view->view,
+				&glu[i][0], &glu[i][1], &glu[i][2]);
+	gdouble slow = (g_get_monotonic_time() - start) / 1000.0 / PASSES;
+
+	start = g_get_monotonic_time();
+	for (int p = 0; p < PASSES; p++)
+		roam_view_project(view, in, fast, count);
+	gdouble batch = (g_get_monotonic_time() - start) / 1000.0 / PASSES;
+
+	gdouble err = 0;
+	for (int i = 0; i < count; i++)
+		for (int j = 0; j < 3; j++)
+			err = MAX(err, fabs(glu[i][j] - fast[i][j]) /
+					MAX(1, fabs(glu[i][j])));
+
+	g_print("project %7d points: gluProject=%8.3fms batch=%8.3fms (%.2fx) err=%g\n",
+			count, slow, batch, slow/batch, err);
+	g_free(in);
+	g_free(glu);
+	g_free(fast);
+	roam_sphere_free(sphere);
+}
+
+int main(int argc, char **argv)
+{
+	gint targets[] = {2000, 20000, 200000};
+	gint cpus = argc > 1 ? atoi(argv[1]) : g_get_num_processors();
+	for (int i = 0; i < G_N_ELEMENTS(targets); i++)
+		test_project(targets[i]);
+	for (int i = 0; i < G_N_ELEMENTS(targets); i++)
+		test_layout(targets[i]);
+	for (int i = 0; i < G_N_ELEMENTS(targets); i++)
+		test_threads(targets[i], cpus);
+	for (int i = 0; i < G_N_ELEMENTS(targets); i++) {
+		test_incremental(targets[i], EARTH_R);
+		test_incremental(targets[i], EARTH_R/10);
+	}
+	for (int i = 0; i < G_N_ELEMENTS(targets); i++)
+		test_culling(targets[i]);
+	for (int i = 0; i < G_N_ELEMENTS(targets); i++) {
+		test_intersect(targets[i], 22.5);
+		test_intersect(targets[i], 1.40625);
+	}
+	for (int i = 0; i < G_N_ELEMENTS(targets); i++) {
+		test_version(targets[i], 0);
+		test_version(targets[i], 0.05);
+	}
+	for (int i = 0; i < G_N_ELEMENTS(targets); i++) {
+		test_budget(targets[i], 2000);
+		test_budget(targets[i], 10000);
+	}
+	return 0;
+}
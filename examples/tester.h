@@ -20,7 +20,11 @@
 
 #include <gtk/gtk.h>
 #include <glib-object.h>
+#include <math.h>
+#include <string.h>
 
+#include <grits-util.h>
+#include <roam.h>
 #include <objects/grits-object.h>
 
 /* Type macros */
@@ -53,4 +57,73 @@ GritsTester *grits_tester_new();
 gpointer grits_tester_add(GritsTester *tester, GritsObject *object);
 GritsObject *grits_tester_remove(GritsTester *tester, gpointer ref);
 
+/* View helpers for the benchmarks, these are inline so that benchmarks can
+ * use them without linking the tester widget */
+
+/* Column major matrix helpers, these match the OpenGL functions */
+static inline void mat_mult(gdouble *out, gdouble *a, gdouble *b)
+{
+	gdouble tmp[16];
+	for (int c = 0; c < 4; c++)
+	for (int r = 0; r < 4; r++) {
+		tmp[c*4+r] = 0;
+		for (int k = 0; k < 4; k++)
+			tmp[c*4+r] += a[k*4+r] * b[c*4+k];
+	}
+	memcpy(out, tmp, sizeof(tmp));
+}
+
+static inline void mat_rotate(gdouble *m, gdouble ang, gdouble x, gdouble y, gdouble z)
+{
+	gdouble c = cos(deg2rad(ang)), s = sin(deg2rad(ang));
+	gdouble rot[16] = {
+		x*x*(1-c)+c,   y*x*(1-c)+z*s, x*z*(1-c)-y*s, 0,
+		x*y*(1-c)-z*s, y*y*(1-c)+c,   y*z*(1-c)+x*s, 0,
+		x*z*(1-c)+y*s, y*z*(1-c)-x*s, z*z*(1-c)+c,   0,
+		0,             0,             0,             1,
+	};
+	mat_mult(m, m, rot);
+}
+
+static inline void mat_translate(gdouble *m, gdouble x, gdouble y, gdouble z)
+{
+	gdouble tr[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, x,y,z,1};
+	mat_mult(m, m, tr);
+}
+
+/* Mimic _set_projection in grits-opengl.c for an 800x600 window, looking at
+ * lat, lon from elev and tilted by rx degrees. Each call gives the view a new
+ * version, which is unique across views. */
+static inline void grits_tester_set_view(RoamView *view,
+		gdouble lat, gdouble lon, gdouble elev, gdouble rx)
+{
+	static gint version = 0;
+	gint width = 800, height = 600;
+
+	gdouble ang  = atan((height/2)/FOV_DIST)*2;
+	gdouble near = MAX(elev*0.75 - 10000, 50);
+	gdouble far  = elev + EARTH_R*1.25 + 10000;
+	gdouble f    = 1/tan(ang/2);
+	gdouble proj[16] = {
+		f/((gdouble)width/height), 0, 0,                         0,
+		0,                         f, 0,                         0,
+		0,                         0, (far+near)/(near-far),    -1,
+		0,                         0, (2*far*near)/(near-far),   0,
+	};
+	memcpy(view->proj, proj, sizeof(proj));
+
+	gdouble ident[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1};
+	memcpy(view->model, ident, sizeof(ident));
+	mat_rotate(view->model, rx, 1, 0, 0);
+	mat_translate(view->model, 0, 0, -elev2rad(elev));
+	mat_rotate(view->model,  lat, 1, 0, 0);
+	mat_rotate(view->model, -lon, 0, 1, 0);
+
+	view->view[0] = 0;
+	view->view[1] = 0;
+	view->view[2] = width;
+	view->view[3] = height;
+	view->version = ++version;
+}
+
 #endif
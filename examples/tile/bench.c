@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include <grits.h>
+
+#include "../tester.h"
+
+/* Counted instead of loading anything */
+static gint requests = 0;
+
+/* Camera positions, as passed to grits_viewer_set_location and rotation */
+typedef struct {
+	gdouble lat, lon, elev;
+	gdouble rx;
+} Camera;
+
+/* Pretend the tile loaded immediately */
+static void load_func(GritsTile *tile, gpointer user_data)
+{
+	tile->data = GINT_TO_POINTER(TRUE);
+	requests++;
+}
+
+static void free_func(GritsTile *tile, gpointer user_data)
+{
+}
+
+/* Check tiles against the camera view */
+static gboolean visible_func(gdouble n, gdouble s, gdouble e, gdouble w,
+		gpointer view)
+{
+	return roam_view_visible(view, n, s, e, w);
+}
+
+/* Tile settings used by the sat, elev and map plugins */
+typedef struct {
+	const gchar *name;
+	gdouble      res;
+	gint         width;
+} Layer;
+
+static Layer layers[] = {
+	{"sat",  500, 1024},
+	{"elev",  50, 1024},
+	{"map",    1,  256},
+};
+
+/* Count the tiles requested along a camera path */
+static gint run(Layer *layer, Camera *path, gint count, gboolean visible)
+{
+	RoamView  *view = g_new0(RoamView, 1);
+	GritsTile *root = grits_tile_new(NULL, NORTH, SOUTH, EAST, WEST);
+	view->mversion = -1;
+	requests = 0;
+	for (int i = 0; i < count; i++) {
+		GritsPoint eye = {path[i].lat, path[i].lon, path[i].elev};
+		grits_tester_set_view(view, path[i].lat, path[i].lon,
+				path[i].elev, path[i].rx);
+		grits_tile_update_visible(root, &eye,
+				visible ? visible_func : NULL, view,
+				layer->res, layer->width, layer->width,
+				load_func, NULL);
+	}
+	grits_tile_free(root, free_func, NULL);
+	g_free(view);
+	return requests;
+}
+
+static void test_path(const gchar *name, Camera *path, gint count)
+{
+	for (int i = 0; i < G_N_ELEMENTS(layers); i++) {
+		gint all     = run(&layers[i], path, count, FALSE);
+		gint visible = run(&layers[i], path, count, TRUE);
+		g_print("%-5s %-4s %2d steps: distance=%5d visible=%5d (%.2fx)\n",
+				name, layers[i].name, count,
+				all, visible, (gdouble)all/visible);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	Camera path[64];
+
+	/* Zoom from orbit to 5km */
+	for (int i = 0; i <= 40; i++)
+		path[i] = (Camera){40, -100, 20000e3*pow(5e3/20000e3, i/40.0), 0};
+	test_path("zoom", path, 41);
+
+	/* Pan 2 degrees east at 5km */
+	for (int i = 0; i <= 40; i++)
+		path[i] = (Camera){40, -100 + i*0.05, 5e3, 0};
+	test_path("pan", path, 41);
+
+	/* Tilt towards the horizon at 50km */
+	for (int i = 0; i <= 30; i++)
+		path[i] = (Camera){40, -98, 50e3, -i*2.5};
+	test_path("tilt", path, 31);
+
+	/* Circle the globe from orbit */
+	for (int i = 0; i <= 40; i++)
+		path[i] = (Camera){20, -100 + i*9, 8000e3, 0};
+	test_path("orbit", path, 41);
+
+	return 0;
+}
@@ -0,0 +1,702 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * SECTION:grits-cache
+ * @short_description: Disk cache limits
+ *
+ * #GritsCache keeps the files downloaded for a cache prefix within a quota.
+ * #GritsHttp reports each file as it is downloaded or read from the cache,
+ * the size and last access time of each file are kept in memory and saved to
+ * a small index file in the cache directory. Once the quota is exceeded the
+ * least recently used files are removed.
+ *
+ * The work is done by a single background thread which is shared by all
+ * caches. It runs every few minutes, or sooner when a cache is well over its
+ * quota, and pauses every few file operations so that it does not compete
+ * with tile loading for the disk. The cache directory is only scanned once a
+ * day, or when the index is missing, which also removes partial downloads and
+ * temporary files which have been abandoned.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "grits-cache.h"
+#include "grits-pack.h"
+
+#define CACHE_MAGIC    "GRITSAC1"
+#define CACHE_INDEX    ".access"
+#define CACHE_QUOTA    (G_GINT64_CONSTANT(1)<<30)
+#define SWEEP_DELAY    60         // seconds after startup
+#define SWEEP_INTERVAL (10*60)    // seconds between sweeps
+#define SWEEP_MIN      10         // seconds between sweeps, when woken up
+#define SWEEP_BATCH    64         // file operations between pauses
+#define SWEEP_PAUSE    10000      // microseconds
+#define SCAN_INTERVAL  (24*60*60) // seconds between directory scans
+#define PART_AGE       (60*60)    // seconds before partial files are removed
+#define TEMP_AGE       (10*60)    // seconds before index pages are removed
+
+/* Start of the index file */
+typedef struct {
+	gchar   magic[8];
+	guint32 scanned;
+	guint32 count;
+} GritsCacheHeader;
+
+/* Entries in the index file are followed by the key */
+typedef struct {
+	gint64  size;
+	guint32 atime;
+	guint16 key_len;
+	guint8  packed;
+	guint8  pad;
+} GritsCacheRecord;
+
+typedef struct {
+	gint64   size;   /* bytes, or -1 if not known yet */
+	guint32  atime;  /* seconds since the epoch */
+	gboolean packed;
+} GritsCacheEntry;
+
+/* For sorting files by access time */
+typedef struct {
+	gchar           *key;
+	GritsCacheEntry *entry;
+} GritsCacheItem;
+
+struct _GritsCache {
+	gchar      *dir;
+	gchar      *index_path;
+	GHashTable *files;
+	GritsPack  *pack;
+	gint64      quota;
+	gint64      used;
+	guint32     scanned;
+	gboolean    dirty;
+	gint        refs;
+	GMutex      lock;
+};
+
+/* Caches are shared by directory, and swept by a single thread */
+static GHashTable *grits_caches        = NULL;
+static GMutex      grits_caches_lock;
+static GCond       grits_caches_cond;
+static gboolean    grits_caches_wakeup = FALSE;
+static gint64      grits_cache_quota   = CACHE_QUOTA;
+
+static guint32 _grits_cache_now(void)
+{
+	return g_get_real_time() / G_USEC_PER_SEC;
+}
+
+/* Get the quota in bytes, or 0 for no limit, while holding the lock */
+static gint64 _grits_cache_get_quota(GritsCache *cache)
+{
+	if (cache->quota < 0)
+		return 0;
+	return MAX(cache->quota ?: grits_cache_quota, 0);
+}
+
+/* Add or update a file, while holding the lock */
+static void _grits_cache_add(GritsCache *cache, const gchar *key,
+		gint64 size, guint32 atime, gboolean packed)
+{
+	GritsCacheEntry *entry = g_hash_table_lookup(cache->files, key);
+	if (!entry) {
+		entry = g_new0(GritsCacheEntry, 1);
+		entry->size = -1;
+		g_hash_table_insert(cache->files, g_strdup(key), entry);
+	}
+	if (size >= 0) {
+		cache->used += size - MAX(entry->size, 0);
+		entry->size  = size;
+	}
+	if (atime > entry->atime)
+		entry->atime = atime;
+	entry->packed = packed;
+	cache->dirty  = TRUE;
+}
+
+/* Remove a file, while holding the lock */
+static void _grits_cache_remove(GritsCache *cache, const gchar *key)
+{
+	GritsCacheEntry *entry = g_hash_table_lookup(cache->files, key);
+	if (!entry)
+		return;
+	cache->used -= MAX(entry->size, 0);
+	cache->dirty = TRUE;
+	g_hash_table_remove(cache->files, key);
+}
+
+static void _grits_cache_wakeup(void)
+{
+	g_mutex_lock(&grits_caches_lock);
+	grits_caches_wakeup = TRUE;
+	g_cond_signal(&grits_caches_cond);
+	g_mutex_unlock(&grits_caches_lock);
+}
+
+/* Give other threads a chance at the disk */
+static void _grits_cache_pause(gint *ops)
+{
+	if (++*ops % SWEEP_BATCH == 0)
+		g_usleep(SWEEP_PAUSE);
+}
+
+/***************
+ * Index files *
+ ***************/
+static void _grits_cache_load(GritsCache *cache)
+{
+	gsize  len;
+	gchar *data = NULL;
+	if (!g_file_get_contents(cache->index_path, &data, &len, NULL))
+		return;
+
+	GritsCacheHeader header = {};
+	gboolean ok  = len >= sizeof(header);
+	gsize    pos = sizeof(header);
+	if (ok) {
+		memcpy(&header, data, sizeof(header));
+		ok = !memcmp(header.magic, CACHE_MAGIC, 8);
+	}
+	for (guint32 i = 0; ok && i < header.count; i++) {
+		GritsCacheRecord record;
+		if (pos + sizeof(record) > len) {
+			ok = FALSE;
+			break;
+		}
+		memcpy(&record, data+pos, sizeof(record));
+		pos += sizeof(record);
+		if (record.key_len == 0 || pos + record.key_len > len) {
+			ok = FALSE;
+			break;
+		}
+		gchar *key = g_strndup(data+pos, record.key_len);
+		_grits_cache_add(cache, key, record.size, record.atime,
+				record.packed);
+		pos += record.key_len;
+		g_free(key);
+	}
+
+	if (ok) {
+		cache->scanned = header.scanned;
+		cache->dirty   = FALSE;
+	} else {
+		g_warning("GritsCache: load - ignoring damaged %s",
+				cache->index_path);
+		g_hash_table_remove_all(cache->files);
+		cache->used = 0;
+	}
+	g_debug("GritsCache: load - %s files=%d used=%"G_GINT64_FORMAT,
+			cache->dir, g_hash_table_size(cache->files), cache->used);
+	g_free(data);
+}
+
+static void _grits_cache_save(GritsCache *cache)
+{
+	g_mutex_lock(&cache->lock);
+	if (!cache->dirty) {
+		g_mutex_unlock(&cache->lock);
+		return;
+	}
+	GritsCacheHeader header = {CACHE_MAGIC, cache->scanned};
+	GByteArray *data = g_byte_array_sized_new(sizeof(header) +
+			g_hash_table_size(cache->files) * (sizeof(GritsCacheRecord)+16));
+	g_byte_array_append(data, (guint8*)&header, sizeof(header));
+
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init(&iter, cache->files);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		GritsCacheEntry *entry = value;
+		gsize key_len = strlen(key);
+		if (key_len > G_MAXUINT16)
+			continue;
+		GritsCacheRecord record = {entry->size, entry->atime,
+			key_len, entry->packed};
+		g_byte_array_append(data, (guint8*)&record, sizeof(record));
+		g_byte_array_append(data, key, key_len);
+		header.count++;
+	}
+	memcpy(data->data, &header, sizeof(header));
+	cache->dirty = FALSE;
+	g_mutex_unlock(&cache->lock);
+
+	g_mkdir_with_parents(cache->dir, 0755);
+	if (!g_file_set_contents(cache->index_path,
+				(gchar*)data->data, data->len, NULL)) {
+		g_warning("GritsCache: save - error writing %s", cache->index_path);
+		g_mutex_lock(&cache->lock);
+		cache->dirty = TRUE;
+		g_mutex_unlock(&cache->lock);
+	}
+	g_byte_array_free(data, TRUE);
+}
+
+/************
+ * Sweeping *
+ ************/
+/* Find cached files below @path, and remove abandoned partial downloads and
+ * index pages from grits_http_available */
+static void _grits_cache_scan_dir(GritsCache *cache, const gchar *path,
+		const gchar *rel, GHashTable *found, guint32 now, gint *ops)
+{
+	GDir *dir = g_dir_open(path, 0, NULL);
+	if (!dir)
+		return;
+	const gchar *name;
+	while ((name = g_dir_read_name(dir))) {
+		gchar *full = g_build_filename(path, name, NULL);
+		gchar *key  = rel ? g_build_filename(rel, name, NULL) : g_strdup(name);
+		GStatBuf st;
+		_grits_cache_pause(ops);
+		if (g_stat(full, &st) != 0) {
+			/* Removed while scanning */
+		} else if (S_ISDIR(st.st_mode)) {
+			if (rel || !g_str_equal(name, ".meta"))
+				_grits_cache_scan_dir(cache, full, key, found, now, ops);
+		} else if (g_str_has_suffix(name, ".part")) {
+			if (st.st_mtime + PART_AGE < now) {
+				g_debug("GritsCache: scan - removing %s", full);
+				g_remove(full);
+			}
+		} else if (!rel && g_str_has_prefix(name, ".index.")) {
+			if (st.st_mtime + TEMP_AGE < now) {
+				g_debug("GritsCache: scan - removing %s", full);
+				g_remove(full);
+			}
+		} else if (!rel && (g_str_has_prefix(name, "pack.") ||
+		                    g_str_has_prefix(name, CACHE_INDEX))) {
+			/* Packs are listed separately */
+		} else {
+			GritsCacheEntry *entry = g_new0(GritsCacheEntry, 1);
+			entry->size  = st.st_size;
+			entry->atime = MAX(st.st_atime, st.st_mtime);
+			g_hash_table_insert(found, key, entry);
+			key = NULL;
+		}
+		g_free(full);
+		g_free(key);
+	}
+	g_dir_close(dir);
+}
+
+/* Replace the list of unpacked files with the files found in the cache
+ * directory, files which were used during the scan are kept */
+static void _grits_cache_scan(GritsCache *cache, guint32 now, gint *ops)
+{
+	GHashTable *found = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
+	_grits_cache_scan_dir(cache, cache->dir, NULL, found, now, ops);
+
+	GHashTableIter iter;
+	gpointer key, value;
+	g_mutex_lock(&cache->lock);
+	g_hash_table_iter_init(&iter, cache->files);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		GritsCacheEntry *entry = value;
+		if (!entry->packed && entry->atime < now &&
+		    !g_hash_table_lookup(found, key)) {
+			cache->used -= MAX(entry->size, 0);
+			g_hash_table_iter_remove(&iter);
+		}
+	}
+	g_hash_table_iter_init(&iter, found);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		GritsCacheEntry *entry = value;
+		_grits_cache_add(cache, key, entry->size, entry->atime, FALSE);
+	}
+	g_debug("GritsCache: scan - %s files=%d used=%"G_GINT64_FORMAT,
+			cache->dir, g_hash_table_size(found), cache->used);
+	cache->scanned = now;
+	cache->dirty   = TRUE;
+	g_mutex_unlock(&cache->lock);
+	g_hash_table_destroy(found);
+}
+
+static void _grits_cache_scan_pack_cb(const gchar *key, gsize size,
+		gpointer found)
+{
+	if (g_str_has_prefix(key, ".meta"))
+		return;
+	gsize *copy = g_new(gsize, 1);
+	*copy = size;
+	g_hash_table_insert(found, g_strdup(key), copy);
+}
+
+/* Update the list of packed files from the pack, this only uses the index
+ * which the pack keeps in memory */
+static void _grits_cache_scan_pack(GritsCache *cache, guint32 now)
+{
+	if (!cache->pack) {
+		gchar *data = g_build_filename(cache->dir, "pack.data", NULL);
+		if (g_file_test(data, G_FILE_TEST_EXISTS))
+			cache->pack = grits_pack_open(cache->dir);
+		g_free(data);
+	}
+	if (!cache->pack)
+		return;
+
+	GHashTable *found = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
+	grits_pack_foreach(cache->pack, _grits_cache_scan_pack_cb, found);
+
+	GHashTableIter iter;
+	gpointer key, value;
+	g_mutex_lock(&cache->lock);
+	g_hash_table_iter_init(&iter, cache->files);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		GritsCacheEntry *entry = value;
+		if (entry->packed && entry->atime < now &&
+		    !g_hash_table_lookup(found, key)) {
+			cache->used -= MAX(entry->size, 0);
+			g_hash_table_iter_remove(&iter);
+		}
+	}
+	g_hash_table_iter_init(&iter, found);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		_grits_cache_add(cache, key, *(gsize*)value, 0, TRUE);
+	g_mutex_unlock(&cache->lock);
+	g_hash_table_destroy(found);
+}
+
+/* Find the size of files which were used before they were scanned */
+static void _grits_cache_stat(GritsCache *cache, gint *ops)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GSList *unknown = NULL;
+	g_mutex_lock(&cache->lock);
+	g_hash_table_iter_init(&iter, cache->files);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		if (!((GritsCacheEntry*)value)->packed &&
+		    ((GritsCacheEntry*)value)->size < 0)
+			unknown = g_slist_prepend(unknown, g_strdup(key));
+	g_mutex_unlock(&cache->lock);
+
+	for (GSList *cur = unknown; cur; cur = cur->next) {
+		GStatBuf st;
+		gchar *path = g_build_filename(cache->dir, cur->data, NULL);
+		gboolean exists = g_stat(path, &st) == 0;
+		g_mutex_lock(&cache->lock);
+		if (exists)
+			_grits_cache_add(cache, cur->data, st.st_size, 0, FALSE);
+		else
+			_grits_cache_remove(cache, cur->data);
+		g_mutex_unlock(&cache->lock);
+		_grits_cache_pause(ops);
+		g_free(path);
+	}
+	g_slist_free_full(unknown, g_free);
+}
+
+static gint _grits_cache_compare(gconstpointer _a, gconstpointer _b)
+{
+	const GritsCacheItem *a = _a, *b = _b;
+	return a->entry->atime < b->entry->atime ? -1 :
+	       a->entry->atime > b->entry->atime ?  1 : 0;
+}
+
+/* Remove a file and its validators from the disk */
+static void _grits_cache_delete(GritsCache *cache, const gchar *key,
+		gboolean packed)
+{
+	gchar *meta = g_build_filename(".meta", key, NULL);
+	if (packed) {
+		if (cache->pack) {
+			grits_pack_remove(cache->pack, key);
+			grits_pack_remove(cache->pack, meta);
+		}
+	} else {
+		gchar *path      = g_build_filename(cache->dir, key,  NULL);
+		gchar *meta_path = g_build_filename(cache->dir, meta, NULL);
+		g_remove(path);
+		g_remove(meta_path);
+		g_free(path);
+		g_free(meta_path);
+	}
+	g_free(meta);
+}
+
+/* Remove the least recently used files until the cache is somewhat below
+ * its quota, so that it is not swept again right away */
+static void _grits_cache_evict(GritsCache *cache, gint *ops)
+{
+	g_mutex_lock(&cache->lock);
+	gint64 quota = _grits_cache_get_quota(cache);
+	if (quota <= 0 || cache->used <= quota) {
+		g_mutex_unlock(&cache->lock);
+		return;
+	}
+
+	/* Sort files by access time */
+	GArray *items = g_array_sized_new(FALSE, FALSE, sizeof(GritsCacheItem),
+			g_hash_table_size(cache->files));
+	GHashTableIter iter;
+	GritsCacheItem item;
+	g_hash_table_iter_init(&iter, cache->files);
+	while (g_hash_table_iter_next(&iter,
+				(gpointer*)&item.key, (gpointer*)&item.entry))
+		g_array_append_val(items, item);
+	g_array_sort(items, _grits_cache_compare);
+
+	/* Pick the oldest files */
+	GArray *victims = g_array_new(FALSE, FALSE, sizeof(GritsCacheItem));
+	gint64  target  = quota - quota/10;
+	for (guint i = 0; i < items->len && cache->used > target; i++) {
+		GritsCacheItem *old = &g_array_index(items, GritsCacheItem, i);
+		GritsCacheItem  victim = {g_strdup(old->key),
+			g_new(GritsCacheEntry, 1)};
+		*victim.entry = *old->entry;
+		g_array_append_val(victims, victim);
+		cache->used -= MAX(old->entry->size, 0);
+		cache->dirty = TRUE;
+		g_hash_table_remove(cache->files, old->key);
+	}
+	g_mutex_unlock(&cache->lock);
+	g_array_free(items, TRUE);
+
+	/* Remove them from the disk */
+	gint64   freed  = 0;
+	gboolean packed = FALSE;
+	for (guint i = 0; i < victims->len; i++) {
+		GritsCacheItem *victim = &g_array_index(victims, GritsCacheItem, i);
+		_grits_cache_delete(cache, victim->key, victim->entry->packed);
+		_grits_cache_pause(ops);
+		freed  += MAX(victim->entry->size, 0);
+		packed |= victim->entry->packed;
+		g_free(victim->key);
+		g_free(victim->entry);
+	}
+	g_debug("GritsCache: evict - %s removed %d files, %"G_GINT64_FORMAT" bytes",
+			cache->dir, victims->len, freed);
+	g_array_free(victims, TRUE);
+
+	/* Reclaim the space used by removed files once it adds up */
+	if (packed && cache->pack) {
+		guint64 live, total;
+		grits_pack_get_size(cache->pack, &live, &total);
+		if (total - live > total/2)
+			grits_pack_compact(cache->pack);
+	}
+}
+
+static void _grits_cache_sweep(GritsCache *cache)
+{
+	guint32 now = _grits_cache_now();
+	gint    ops = 0;
+	if (cache->scanned + SCAN_INTERVAL < now)
+		_grits_cache_scan(cache, now, &ops);
+	_grits_cache_scan_pack(cache, now);
+	_grits_cache_stat(cache, &ops);
+	_grits_cache_evict(cache, &ops);
+	_grits_cache_save(cache);
+}
+
+static gpointer _grits_cache_sweeper(gpointer data)
+{
+	gint64 wake = g_get_monotonic_time() + SWEEP_DELAY*G_USEC_PER_SEC;
+	g_mutex_lock(&grits_caches_lock);
+	while (TRUE) {
+		while (!grits_caches_wakeup &&
+		       g_cond_wait_until(&grits_caches_cond, &grits_caches_lock, wake))
+			;
+		grits_caches_wakeup = FALSE;
+
+		/* Hold a reference to each cache while it is swept */
+		GList *caches = g_hash_table_get_values(grits_caches);
+		for (GList *cur = caches; cur; cur = cur->next)
+			((GritsCache*)cur->data)->refs++;
+		g_mutex_unlock(&grits_caches_lock);
+		for (GList *cur = caches; cur; cur = cur->next) {
+			_grits_cache_sweep(cur->data);
+			grits_cache_close(cur->data);
+		}
+		g_list_free(caches);
+
+		/* Wait a little while even if we're woken up */
+		g_mutex_lock(&grits_caches_lock);
+		gint64 now = g_get_monotonic_time();
+		gint64 min = now + SWEEP_MIN*G_USEC_PER_SEC;
+		while (g_cond_wait_until(&grits_caches_cond, &grits_caches_lock, min))
+			;
+		wake = now + SWEEP_INTERVAL*G_USEC_PER_SEC;
+	}
+	return NULL;
+}
+
+/***********
+ * Methods *
+ ***********/
+/**
+ * grits_cache_set_default_quota:
+ * @bytes: the quota in bytes, or 0 for no limit
+ *
+ * Set the quota used by caches which do not have their own quota, see
+ * grits_cache_set_quota. The default is 1 GiB for each cache.
+ */
+void grits_cache_set_default_quota(gint64 bytes)
+{
+	g_debug("GritsCache: set_default_quota - %"G_GINT64_FORMAT, bytes);
+	g_mutex_lock(&grits_caches_lock);
+	grits_cache_quota   = bytes;
+	grits_caches_wakeup = TRUE;
+	g_cond_signal(&grits_caches_cond);
+	g_mutex_unlock(&grits_caches_lock);
+}
+
+/**
+ * grits_cache_open:
+ * @prefix: the prefix in the cache, as passed to grits_http_new
+ *
+ * Open the cache for a prefix. Opening the same prefix more than once returns
+ * the same cache. The index of the cache is read right away, the cache
+ * directory is scanned later from the background thread.
+ *
+ * Returns: the cache
+ */
+GritsCache *grits_cache_open(const gchar *prefix)
+{
+	gchar *dir = g_build_filename(g_get_user_cache_dir(), PACKAGE,
+			prefix, NULL);
+	g_mutex_lock(&grits_caches_lock);
+	if (!grits_caches) {
+		grits_caches = g_hash_table_new(g_str_hash, g_str_equal);
+		g_thread_new("grits-cache", _grits_cache_sweeper, NULL);
+	}
+	GritsCache *cache = g_hash_table_lookup(grits_caches, dir);
+	if (cache) {
+		cache->refs++;
+		g_mutex_unlock(&grits_caches_lock);
+		g_free(dir);
+		return cache;
+	}
+
+	g_debug("GritsCache: open - %s", dir);
+	cache = g_new0(GritsCache, 1);
+	cache->dir        = dir;
+	cache->index_path = g_build_filename(dir, CACHE_INDEX, NULL);
+	cache->files      = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
+	cache->refs       = 1;
+	g_mutex_init(&cache->lock);
+	_grits_cache_load(cache);
+	g_hash_table_insert(grits_caches, cache->dir, cache);
+	g_mutex_unlock(&grits_caches_lock);
+	return cache;
+}
+
+/**
+ * grits_cache_close:
+ * @cache: the cache to close
+ *
+ * Release a reference to the cache, once it is no longer used the index is
+ * written.
+ */
+void grits_cache_close(GritsCache *cache)
+{
+	g_mutex_lock(&grits_caches_lock);
+	if (--cache->refs > 0) {
+		g_mutex_unlock(&grits_caches_lock);
+		return;
+	}
+	g_hash_table_remove(grits_caches, cache->dir);
+	g_mutex_unlock(&grits_caches_lock);
+
+	g_debug("GritsCache: close - %s", cache->dir);
+	_grits_cache_save(cache);
+	if (cache->pack)
+		grits_pack_close(cache->pack);
+	g_hash_table_destroy(cache->files);
+	g_mutex_clear(&cache->lock);
+	g_free(cache->dir);
+	g_free(cache->index_path);
+	g_free(cache);
+}
+
+/**
+ * grits_cache_set_quota:
+ * @cache: the cache
+ * @bytes: the quota in bytes, 0 to use the default, or -1 for no limit
+ *
+ * Limit the disk space used by the files in a cache. Files are not removed
+ * right away, but shortly after the quota has been exceeded.
+ */
+void grits_cache_set_quota(GritsCache *cache, gint64 bytes)
+{
+	g_debug("GritsCache: set_quota - %s %"G_GINT64_FORMAT, cache->dir, bytes);
+	g_mutex_lock(&cache->lock);
+	cache->quota = bytes;
+	g_mutex_unlock(&cache->lock);
+	_grits_cache_wakeup();
+}
+
+/**
+ * grits_cache_touch:
+ * @cache:  the cache
+ * @local:  the name of the file in the cache
+ * @size:   the size of the file in bytes, or -1 if it has not changed
+ * @packed: whether the file is stored in a #GritsPack
+ *
+ * Record that a file has been used or written. This only updates the index
+ * in memory, it does not access the disk.
+ */
+void grits_cache_touch(GritsCache *cache, const gchar *local,
+		gint64 size, gboolean packed)
+{
+	g_mutex_lock(&cache->lock);
+	_grits_cache_add(cache, local, size, _grits_cache_now(), packed);
+	gint64 quota = _grits_cache_get_quota(cache);
+	gboolean over = quota > 0 && cache->used > quota + quota/10;
+	g_mutex_unlock(&cache->lock);
+	if (over)
+		_grits_cache_wakeup();
+}
+
+/**
+ * grits_cache_forget:
+ * @cache: the cache
+ * @local: the name of the file in the cache
+ *
+ * Record that a file has been removed from the cache.
+ */
+void grits_cache_forget(GritsCache *cache, const gchar *local)
+{
+	g_mutex_lock(&cache->lock);
+	_grits_cache_remove(cache, local);
+	g_mutex_unlock(&cache->lock);
+}
+
+/**
+ * grits_cache_get_size:
+ * @cache: the cache
+ * @used:  bytes used by the files in the cache, or NULL
+ * @quota: the quota in bytes, 0 for no limit, or NULL
+ *
+ * Get the amount of disk space used by the cache.
+ */
+void grits_cache_get_size(GritsCache *cache, gint64 *used, gint64 *quota)
+{
+	g_mutex_lock(&cache->lock);
+	if (used)  *used  = cache->used;
+	if (quota) *quota = _grits_cache_get_quota(cache);
+	g_mutex_unlock(&cache->lock);
+}
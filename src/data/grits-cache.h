@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GRITS_CACHE_H__
+#define __GRITS_CACHE_H__
+
+#include <glib.h>
+
+typedef struct _GritsCache GritsCache;
+
+void grits_cache_set_default_quota(gint64 bytes);
+
+GritsCache *grits_cache_open(const gchar *prefix);
+
+void grits_cache_close(GritsCache *cache);
+
+void grits_cache_set_quota(GritsCache *cache, gint64 bytes);
+
+void grits_cache_touch(GritsCache *cache, const gchar *local,
+		gint64 size, gboolean packed);
+
+void grits_cache_forget(GritsCache *cache, const gchar *local);
+
+void grits_cache_get_size(GritsCache *cache, gint64 *used, gint64 *quota);
+
+#endif
@@ -25,7 +25,8 @@
  * @GRITS_LOCAL:   Only return local files (for offline mode)
  * @GRITS_ONCE:    Download the file only if it does not exist
  * @GRITS_UPDATE:  Update the file to be like the server
- * @GRITS_REFRESH: Delete the existing file and fetch a new copy
+ * @GRITS_REFRESH: Fetch a new copy, unless the server says the cached file
+ *                 is still current
  *
  * Various methods for caching data
  */
@@ -23,6 +23,13 @@
  * the Hyper Text Transfer Protocol. Each #GritsHttp should be associated with
  * a particular server or dataset, all the files downloaded for this dataset
  * will be cached together in $HOME/.cache/grits/
+ *
+ * Files are normally cached as one file each. Datasets with many small files,
+ * such as map tiles, can be stored in a single #GritsPack instead, see
+ * grits_http_set_packed.
+ *
+ * The disk space used by each prefix is limited, once it exceeds its quota the
+ * least recently used files are removed, see #GritsCache.
  */
 
 #include <config.h>
@@ -38,6 +45,191 @@ gchar *_get_cache_path(GritsHttp *http, const gchar *local)
 			http->prefix, local, NULL);
 }
 
+/* Validators for cached files are kept in sidecar files under .meta, so that
+ * refreshing a file which has not changed only costs a 304 response */
+static gchar *_get_meta_path(GritsHttp *http, const gchar *local)
+{
+	return g_build_filename(g_get_user_cache_dir(), PACKAGE,
+			http->prefix, ".meta", local, NULL);
+}
+
+/* All requests share one session, which is run asynchronously from a single
+ * thread so that many requests can be in flight at once and connections are
+ * kept alive between requests for different datasets */
+static SoupSession  *grits_http_session  = NULL;
+static GMainContext *grits_http_context  = NULL;
+static gint          grits_http_per_host = 6;
+static gint          grits_http_total    = 32;
+
+/* Downloads in progress and recently failed downloads, by cache path. Requests
+ * for a file which is already being downloaded wait for that download, and
+ * files which failed are not requested again until the failure expires */
+static GHashTable   *grits_http_inflight = NULL;
+static GHashTable   *grits_http_failed   = NULL;
+static gint          grits_http_fail_ttl = 60;
+static GMutex        grits_http_lock;
+
+/* A request which is queued or being downloaded, the message and the list of
+ * requests for each #GritsHttp are only accessed from the HTTP thread */
+typedef struct {
+	GritsHttp         *http;
+	gchar             *uri;
+	gchar             *local;
+	gchar             *path;
+	gchar             *part;
+	GritsCacheType     mode;
+	FILE              *fp;
+	SoupMessage       *message;
+	GritsChunkCallback chunk;
+	GritsHttpCallback  callback;
+	gpointer           user_data;
+	GSList            *waiters;
+	gchar             *meta;
+	gchar             *etag;
+	gchar             *modified;
+} GritsHttpRequest;
+
+static gpointer _grits_http_thread(gpointer _loop)
+{
+	GMainLoop *loop = _loop;
+	g_main_loop_run(loop);
+	return NULL;
+}
+
+static gpointer _grits_http_init(gpointer data)
+{
+	g_debug("GritsHttp: init - per_host=%d total=%d",
+			grits_http_per_host, grits_http_total);
+	grits_http_inflight = g_hash_table_new(g_str_hash, g_str_equal);
+	grits_http_failed   = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
+	grits_http_context  = g_main_context_new();
+	grits_http_session = soup_session_async_new_with_options(
+			"async-context",      grits_http_context,
+			"user-agent",         PACKAGE_STRING,
+			"timeout",            10,
+			"max-conns",          grits_http_total,
+			"max-conns-per-host", grits_http_per_host,
+			NULL);
+	GMainLoop *loop = g_main_loop_new(grits_http_context, FALSE);
+	g_thread_new("grits-http", _grits_http_thread, loop);
+	return grits_http_session;
+}
+
+static SoupSession *_grits_http_get_session(void)
+{
+	static GOnce once = G_ONCE_INIT;
+	return g_once(&once, _grits_http_init, NULL);
+}
+
+static gboolean _grits_http_set_limits_cb(gpointer data)
+{
+	g_object_set(grits_http_session,
+			"max-conns",          grits_http_total,
+			"max-conns-per-host", grits_http_per_host,
+			NULL);
+	return FALSE;
+}
+
+/**
+ * grits_http_set_limits:
+ * @per_host: maximum number of connections to a single server
+ * @total:    maximum number of connections
+ *
+ * Limit the number of connections which are open at once. The limits are
+ * shared by all #GritsHttp objects. Requests beyond the limits are queued
+ * until a connection is available, connections are kept alive and reused for
+ * later requests to the same server. Lowering the limits does not close
+ * connections which are already open.
+ */
+void grits_http_set_limits(gint per_host, gint total)
+{
+	grits_http_per_host = per_host;
+	grits_http_total    = total;
+	if (_grits_http_get_session())
+		g_main_context_invoke(grits_http_context,
+				_grits_http_set_limits_cb, NULL);
+}
+
+/**
+ * grits_http_set_failure_ttl:
+ * @seconds: time to remember failed downloads, or 0 to always retry
+ *
+ * Set how long failed downloads are remembered. Until then requests for the
+ * same file fail without contacting the server, unless they use
+ * %GRITS_REFRESH. This keeps missing tiles from being requested again every
+ * time the view changes.
+ */
+void grits_http_set_failure_ttl(gint seconds)
+{
+	g_mutex_lock(&grits_http_lock);
+	grits_http_fail_ttl = seconds;
+	if (grits_http_failed)
+		g_hash_table_remove_all(grits_http_failed);
+	g_mutex_unlock(&grits_http_lock);
+}
+
+/**
+ * grits_http_setup_prefs:
+ * @prefs: the preferences to read
+ *
+ * Configure connection limits, failed downloads and the disk cache from the
+ * "grits" group of @prefs. These settings are shared by all #GritsHttp
+ * objects, keys which are not set keep their current values.
+ */
+void grits_http_setup_prefs(GritsPrefs *prefs)
+{
+	/* HTTP connections */
+	gint per_host = grits_prefs_get_integer(prefs, "grits/http_per_host", NULL);
+	gint total    = grits_prefs_get_integer(prefs, "grits/http_conns",    NULL);
+	if (per_host > 0 || total > 0)
+		grits_http_set_limits(
+				per_host > 0 ? per_host : grits_http_per_host,
+				total    > 0 ? total    : grits_http_total);
+
+	/* Seconds to remember failed downloads, 0 always retries */
+	if (grits_prefs_has_key(prefs, "grits/http_fail_ttl"))
+		grits_http_set_failure_ttl(MAX(grits_prefs_get_integer(prefs,
+				"grits/http_fail_ttl", NULL), 0));
+
+	/* Disk space for each cached dataset in MB, 0 for no limit */
+	if (grits_prefs_has_key(prefs, "grits/cache_quota"))
+		grits_cache_set_default_quota(MAX(grits_prefs_get_integer(prefs,
+				"grits/cache_quota", NULL), 0) * (gint64)1024*1024);
+}
+
+/* Check for a recent failure while holding grits_http_lock */
+static gboolean _grits_http_failed(const gchar *path)
+{
+	gint64 *expire = g_hash_table_lookup(grits_http_failed, path);
+	if (!expire)
+		return FALSE;
+	if (*expire > g_get_monotonic_time())
+		return TRUE;
+	g_hash_table_remove(grits_http_failed, path);
+	return FALSE;
+}
+
+static gboolean _grits_http_expired(gpointer path, gpointer expire,
+		gpointer now)
+{
+	return *(gint64*)expire <= *(gint64*)now;
+}
+
+/* Remember a failure while holding grits_http_lock */
+static void _grits_http_set_failed(const gchar *path)
+{
+	gint64 now = g_get_monotonic_time();
+	if (grits_http_fail_ttl <= 0)
+		return;
+	if (g_hash_table_size(grits_http_failed) >= 4096)
+		g_hash_table_foreach_remove(grits_http_failed,
+				_grits_http_expired, &now);
+	gint64 *expire = g_new(gint64, 1);
+	*expire = now + (gint64)grits_http_fail_ttl*G_USEC_PER_SEC;
+	g_hash_table_insert(grits_http_failed, g_strdup(path), expire);
+}
+
 /**
  * grits_http_new:
  * @prefix: The prefix in the cache to store the downloaded files.
@@ -51,13 +243,47 @@ GritsHttp *grits_http_new(const gchar *prefix)
 {
 	g_debug("GritsHttp: new - %s", prefix);
 	GritsHttp *http = g_new0(GritsHttp, 1);
-	http->soup = soup_session_sync_new();
+	http->soup = g_object_ref(_grits_http_get_session());
 	http->prefix = g_strdup(prefix);
-	g_object_set(http->soup, "user-agent", PACKAGE_STRING, NULL);
-	g_object_set(http->soup, "timeout",    10,             NULL);
+	http->cache  = grits_cache_open(prefix);
+	g_mutex_init(&http->lock);
+	g_cond_init(&http->cond);
 	return http;
 }
 
+/* Count requests and other calls to the HTTP thread, so that grits_http_free
+ * can wait for them */
+static void _grits_http_hold(GritsHttp *http)
+{
+	g_mutex_lock(&http->lock);
+	http->pending++;
+	g_mutex_unlock(&http->lock);
+}
+
+static void _grits_http_release(GritsHttp *http)
+{
+	g_mutex_lock(&http->lock);
+	if (--http->pending == 0)
+		g_cond_broadcast(&http->cond);
+	g_mutex_unlock(&http->lock);
+}
+
+/* Cancel the requests from the HTTP thread, cancelling a message calls its
+ * completion callback which removes it from the list */
+static gboolean _grits_http_abort_cb(gpointer _http)
+{
+	GritsHttp *http = _http;
+	GList *requests = g_list_copy(http->requests);
+	for (GList *cur = requests; cur; cur = cur->next) {
+		GritsHttpRequest *req = cur->data;
+		soup_session_cancel_message(http->soup, req->message,
+				SOUP_STATUS_CANCELLED);
+	}
+	g_list_free(requests);
+	_grits_http_release(http);
+	return FALSE;
+}
+
 /**
  * grits_http_abort:
  * @http: the #GritsHttp to abort
@@ -68,30 +294,81 @@ void grits_http_abort(GritsHttp *http)
 {
 	g_debug("GritsHttp: abort - %s", http->prefix);
 	http->aborted = TRUE;
-	soup_session_abort(http->soup);
+	_grits_http_hold(http);
+	g_main_context_invoke(grits_http_context, _grits_http_abort_cb, http);
 }
 
 /**
  * grits_http_free:
  * @http: the #GritsHttp to free
  *
- * Frees resources used by @http and cancels any pending requests.
+ * Frees resources used by @http. This waits for pending requests to finish,
+ * call grits_http_abort first to cancel them.
  */
 void grits_http_free(GritsHttp *http)
 {
 	g_debug("GritsHttp: free - %s", http->prefix);
+	g_mutex_lock(&http->lock);
+	while (http->pending)
+		g_cond_wait(&http->cond, &http->lock);
+	g_mutex_unlock(&http->lock);
+	g_mutex_clear(&http->lock);
+	g_cond_clear(&http->cond);
+	if (http->pack)
+		grits_pack_close(http->pack);
+	grits_cache_close(http->cache);
 	g_object_unref(http->soup);
 	g_free(http->prefix);
 	g_free(http);
 }
 
-/* For passing data to the chunck callback */
-struct _CacheInfo {
-	FILE  *fp;
-	gchar *path;
-	GritsChunkCallback callback;
-	gpointer user_data;
-};
+/**
+ * grits_http_set_packed:
+ * @http:   the #GritsHttp to change
+ * @packed: TRUE to store files in a #GritsPack
+ *
+ * Store downloaded files in a single #GritsPack in the cache directory instead
+ * of one file each. Checking for and reading a cached file then only uses the
+ * index kept in memory and the memory mapped pack.
+ *
+ * Packed files must be read with grits_http_fetch_bytes, the paths passed to
+ * #GritsHttpCallback and returned by grits_http_fetch are only used to name
+ * the file. This should be set before any files are fetched.
+ *
+ * If the pack can not be opened, for example because another process is using
+ * it, files are stored separately.
+ */
+void grits_http_set_packed(GritsHttp *http, gboolean packed)
+{
+	g_debug("GritsHttp: set_packed - %s %d", http->prefix, packed);
+	if (http->pack)
+		grits_pack_close(http->pack);
+	http->pack = NULL;
+	if (packed) {
+		gchar *dir = _get_cache_path(http, NULL);
+		/* Fall back to separate files if the pack is in use by
+		 * another process */
+		if (!(http->pack = grits_pack_open(dir)))
+			g_warning("GritsHttp: set_packed - not packing %s", dir);
+		g_free(dir);
+	}
+}
+
+/**
+ * grits_http_set_quota:
+ * @http:  the #GritsHttp to change
+ * @bytes: the quota in bytes, 0 to use the default, or -1 for no limit
+ *
+ * Limit the disk space used by the files cached for the prefix of @http, see
+ * grits_cache_set_quota. The quota is shared with other #GritsHttp objects
+ * using the same prefix.
+ */
+void grits_http_set_quota(GritsHttp *http, gint64 bytes)
+{
+	grits_cache_set_quota(http->cache, bytes);
+}
+
+/* For passing data to the chunk callback */
 struct _CacheInfoMain {
 	gchar *path;
 	GritsChunkCallback callback;
@@ -107,6 +384,7 @@ static gboolean _chunk_main_cb(gpointer _infomain)
 	infomain->callback(infomain->path,
 			infomain->cur, infomain->total,
 			infomain->user_data);
+	g_free(infomain->path);
 	g_free(infomain);
 	return FALSE;
 }
@@ -114,9 +392,9 @@ static gboolean _chunk_main_cb(gpointer _infomain)
 /**
  * Append data to the file and call the users callback if they supplied one.
  */
-static void _chunk_cb(SoupMessage *message, SoupBuffer *chunk, gpointer _info)
+static void _chunk_cb(SoupMessage *message, SoupBuffer *chunk, gpointer _req)
 {
-	struct _CacheInfo *info = _info;
+	GritsHttpRequest *req = _req;
 
 	if (!SOUP_STATUS_IS_SUCCESSFUL(message->status_code)) {
 		g_warning("GritsHttp: _chunk_cb - soup failed with %d",
@@ -124,15 +402,15 @@ static void _chunk_cb(SoupMessage *message, SoupBuffer *chunk, gpointer _info)
 		return;
 	}
 
-	if (!fwrite(chunk->data, chunk->length, 1, info->fp))
+	if (!fwrite(chunk->data, chunk->length, 1, req->fp))
 		g_error("GritsHttp: _chunk_cb - Unable to write data");
 
-	if (info->callback) {
+	if (req->chunk) {
 		struct _CacheInfoMain *infomain = g_new0(struct _CacheInfoMain, 1);
-		infomain->path      = info->path;
-		infomain->callback  = info->callback;
-		infomain->user_data = info->user_data;
-		infomain->cur       = ftell(info->fp);
+		infomain->path      = g_strdup(req->path);
+		infomain->callback  = req->chunk;
+		infomain->user_data = req->user_data;
+		infomain->cur       = ftell(req->fp);
 		goffset st=0, end=0;
 		soup_message_headers_get_content_range(message->response_headers,
 				&st, &end, &infomain->total);
@@ -141,6 +419,424 @@ static void _chunk_cb(SoupMessage *message, SoupBuffer *chunk, gpointer _info)
 
 }
 
+/* Call the completion callback and free the request, the path is passed on
+ * to the callback */
+static void _grits_http_finish(GritsHttpRequest *req, gboolean success)
+{
+	GritsHttp *http = req->http;
+	if (!success) {
+		g_free(req->path);
+		req->path = NULL;
+	}
+	if (req->callback)
+		req->callback(http, req->path, req->user_data);
+	else
+		g_free(req->path);
+	g_free(req->uri);
+	g_free(req->local);
+	g_free(req->meta);
+	g_free(req->etag);
+	g_free(req->modified);
+	g_free(req);
+	_grits_http_release(http);
+}
+
+/* Read the validators for a cached file */
+static gboolean _grits_http_load_meta(GritsHttpRequest *req)
+{
+	GKeyFile *meta = g_key_file_new();
+	GritsPack *pack = req->http->pack;
+	gboolean loaded = FALSE;
+	if (pack && grits_pack_has(pack, req->local)) {
+		GBytes *bytes = grits_pack_get(pack, req->meta);
+		if (bytes) {
+			gsize len;
+			const gchar *data = g_bytes_get_data(bytes, &len);
+			loaded = g_key_file_load_from_data(meta, data, len, 0, NULL);
+			g_bytes_unref(bytes);
+		}
+	} else if (!pack && g_file_test(req->path, G_FILE_TEST_EXISTS)) {
+		loaded = g_key_file_load_from_file(meta, req->meta, 0, NULL);
+	}
+	if (loaded) {
+		req->etag     = g_key_file_get_string(meta, "http", "etag",          NULL);
+		req->modified = g_key_file_get_string(meta, "http", "last-modified", NULL);
+	}
+	g_key_file_free(meta);
+	return req->etag || req->modified;
+}
+
+/* Save the validators sent by the server along with a downloaded file */
+static void _grits_http_save_meta(GritsHttpRequest *req,
+		SoupMessageHeaders *headers)
+{
+	const gchar *etag     = soup_message_headers_get_one(headers, "ETag");
+	const gchar *modified = soup_message_headers_get_one(headers, "Last-Modified");
+	GritsPack *pack = req->http->pack;
+	if (!etag && !modified) {
+		if (pack)
+			grits_pack_remove(pack, req->meta);
+		else
+			g_remove(req->meta);
+		return;
+	}
+	GKeyFile *meta = g_key_file_new();
+	if (etag)
+		g_key_file_set_string(meta, "http", "etag",          etag);
+	if (modified)
+		g_key_file_set_string(meta, "http", "last-modified", modified);
+	gsize len;
+	gchar *data = g_key_file_to_data(meta, &len, NULL);
+	if (pack) {
+		if (!grits_pack_put(pack, req->meta, data, len))
+			g_warning("GritsHttp: save_meta - error packing %s", req->meta);
+	} else {
+		gchar *dir = g_path_get_dirname(req->meta);
+		g_mkdir_with_parents(dir, 0755);
+		if (!g_file_set_contents(req->meta, data, len, NULL))
+			g_warning("GritsHttp: save_meta - error writing %s", req->meta);
+		g_free(dir);
+	}
+	g_free(data);
+	g_key_file_free(meta);
+}
+
+static void _grits_http_start(GritsHttpRequest *req, gboolean cached);
+
+/* Finish a download along with the requests waiting for it, @status is the
+ * HTTP status of failed downloads, or 0 for local errors which should not be
+ * remembered. A cancelled download is handed to a waiter whose #GritsHttp has
+ * not been aborted, which restarts it, and only the aborted requests fail. */
+static void _grits_http_complete(GritsHttpRequest *req, gboolean success,
+		guint status)
+{
+	GritsHttpRequest *next = NULL;
+	g_mutex_lock(&grits_http_lock);
+	g_hash_table_remove(grits_http_inflight, req->path);
+	if (!success && status && status != SOUP_STATUS_CANCELLED)
+		_grits_http_set_failed(req->path);
+	GSList *waiters = req->waiters;
+	if (status == SOUP_STATUS_CANCELLED) {
+		GSList *aborted = NULL;
+		for (GSList *cur = waiters; cur; cur = cur->next) {
+			GritsHttpRequest *waiter = cur->data;
+			if (waiter->http->aborted)
+				aborted = g_slist_prepend(aborted, waiter);
+			else if (!next)
+				next = waiter;
+			else
+				next->waiters = g_slist_prepend(next->waiters, waiter);
+		}
+		g_slist_free(waiters);
+		waiters = aborted;
+		if (next) {
+			g_debug("GritsHttp: complete - handing off %s", next->local);
+			next->path = g_strdup(req->path);
+			g_hash_table_insert(grits_http_inflight, next->path, next);
+		}
+	}
+	g_mutex_unlock(&grits_http_lock);
+
+	for (GSList *cur = waiters; cur; cur = cur->next) {
+		GritsHttpRequest *waiter = cur->data;
+		waiter->path = g_strdup(req->path);
+		_grits_http_finish(waiter, success);
+	}
+	g_slist_free(waiters);
+	_grits_http_finish(req, success);
+
+	if (next) {
+		GritsPack *pack = next->http->pack;
+		_grits_http_start(next, pack ? grits_pack_has(pack, next->local) :
+				g_file_test(next->path, G_FILE_TEST_EXISTS));
+	}
+}
+
+/* Move a complete download into place, either by renaming the partial file
+ * or by copying it into the pack */
+static gboolean _grits_http_store(GritsHttpRequest *req)
+{
+	GritsPack *pack = req->http->pack;
+	if (!pack)
+		return g_rename(req->part, req->path) == 0;
+	gsize len;
+	gchar *data = NULL;
+	gboolean ok = g_file_get_contents(req->part, &data, &len, NULL) &&
+		grits_pack_put(pack, req->local, data, len);
+	if (!ok)
+		g_warning("GritsHttp: store - error packing %s", req->part);
+	g_remove(req->part);
+	g_free(data);
+	return ok;
+}
+
+/* Called from the HTTP thread once the message is finished or cancelled */
+static void _grits_http_done(SoupSession *session, SoupMessage *message,
+		gpointer _req)
+{
+	GritsHttpRequest *req = _req;
+	GritsHttp *http = req->http;
+	http->requests = g_list_remove(http->requests, req);
+
+	/* Close file */
+	guint status = message->status_code;
+	gboolean complete = SOUP_STATUS_IS_SUCCESSFUL(status) ||
+		status == SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE;
+	gboolean stored = TRUE;
+	gint64   size   = ftell(req->fp);
+	fclose(req->fp);
+	if (req->part != req->path) {
+		if (complete)
+			stored = _grits_http_store(req);
+		else if (status == SOUP_STATUS_NOT_MODIFIED)
+			g_remove(req->part);
+		g_free(req->part);
+	}
+	if (SOUP_STATUS_IS_SUCCESSFUL(status) && stored)
+		_grits_http_save_meta(req, message->response_headers);
+	if (complete && stored)
+		grits_cache_touch(http->cache, req->local, size, http->pack != NULL);
+	else if (status == SOUP_STATUS_NOT_MODIFIED)
+		grits_cache_touch(http->cache, req->local, -1, http->pack != NULL);
+
+	/* Finished */
+	if (status == SOUP_STATUS_CANCELLED) {
+		_grits_http_complete(req, FALSE, status);
+	} else if (status == SOUP_STATUS_NOT_MODIFIED) {
+		/* Cached file is still current */
+		g_debug("GritsHttp: done_cb - not modified %s", req->path);
+		_grits_http_complete(req, TRUE, status);
+	} else if (!stored) {
+		g_warning("GritsHttp: done_cb - error storing %s", req->path);
+		_grits_http_complete(req, FALSE, 0);
+	} else if (status == SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE) {
+		/* Range unsatisfiable, file already complete */
+		_grits_http_complete(req, TRUE, status);
+	} else if (!SOUP_STATUS_IS_SUCCESSFUL(status)) {
+		g_warning("GritsHttp: done_cb - error copying file, status=%d\n"
+				"\tsrc=%s\n"
+				"\tdst=%s",
+				status, req->uri, req->path);
+		_grits_http_complete(req, FALSE, status);
+	} else {
+		_grits_http_complete(req, TRUE, status);
+	}
+}
+
+/* Copy a packed file to the partial file so that it can be continued */
+static void _grits_http_unpack(GritsHttpRequest *req)
+{
+	GBytes *bytes = grits_pack_get(req->http->pack, req->local);
+	if (!bytes)
+		return;
+	gsize len;
+	gconstpointer data = g_bytes_get_data(bytes, &len);
+	FILE *fp = fopen_p(req->part, "wb");
+	if (fp) {
+		if (len && !fwrite(data, len, 1, fp))
+			g_warning("GritsHttp: unpack - error writing %s", req->part);
+		fclose(fp);
+	}
+	g_bytes_unref(bytes);
+}
+
+/* Start the download from the HTTP thread */
+static gboolean _grits_http_queue(gpointer _req)
+{
+	GritsHttpRequest *req = _req;
+	GritsHttp *http = req->http;
+
+	SoupMessage *message = NULL;
+	if (!http->aborted && !(message = soup_message_new("GET", req->uri)))
+		g_warning("GritsHttp: queue - cannot parse uri %s", req->uri);
+	if (!message) {
+		fclose(req->fp);
+		if (req->part != req->path)
+			g_free(req->part);
+		_grits_http_complete(req, FALSE,
+				http->aborted ? SOUP_STATUS_CANCELLED : 0);
+		return FALSE;
+	}
+
+	/* Write the body directly to the file instead of keeping it in memory */
+	soup_message_body_set_accumulate(message->response_body, FALSE);
+	g_signal_connect(message, "got-chunk", G_CALLBACK(_chunk_cb), req);
+	if (req->etag || req->modified) {
+		/* Revalidate the cached file */
+		if (req->etag)
+			soup_message_headers_replace(message->request_headers,
+					"If-None-Match", req->etag);
+		if (req->modified)
+			soup_message_headers_replace(message->request_headers,
+					"If-Modified-Since", req->modified);
+	} else {
+		//if (ftell(fp) > 0)
+			soup_message_headers_set_range(message->request_headers,
+					ftell(req->fp), -1);
+	}
+	if (req->mode == GRITS_REFRESH)
+		soup_message_headers_replace(message->request_headers,
+				"Cache-Control", "max-age=0");
+
+	req->message = message;
+	http->requests = g_list_prepend(http->requests, req);
+	soup_session_queue_message(http->soup, message, _grits_http_done, req);
+	return FALSE;
+}
+
+/* Open the partial file for a download and start it, the request must already
+ * be in the list of downloads in progress */
+static void _grits_http_start(GritsHttpRequest *req, gboolean cached)
+{
+	GritsPack *pack = req->http->pack;
+
+	/* Open the file for writting, a new copy of a file which is being
+	 * revalidated replaces the old one once it is complete. Packed files
+	 * are always downloaded to a partial file, which is copied into the
+	 * pack once it is complete. */
+	req->part = req->path;
+	if (req->etag || req->modified || !cached || pack)
+		req->part = g_strdup_printf("%s.part", req->path);
+	if (pack && cached && !req->etag && !req->modified &&
+	    !g_file_test(req->part, G_FILE_TEST_EXISTS))
+		_grits_http_unpack(req);
+	req->fp = fopen_p(req->part, req->etag || req->modified ? "wb" : "ab");
+	if (!req->fp) {
+		g_warning("GritsHttp: start - error opening %s", req->path);
+		if (req->part != req->path)
+			g_free(req->part);
+		_grits_http_complete(req, FALSE, 0);
+		return;
+	}
+	fseek(req->fp, 0, SEEK_END); // "a" is broken on Windows, twice
+
+	/* Download the file */
+	g_main_context_invoke(grits_http_context, _grits_http_queue, req);
+}
+
+/**
+ * grits_http_fetch_async:
+ * @http:      the #GritsHttp connection to use
+ * @uri:       the URI to fetch
+ * @local:     the local name to give to the file
+ * @mode:      the update type to use when fetching data
+ * @chunk:     callback to call when a chunk of data is received
+ * @callback:  callback to call when the file is complete
+ * @user_data: user data to pass to the callbacks
+ *
+ * Fetch a file from the cache without waiting for it to be downloaded. Any
+ * number of requests can be in flight at once, they are queued until a
+ * connection is available, see grits_http_set_limits.
+ *
+ * Requests for a file which is already being downloaded share the download,
+ * and files which failed recently are not requested again, see
+ * grits_http_set_failure_ttl. Only the request which started the download
+ * receives its @chunk callbacks. If the download is cancelled by
+ * grits_http_abort, it continues for the waiting requests of other #GritsHttp
+ * objects.
+ *
+ * @callback is called from the HTTP thread once the file is complete, or
+ * directly from grits_http_fetch_async if the file does not need to be
+ * downloaded. It should not block, since it holds up other requests.
+ */
+void grits_http_fetch_async(GritsHttp *http, const gchar *uri,
+		const gchar *local, GritsCacheType mode,
+		GritsChunkCallback chunk, GritsHttpCallback callback,
+		gpointer user_data)
+{
+	g_debug("GritsHttp: fetch_async - %s mode=%d", local, mode);
+	GritsHttpRequest *req = g_new0(GritsHttpRequest, 1);
+	req->http      = http;
+	req->uri       = g_strdup(uri);
+	req->local     = g_strdup(local);
+	req->mode      = mode;
+	req->chunk     = chunk;
+	req->callback  = callback;
+	req->user_data = user_data;
+	_grits_http_hold(http);
+
+	if (http->aborted) {
+		g_debug("GritsHttp: fetch_async - aborted");
+		_grits_http_finish(req, FALSE);
+		return;
+	}
+	req->path = _get_cache_path(http, local);
+	if (mode == GRITS_LOCAL) {
+		_grits_http_finish(req, TRUE);
+		return;
+	}
+
+	/* Check the cache before taking the lock, so that other requests are
+	 * not held up by disk access. Revalidate the file if we're refreshing
+	 * it, or replace it if the server did not give us any validators. */
+	GritsPack *pack = http->pack;
+	gboolean cached = pack ? grits_pack_has(pack, local) :
+		g_file_test(req->path, G_FILE_TEST_EXISTS);
+	req->meta = pack ? g_build_filename(".meta", local, NULL) :
+		_get_meta_path(http, local);
+	gboolean stale = mode == GRITS_REFRESH && cached &&
+		!_grits_http_load_meta(req);
+	if (stale)
+		cached = FALSE;
+
+	/* Wait for the file if it is already being downloaded */
+	g_mutex_lock(&grits_http_lock);
+	GritsHttpRequest *leader = g_hash_table_lookup(grits_http_inflight,
+			req->path);
+	if (leader) {
+		g_debug("GritsHttp: fetch_async - waiting for %s", local);
+		leader->waiters = g_slist_prepend(leader->waiters, req);
+		g_free(req->path);
+		req->path = NULL;
+		g_mutex_unlock(&grits_http_lock);
+		return;
+	}
+
+	/* Use the cached file if possible */
+	if (mode == GRITS_ONCE && cached) {
+		g_mutex_unlock(&grits_http_lock);
+		grits_cache_touch(http->cache, local, -1, pack != NULL);
+		_grits_http_finish(req, TRUE);
+		return;
+	}
+
+	/* Don't retry recent failures, unless we're refreshing */
+	if (mode != GRITS_REFRESH && _grits_http_failed(req->path)) {
+		g_debug("GritsHttp: fetch_async - recently failed %s", local);
+		g_mutex_unlock(&grits_http_lock);
+		_grits_http_finish(req, FALSE);
+		return;
+	}
+	g_hash_table_insert(grits_http_inflight, req->path, req);
+	g_mutex_unlock(&grits_http_lock);
+	g_debug("GritsHttp: fetch_async - Caching file %s", local);
+
+	/* Unlink the stale file now that no one else is downloading it, packed
+	 * files are kept until the new copy replaces them */
+	if (stale && !pack)
+		g_remove(req->path);
+
+	_grits_http_start(req, cached);
+}
+
+/* For waiting on an asynchronous fetch */
+struct _FetchWait {
+	GMutex    lock;
+	GCond     cond;
+	gboolean  done;
+	gchar    *path;
+};
+
+static void _fetch_wait_cb(GritsHttp *http, gchar *path, gpointer _wait)
+{
+	struct _FetchWait *wait = _wait;
+	g_mutex_lock(&wait->lock);
+	wait->path = path;
+	wait->done = TRUE;
+	g_cond_signal(&wait->cond);
+	g_mutex_unlock(&wait->lock);
+}
+
 /**
  * grits_http_fetch:
  * @http:      the #GritsHttp connection to use
@@ -151,7 +847,9 @@ static void _chunk_cb(SoupMessage *message, SoupBuffer *chunk, gpointer _info)
  * @user_data: user data to pass to the callback
  *
  * Fetch a file from the cache. Whether the file is actually loaded from the
- * remote server depends on the value of @mode.
+ * remote server depends on the value of @mode. This waits for the download to
+ * finish, see grits_http_fetch_async. It must not be called from a
+ * #GritsHttpCallback.
  *
  * Returns: The local path to the complete file
  */
@@ -160,78 +858,84 @@ gchar *grits_http_fetch(GritsHttp *http, const gchar *uri, const char *local,
 		GritsCacheType mode, GritsChunkCallback callback, gpointer user_data)
 {
 	g_debug("GritsHttp: fetch - %s mode=%d", local, mode);
-	if (http->aborted) {
-		g_debug("GritsPluginSat: _load_tile_thread - aborted");
+	struct _FetchWait wait = {};
+	g_mutex_init(&wait.lock);
+	g_cond_init(&wait.cond);
+	grits_http_fetch_async(http, uri, local, mode,
+			callback, _fetch_wait_cb, &wait);
+	g_mutex_lock(&wait.lock);
+	while (!wait.done)
+		g_cond_wait(&wait.cond, &wait.lock);
+	g_mutex_unlock(&wait.lock);
+	g_mutex_clear(&wait.lock);
+	g_cond_clear(&wait.cond);
+	return wait.path;
+}
+
+/**
+ * grits_http_fetch_bytes:
+ * @http:      the #GritsHttp connection to use
+ * @uri:       the URI to fetch
+ * @local:     the local name to give to the file
+ * @mode:      the update type to use when fetching data
+ * @callback:  callback to call when a chunk of data is received
+ * @user_data: user data to pass to the callback
+ *
+ * Fetch a file from the cache and read it, see grits_http_fetch. The contents
+ * are memory mapped from the cached file or the pack, see
+ * grits_http_set_packed.
+ *
+ * Returns: the contents of the file, or NULL on error
+ */
+GBytes *grits_http_fetch_bytes(GritsHttp *http, const gchar *uri,
+		const gchar *local, GritsCacheType mode,
+		GritsChunkCallback callback, gpointer user_data)
+{
+	gchar *path = grits_http_fetch(http, uri, local, mode,
+			callback, user_data);
+	if (!path)
 		return NULL;
+	GBytes *bytes = NULL;
+	if (http->pack) {
+		bytes = grits_pack_get(http->pack, local);
+	} else {
+		GMappedFile *file = g_mapped_file_new(path, FALSE, NULL);
+		if (file) {
+			bytes = g_mapped_file_get_bytes(file);
+			g_mapped_file_unref(file);
+		}
 	}
-	gchar *path = _get_cache_path(http, local);
+	if (!bytes)
+		g_debug("GritsHttp: fetch_bytes - unable to read %s", local);
+	g_free(path);
+	return bytes;
+}
 
-	/* Unlink the file if we're refreshing it */
-	if (mode == GRITS_REFRESH)
+/**
+ * grits_http_remove:
+ * @http:  the #GritsHttp the file was fetched with
+ * @local: the local name of the file
+ *
+ * Remove a file from the cache, for instance because it could not be decoded.
+ * The file will be downloaded again the next time it is fetched.
+ */
+void grits_http_remove(GritsHttp *http, const gchar *local)
+{
+	g_debug("GritsHttp: remove - %s", local);
+	grits_cache_forget(http->cache, local);
+	if (http->pack) {
+		gchar *meta = g_build_filename(".meta", local, NULL);
+		grits_pack_remove(http->pack, local);
+		grits_pack_remove(http->pack, meta);
+		g_free(meta);
+	} else {
+		gchar *path = _get_cache_path(http, local);
+		gchar *meta = _get_meta_path(http, local);
 		g_remove(path);
-
-	/* Do the cache if necessasairy */
-	if (!(mode == GRITS_ONCE && g_file_test(path, G_FILE_TEST_EXISTS)) &&
-			mode != GRITS_LOCAL) {
-		g_debug("GritsHttp: fetch - Caching file %s", local);
-
-		/* Open the file for writting */
-		gchar *part = path;
-		if (!g_file_test(path, G_FILE_TEST_EXISTS))
-			part = g_strdup_printf("%s.part", path);
-		FILE *fp = fopen_p(part, "ab");
-		if (!fp) {
-			g_warning("GritsHttp: fetch - error opening %s", path);
-			return NULL;
-		}
-		fseek(fp, 0, SEEK_END); // "a" is broken on Windows, twice
-
-		/* Make temp data */
-		struct _CacheInfo info = {
-			.fp        = fp,
-			.path      = path,
-			.callback  = callback,
-			.user_data = user_data,
-		};
-
-		/* Download the file */
-		SoupMessage *message = soup_message_new("GET", uri);
-		if (message == NULL)
-			g_error("message is null, cannot parse uri");
-		g_signal_connect(message, "got-chunk", G_CALLBACK(_chunk_cb), &info);
-		//if (ftell(fp) > 0)
-			soup_message_headers_set_range(message->request_headers, ftell(fp), -1);
-		if (mode == GRITS_REFRESH)
-			soup_message_headers_replace(message->request_headers,
-					"Cache-Control", "max-age=0");
-		soup_session_send_message(http->soup, message);
-
-		/* Close file */
-		fclose(fp);
-		if (path != part) {
-			if (SOUP_STATUS_IS_SUCCESSFUL(message->status_code))
-				g_rename(part, path);
-			g_free(part);
-		}
-
-		/* Finished */
-		guint status = message->status_code;
-		g_object_unref(message);
-		if (status == SOUP_STATUS_CANCELLED) {
-			return NULL;
-		} else if (status == SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE) {
-			/* Range unsatisfiable, file already complete */
-		} else if (!SOUP_STATUS_IS_SUCCESSFUL(status)) {
-			g_warning("GritsHttp: done_cb - error copying file, status=%d\n"
-					"\tsrc=%s\n"
-					"\tdst=%s",
-					status, uri, path);
-			return NULL;
-		}
+		g_remove(meta);
+		g_free(path);
+		g_free(meta);
 	}
-
-	/* TODO: free everything.. */
-	return path;
 }
 
 /**
@@ -248,6 +952,7 @@ gchar *grits_http_fetch(GritsHttp *http, const gchar *uri, const char *local,
  * The name of each file that matches the filter is added to the returned list.
  *
  * The list as well as the strings contained in it should be freed afterwards.
+ * Files stored in a pack are not listed, see grits_http_set_packed.
  *
  * Returns the list of matching filenames
  */
@@ -277,12 +982,16 @@ GList *grits_http_available(GritsHttp *http,
 	if (index) {
 		gchar tmp[32];
 		g_snprintf(tmp, sizeof(tmp), ".index.%x", g_random_int());
-		gchar *path = grits_http_fetch(http, index, tmp,
+		GBytes *bytes = grits_http_fetch_bytes(http, index, tmp,
 				GRITS_REFRESH, NULL, NULL);
-		if (!path)
-			return files;
-		gchar *html;
-		g_file_get_contents(path, &html, NULL, NULL);
+		gchar *html = NULL;
+		if (bytes) {
+			gsize len;
+			gconstpointer data = g_bytes_get_data(bytes, &len);
+			html = g_strndup(data, len);
+			g_bytes_unref(bytes);
+		}
+		grits_http_remove(http, tmp);
 		if (!html)
 			return files;
 
@@ -304,8 +1013,6 @@ GList *grits_http_available(GritsHttp *http,
 
 		g_regex_unref(extract_re);
 		g_match_info_free(info);
-		g_unlink(path);
-		g_free(path);
 		g_free(html);
 	}
 
@@ -21,16 +21,49 @@
 #include <glib.h>
 #include <libsoup/soup.h>
 
+#include "grits-prefs.h"
 #include "grits-data.h"
+#include "grits-pack.h"
+#include "grits-cache.h"
 
 typedef struct _GritsHttp {
 	SoupSession *soup;
 	gchar *prefix;
 	gboolean aborted;
+
+	/*< private >*/
+	GList *requests;
+	gint   pending;
+	GMutex lock;
+	GCond  cond;
+	GritsPack  *pack;
+	GritsCache *cache;
 } GritsHttp;
 
+/**
+ * GritsHttpCallback:
+ * @http:      the #GritsHttp the file was fetched with
+ * @path:      the local path to the complete file, or NULL on error,
+ *             it should be freed with g_free
+ * @user_data: user data passed to grits_http_fetch_async
+ *
+ * Function called when a file fetched with grits_http_fetch_async is complete
+ */
+typedef void (*GritsHttpCallback)(GritsHttp *http, gchar *path,
+		gpointer user_data);
+
+void grits_http_set_limits(gint per_host, gint total);
+
+void grits_http_set_failure_ttl(gint seconds);
+
+void grits_http_setup_prefs(GritsPrefs *prefs);
+
 GritsHttp *grits_http_new(const gchar *prefix);
 
+void grits_http_set_packed(GritsHttp *http, gboolean packed);
+
+void grits_http_set_quota(GritsHttp *http, gint64 bytes);
+
 void grits_http_abort(GritsHttp *http);
 
 void grits_http_free(GritsHttp *http);
@@ -40,6 +73,17 @@ gchar *grits_http_fetch(GritsHttp *http, const gchar *uri, const gchar *local,
 		GritsChunkCallback callback,
 		gpointer user_data);
 
+void grits_http_fetch_async(GritsHttp *http, const gchar *uri,
+		const gchar *local, GritsCacheType mode,
+		GritsChunkCallback chunk, GritsHttpCallback callback,
+		gpointer user_data);
+
+GBytes *grits_http_fetch_bytes(GritsHttp *http, const gchar *uri,
+		const gchar *local, GritsCacheType mode,
+		GritsChunkCallback callback, gpointer user_data);
+
+void grits_http_remove(GritsHttp *http, const gchar *local);
+
 GList *grits_http_available(GritsHttp *http,
 		gchar *filter, gchar *cache,
 		gchar *extract, gchar *index);
@@ -0,0 +1,770 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * SECTION:grits-pack
+ * @short_description: Packed file store
+ *
+ * #GritsPack stores many small files, such as map tiles, in a single data
+ * file. Reading a file from a pack does not need any file system operations,
+ * the index is kept in memory and the data file is memory mapped.
+ *
+ * The data file is append only, it holds a sequence of records each with a
+ * header, the name of the file and its contents. Files are replaced by
+ * appending a new record and removed by appending a record without contents,
+ * the space used by old records is reclaimed by grits_pack_compact.
+ *
+ * The index file only caches the location of each record. It is rewritten
+ * every so often and when the pack is closed, records added since then are
+ * found by reading the end of the data file when the pack is opened. A
+ * partial record left at the end of the data file by a crash is discarded.
+ *
+ * A pack may be shared by several #GritsHttp objects, but not by several
+ * processes. Open packs are locked, so grits_pack_open fails if another
+ * process is using the pack.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <fcntl.h>
+#ifdef G_OS_WIN32
+#include <io.h>
+#include <share.h>
+#include <sys/stat.h>
+#define fsync     _commit
+#define ftruncate _chsize
+#else
+#include <unistd.h>
+#include <sys/file.h>
+#define O_BINARY  0
+#endif
+
+#include "grits-pack.h"
+
+#define PACK_MAGIC      "GRITSPK1"
+#define INDEX_MAGIC     "GRITSIX1"
+#define RECORD_MAGIC    0x4b505247 // "GRPK"
+#define RECORD_REMOVED  G_MAXUINT32
+#define PACK_ALIGN(n)   (((n)+7) & ~(guint64)7)
+#define PACK_MAX_KEY    4096
+#define PACK_SYNC       256
+
+/* Start of the data file, records start after the header at multiples of 8
+ * bytes so that the contents of each file are aligned as well */
+typedef struct {
+	gchar   magic[8];
+	guint64 gen;
+} GritsPackHeader;
+
+typedef struct {
+	guint32 magic;
+	guint32 key_len;
+	guint32 size;
+	guint32 check;
+} GritsPackRecord;
+
+/* Start of the index file, the index is only used if the generation matches
+ * the data file, compacting the data file changes the generation */
+typedef struct {
+	gchar   magic[8];
+	guint64 gen;
+	guint64 indexed;
+	guint32 count;
+	guint32 check;
+} GritsPackIndexHeader;
+
+/* Entries in the index file are followed by the key, padded to 8 bytes */
+typedef struct {
+	guint64 offset;
+	guint32 size;
+	guint32 key_len;
+} GritsPackEntry;
+
+struct _GritsPack {
+	gchar       *dir;
+	gchar       *data_path;
+	gchar       *index_path;
+	FILE        *fp;
+	guint64      gen;
+	guint64      size;
+	guint64      indexed;
+	guint64      live;
+	gint         unsynced;
+	GHashTable  *index;
+	GMappedFile *map;
+	guint64      mapped;
+	gint         refs;
+	gboolean     compacting;
+	GMutex       lock;
+#ifdef G_OS_WIN32
+	gint         lock_fd;
+#endif
+};
+
+/* Packs are shared by directory */
+static GHashTable *grits_packs = NULL;
+static GMutex      grits_packs_lock;
+
+/* FNV-1a, used to detect partial records and damaged index files */
+static guint32 _grits_pack_hash(guint32 hash, gconstpointer data, gsize len)
+{
+	const guchar *bytes = data;
+	for (gsize i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+static guint64 _grits_pack_record_size(guint32 key_len, guint32 size)
+{
+	return sizeof(GritsPackRecord) + PACK_ALIGN(key_len) +
+		(size == RECORD_REMOVED ? 0 : PACK_ALIGN(size));
+}
+
+static guint64 _grits_pack_data_offset(GritsPackEntry *entry)
+{
+	return entry->offset + sizeof(GritsPackRecord) +
+		PACK_ALIGN(entry->key_len);
+}
+
+/* Add a record to the in memory index, while holding the lock */
+static void _grits_pack_index(GritsPack *pack, const gchar *key,
+		guint32 key_len, guint64 offset, guint32 size)
+{
+	gchar *name = g_strndup(key, key_len);
+	GritsPackEntry *old = g_hash_table_lookup(pack->index, name);
+	if (old)
+		pack->live -= _grits_pack_record_size(old->key_len, old->size);
+	if (size == RECORD_REMOVED) {
+		g_hash_table_remove(pack->index, name);
+		g_free(name);
+		return;
+	}
+	GritsPackEntry *entry = g_new(GritsPackEntry, 1);
+	entry->offset  = offset;
+	entry->size    = size;
+	entry->key_len = key_len;
+	g_hash_table_insert(pack->index, name, entry);
+	pack->live += _grits_pack_record_size(key_len, size);
+}
+
+/* Map the data file so that it covers at least @end */
+static gboolean _grits_pack_map(GritsPack *pack, guint64 end)
+{
+	if (pack->map && pack->mapped >= end)
+		return TRUE;
+	GError *error = NULL;
+	GMappedFile *map = g_mapped_file_new(pack->data_path, FALSE, &error);
+	if (!map) {
+		g_warning("GritsPack: map - %s", error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+	if (pack->map)
+		g_mapped_file_unref(pack->map);
+	pack->map    = map;
+	pack->mapped = g_mapped_file_get_length(map);
+	return pack->mapped >= end;
+}
+
+/* Lock the pack so that other processes do not use it, @fp is the data file.
+ * The lock is released when the data file is closed. */
+static gboolean _grits_pack_lock(GritsPack *pack, FILE *fp)
+{
+#ifdef G_OS_WIN32
+	/* Windows uses a separate lock file, kept open while the pack is */
+	if (pack->lock_fd < 0) {
+		gchar *path = g_build_filename(pack->dir, "pack.lock", NULL);
+		pack->lock_fd = _sopen(path, _O_CREAT | _O_RDWR, _SH_DENYRW,
+				_S_IREAD | _S_IWRITE);
+		g_free(path);
+	}
+	return pack->lock_fd >= 0;
+#else
+	return flock(fileno(fp), LOCK_EX | LOCK_NB) == 0;
+#endif
+}
+
+/* Replace the contents of the data file with an empty pack */
+static gboolean _grits_pack_create(GritsPack *pack)
+{
+	GritsPackHeader header = {PACK_MAGIC};
+	header.gen = (guint64)g_random_int() << 32 | g_random_int();
+	if (fflush(pack->fp) || ftruncate(fileno(pack->fp), 0) ||
+	    fseek(pack->fp, 0, SEEK_SET) ||
+	    !fwrite(&header, sizeof(header), 1, pack->fp) ||
+	    fflush(pack->fp)) {
+		g_warning("GritsPack: create - error writing %s", pack->data_path);
+		return FALSE;
+	}
+	pack->gen  = header.gen;
+	pack->size = sizeof(header);
+	return TRUE;
+}
+
+/* Load the index file if it matches the data file */
+static void _grits_pack_read_index(GritsPack *pack, guint64 length)
+{
+	gchar *data;
+	gsize  len;
+	if (!g_file_get_contents(pack->index_path, &data, &len, NULL))
+		return;
+
+	GritsPackIndexHeader *header = (GritsPackIndexHeader*)data;
+	if (len < sizeof(*header) ||
+	    memcmp(header->magic, INDEX_MAGIC, 8) ||
+	    header->gen != pack->gen || header->indexed > length ||
+	    header->check != _grits_pack_hash(2166136261u,
+			    data+sizeof(*header), len-sizeof(*header))) {
+		g_debug("GritsPack: read_index - out of date %s", pack->index_path);
+		g_free(data);
+		return;
+	}
+
+	gchar *cur = data + sizeof(*header);
+	gchar *end = data + len;
+	for (guint32 i = 0; i < header->count; i++) {
+		GritsPackEntry *entry = (GritsPackEntry*)cur;
+		gchar *key = cur + sizeof(*entry);
+		if (key > end || key + PACK_ALIGN(entry->key_len) > end)
+			break;
+		_grits_pack_index(pack, key, entry->key_len,
+				entry->offset, entry->size);
+		cur = key + PACK_ALIGN(entry->key_len);
+	}
+	pack->size    = header->indexed;
+	pack->indexed = header->indexed;
+	g_free(data);
+}
+
+/* Add records which were written after the index, stopping at the first
+ * record which is incomplete */
+static void _grits_pack_replay(GritsPack *pack, guint64 length)
+{
+	if (pack->size >= length || !_grits_pack_map(pack, length))
+		return;
+	const gchar *data = g_mapped_file_get_contents(pack->map);
+	guint64 offset = pack->size;
+	while (offset + sizeof(GritsPackRecord) <= length) {
+		const GritsPackRecord *rec = (GritsPackRecord*)(data+offset);
+		if (rec->magic != RECORD_MAGIC ||
+		    rec->key_len == 0 || rec->key_len > PACK_MAX_KEY)
+			break;
+		guint64 rec_size = _grits_pack_record_size(rec->key_len, rec->size);
+		if (offset + rec_size > length)
+			break;
+		const gchar *key  = (gchar*)(rec+1);
+		const gchar *body = key + PACK_ALIGN(rec->key_len);
+		guint32 check = _grits_pack_hash(2166136261u, key, rec->key_len);
+		if (rec->size != RECORD_REMOVED)
+			check = _grits_pack_hash(check, body, rec->size);
+		if (check != rec->check)
+			break;
+		_grits_pack_index(pack, key, rec->key_len, offset, rec->size);
+		pack->unsynced++;
+		offset += rec_size;
+	}
+	if (offset != length)
+		g_warning("GritsPack: replay - discarding %"G_GUINT64_FORMAT
+				" bytes at the end of %s",
+				length - offset, pack->data_path);
+	/* The discarded bytes will be overwritten, map them again if needed */
+	pack->size   = offset;
+	pack->mapped = MIN(pack->mapped, offset);
+}
+
+static gboolean _grits_pack_load(GritsPack *pack)
+{
+	/* The data file is locked before anything is read from it, since
+	 * another process may be writing it */
+	gint fd = g_open(pack->data_path, O_RDWR | O_CREAT | O_BINARY, 0644);
+	if (fd < 0 || !(pack->fp = fdopen(fd, "r+b"))) {
+		g_warning("GritsPack: load - error opening %s", pack->data_path);
+		if (fd >= 0)
+			close(fd);
+		return FALSE;
+	}
+	if (!_grits_pack_lock(pack, pack->fp)) {
+		g_warning("GritsPack: load - %s is in use", pack->data_path);
+		return FALSE;
+	}
+
+	/* Left over from an interrupted compaction */
+	gchar *tmp = g_strconcat(pack->data_path, ".new", NULL);
+	g_remove(tmp);
+	g_free(tmp);
+
+	GritsPackHeader header = {};
+	fseek(pack->fp, 0, SEEK_END);
+	guint64 length = ftell(pack->fp);
+	rewind(pack->fp);
+	if (!fread(&header, sizeof(header), 1, pack->fp) ||
+	    memcmp(header.magic, PACK_MAGIC, 8)) {
+		if (length > 0)
+			g_warning("GritsPack: load - replacing %s", pack->data_path);
+		return _grits_pack_create(pack);
+	}
+
+	pack->gen  = header.gen;
+	pack->size = sizeof(header);
+	_grits_pack_read_index(pack, length);
+	_grits_pack_replay(pack, length);
+	g_debug("GritsPack: load - %s files=%d size=%"G_GUINT64_FORMAT
+			" live=%"G_GUINT64_FORMAT" replayed=%d",
+			pack->dir, g_hash_table_size(pack->index),
+			pack->size, pack->live, pack->unsynced);
+	return TRUE;
+}
+
+/* Write the index file, while holding the lock */
+static gboolean _grits_pack_sync(GritsPack *pack)
+{
+	if (fflush(pack->fp) || fsync(fileno(pack->fp))) {
+		g_warning("GritsPack: sync - error flushing %s", pack->data_path);
+		return FALSE;
+	}
+
+	GByteArray *buf = g_byte_array_new();
+	GritsPackIndexHeader header = {INDEX_MAGIC};
+	header.gen     = pack->gen;
+	header.indexed = pack->size;
+	header.count   = g_hash_table_size(pack->index);
+	g_byte_array_append(buf, (guint8*)&header, sizeof(header));
+
+	static const guint8 zeros[8];
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init(&iter, pack->index);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		GritsPackEntry *entry = value;
+		g_byte_array_append(buf, (guint8*)entry, sizeof(*entry));
+		g_byte_array_append(buf, key, entry->key_len);
+		g_byte_array_append(buf, zeros,
+				PACK_ALIGN(entry->key_len) - entry->key_len);
+	}
+	((GritsPackIndexHeader*)buf->data)->check = _grits_pack_hash(
+			2166136261u, buf->data+sizeof(header),
+			buf->len-sizeof(header));
+
+	GError *error = NULL;
+	gboolean ok = g_file_set_contents(pack->index_path,
+			(gchar*)buf->data, buf->len, &error);
+	if (!ok) {
+		g_warning("GritsPack: sync - %s", error->message);
+		g_error_free(error);
+	} else {
+		pack->indexed  = pack->size;
+		pack->unsynced = 0;
+	}
+	g_byte_array_free(buf, TRUE);
+	return ok;
+}
+
+/* Append a record, while holding the lock, @size is RECORD_REMOVED to remove
+ * the file */
+static gboolean _grits_pack_append(GritsPack *pack, const gchar *key,
+		gconstpointer data, guint32 size)
+{
+	static const gchar zeros[8];
+	guint32 key_len = strlen(key);
+	if (key_len == 0 || key_len > PACK_MAX_KEY)
+		return FALSE;
+
+	GritsPackRecord rec = {RECORD_MAGIC, key_len, size};
+	rec.check = _grits_pack_hash(2166136261u, key, key_len);
+	if (size != RECORD_REMOVED)
+		rec.check = _grits_pack_hash(rec.check, data, size);
+
+	/* Anything after the last complete record is overwritten */
+	gsize key_pad  = PACK_ALIGN(key_len) - key_len;
+	gsize data_pad = size == RECORD_REMOVED ? 0 : PACK_ALIGN(size) - size;
+	if (fseek(pack->fp, pack->size, SEEK_SET) ||
+	    !fwrite(&rec, sizeof(rec), 1, pack->fp) ||
+	    !fwrite(key, key_len, 1, pack->fp) ||
+	    (key_pad  && !fwrite(zeros, key_pad, 1, pack->fp)) ||
+	    (size && size != RECORD_REMOVED && !fwrite(data, size, 1, pack->fp)) ||
+	    (data_pad && !fwrite(zeros, data_pad, 1, pack->fp)) ||
+	    fflush(pack->fp)) {
+		g_warning("GritsPack: append - error writing %s", pack->data_path);
+		return FALSE;
+	}
+
+	_grits_pack_index(pack, key, key_len, pack->size, size);
+	pack->size += _grits_pack_record_size(key_len, size);
+	if (++pack->unsynced >= PACK_SYNC)
+		_grits_pack_sync(pack);
+	return TRUE;
+}
+
+/**
+ * grits_pack_open:
+ * @dir: the directory to store the pack in
+ *
+ * Open the pack stored in @dir, creating it if needed. Opening the same
+ * directory more than once returns the same pack.
+ *
+ * Returns: the pack, or NULL on error
+ */
+GritsPack *grits_pack_open(const gchar *dir)
+{
+	g_mutex_lock(&grits_packs_lock);
+	if (!grits_packs)
+		grits_packs = g_hash_table_new(g_str_hash, g_str_equal);
+	GritsPack *pack = g_hash_table_lookup(grits_packs, dir);
+	if (pack) {
+		pack->refs++;
+		g_mutex_unlock(&grits_packs_lock);
+		return pack;
+	}
+
+	g_debug("GritsPack: open - %s", dir);
+	pack = g_new0(GritsPack, 1);
+	pack->dir        = g_strdup(dir);
+	pack->data_path  = g_build_filename(dir, "pack.data",  NULL);
+	pack->index_path = g_build_filename(dir, "pack.index", NULL);
+	pack->index      = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
+	pack->refs       = 1;
+#ifdef G_OS_WIN32
+	pack->lock_fd    = -1;
+#endif
+	g_mutex_init(&pack->lock);
+	g_mkdir_with_parents(dir, 0755);
+	if (!_grits_pack_load(pack)) {
+		g_mutex_unlock(&grits_packs_lock);
+		pack->refs = 0;
+		grits_pack_close(pack);
+		return NULL;
+	}
+	g_hash_table_insert(grits_packs, pack->dir, pack);
+	g_mutex_unlock(&grits_packs_lock);
+	return pack;
+}
+
+/**
+ * grits_pack_close:
+ * @pack: the pack to close
+ *
+ * Release a reference to the pack, once it is no longer used the index is
+ * written and the files are closed.
+ */
+void grits_pack_close(GritsPack *pack)
+{
+	g_mutex_lock(&grits_packs_lock);
+	if (pack->refs > 0 && --pack->refs > 0) {
+		g_mutex_unlock(&grits_packs_lock);
+		return;
+	}
+	if (grits_packs && g_hash_table_lookup(grits_packs, pack->dir) == pack)
+		g_hash_table_remove(grits_packs, pack->dir);
+	g_mutex_unlock(&grits_packs_lock);
+
+	g_debug("GritsPack: close - %s", pack->dir);
+	if (pack->fp) {
+		if (pack->unsynced)
+			_grits_pack_sync(pack);
+		fclose(pack->fp);
+	}
+	if (pack->map)
+		g_mapped_file_unref(pack->map);
+#ifdef G_OS_WIN32
+	if (pack->lock_fd >= 0)
+		close(pack->lock_fd);
+#endif
+	g_hash_table_destroy(pack->index);
+	g_mutex_clear(&pack->lock);
+	g_free(pack->dir);
+	g_free(pack->data_path);
+	g_free(pack->index_path);
+	g_free(pack);
+}
+
+/**
+ * grits_pack_has:
+ * @pack: the pack to search
+ * @key:  the name of the file
+ *
+ * Check if a file is stored in the pack.
+ *
+ * Returns: TRUE if the file exists
+ */
+gboolean grits_pack_has(GritsPack *pack, const gchar *key)
+{
+	g_mutex_lock(&pack->lock);
+	gboolean has = g_hash_table_contains(pack->index, key);
+	g_mutex_unlock(&pack->lock);
+	return has;
+}
+
+/**
+ * grits_pack_get:
+ * @pack: the pack to read from
+ * @key:  the name of the file
+ *
+ * Read a file from the pack. The returned data points into the memory mapped
+ * data file, it remains valid even if the file is replaced or the pack is
+ * compacted.
+ *
+ * Returns: the contents of the file, or NULL if it does not exist
+ */
+GBytes *grits_pack_get(GritsPack *pack, const gchar *key)
+{
+	GBytes *bytes = NULL;
+	g_mutex_lock(&pack->lock);
+	GritsPackEntry *entry = g_hash_table_lookup(pack->index, key);
+	if (entry) {
+		guint64 offset = _grits_pack_data_offset(entry);
+		if (_grits_pack_map(pack, offset + entry->size))
+			bytes = g_bytes_new_with_free_func(
+				g_mapped_file_get_contents(pack->map) + offset,
+				entry->size,
+				(GDestroyNotify)g_mapped_file_unref,
+				g_mapped_file_ref(pack->map));
+	}
+	g_mutex_unlock(&pack->lock);
+	return bytes;
+}
+
+/**
+ * grits_pack_put:
+ * @pack: the pack to write to
+ * @key:  the name of the file
+ * @data: the contents of the file
+ * @size: the size of the file in bytes
+ *
+ * Add a file to the pack, replacing any existing file with the same name.
+ *
+ * Returns: TRUE if the file was written
+ */
+gboolean grits_pack_put(GritsPack *pack, const gchar *key,
+		gconstpointer data, gsize size)
+{
+	if (size >= RECORD_REMOVED)
+		return FALSE;
+	g_mutex_lock(&pack->lock);
+	gboolean ok = _grits_pack_append(pack, key, data, size);
+	g_mutex_unlock(&pack->lock);
+	return ok;
+}
+
+/**
+ * grits_pack_remove:
+ * @pack: the pack to remove from
+ * @key:  the name of the file
+ *
+ * Remove a file from the pack.
+ *
+ * Returns: TRUE if the file was removed or did not exist
+ */
+gboolean grits_pack_remove(GritsPack *pack, const gchar *key)
+{
+	gboolean ok = TRUE;
+	g_mutex_lock(&pack->lock);
+	if (g_hash_table_contains(pack->index, key))
+		ok = _grits_pack_append(pack, key, NULL, RECORD_REMOVED);
+	g_mutex_unlock(&pack->lock);
+	return ok;
+}
+
+/**
+ * grits_pack_foreach:
+ * @pack:      the pack to list
+ * @func:      function to call for each file
+ * @user_data: user data to pass to the function
+ *
+ * Call a function for each file in the pack. The pack is locked while this
+ * runs, so @func must not use the pack.
+ */
+void grits_pack_foreach(GritsPack *pack, GritsPackFunc func, gpointer user_data)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	g_mutex_lock(&pack->lock);
+	g_hash_table_iter_init(&iter, pack->index);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		func(key, ((GritsPackEntry*)value)->size, user_data);
+	g_mutex_unlock(&pack->lock);
+}
+
+/**
+ * grits_pack_get_size:
+ * @pack:  the pack
+ * @live:  bytes used by current files, or NULL
+ * @total: size of the data file, or NULL
+ *
+ * Get the amount of space used by the pack, the difference between @total
+ * and @live is reclaimed by grits_pack_compact.
+ */
+void grits_pack_get_size(GritsPack *pack, guint64 *live, guint64 *total)
+{
+	g_mutex_lock(&pack->lock);
+	if (live)  *live  = pack->live;
+	if (total) *total = pack->size;
+	g_mutex_unlock(&pack->lock);
+}
+
+/**
+ * grits_pack_sync:
+ * @pack: the pack
+ *
+ * Flush the data file to disk and write the index.
+ *
+ * Returns: TRUE on success
+ */
+gboolean grits_pack_sync(GritsPack *pack)
+{
+	g_mutex_lock(&pack->lock);
+	gboolean ok = _grits_pack_sync(pack);
+	g_mutex_unlock(&pack->lock);
+	return ok;
+}
+
+/* Copy a record from the old data file to the new one and index it in @next,
+ * which only holds the new index and sizes
+ * Returns the size of the record, or 0 on error */
+static guint64 _grits_pack_copy(GritsPack *next, FILE *fp,
+		const gchar *data, guint64 offset)
+{
+	const GritsPackRecord *rec = (GritsPackRecord*)(data+offset);
+	guint64 rec_size = _grits_pack_record_size(rec->key_len, rec->size);
+	if (!fwrite(rec, rec_size, 1, fp))
+		return 0;
+	_grits_pack_index(next, (gchar*)(rec+1), rec->key_len,
+			next->size, rec->size);
+	next->size += rec_size;
+	return rec_size;
+}
+
+/**
+ * grits_pack_compact:
+ * @pack: the pack
+ *
+ * Rewrite the data file with only the current version of each file. The new
+ * data file is written next to the old one and renamed over it once it is
+ * complete, so the pack is intact if this is interrupted.
+ *
+ * The pack can be used while the files are copied, the lock is only held
+ * while the index is copied and while the new data file is swapped in.
+ *
+ * Returns: TRUE on success
+ */
+gboolean grits_pack_compact(GritsPack *pack)
+{
+	g_mutex_lock(&pack->lock);
+	g_debug("GritsPack: compact - %s live=%"G_GUINT64_FORMAT
+			" size=%"G_GUINT64_FORMAT, pack->dir, pack->live, pack->size);
+	if (pack->compacting || !_grits_pack_map(pack, pack->size)) {
+		g_mutex_unlock(&pack->lock);
+		return FALSE;
+	}
+
+	/* Snapshot the current records, the mapping stays valid while the
+	 * pack is appended to */
+	GMappedFile *map     = g_mapped_file_ref(pack->map);
+	guint64      end     = pack->size;
+	GArray      *offsets = g_array_sized_new(FALSE, FALSE, sizeof(guint64),
+			g_hash_table_size(pack->index));
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, pack->index);
+	while (g_hash_table_iter_next(&iter, NULL, &value))
+		g_array_append_val(offsets, ((GritsPackEntry*)value)->offset);
+	pack->compacting = TRUE;
+	g_mutex_unlock(&pack->lock);
+
+	/* Copy current records to the new file */
+	gchar *tmp = g_strconcat(pack->data_path, ".new", NULL);
+	FILE  *fp  = g_fopen(tmp, "w+b");
+	GritsPackHeader header = {PACK_MAGIC};
+	header.gen = (guint64)g_random_int() << 32 | g_random_int();
+	gboolean ok = fp && fwrite(&header, sizeof(header), 1, fp);
+
+	GritsPack next = {};
+	next.index = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
+	next.size  = sizeof(header);
+	const gchar *data = g_mapped_file_get_contents(map);
+	for (guint i = 0; ok && i < offsets->len; i++)
+		ok = _grits_pack_copy(&next, fp, data,
+				g_array_index(offsets, guint64, i)) > 0;
+	ok = ok && !fflush(fp) && !fsync(fileno(fp));
+	g_array_free(offsets, TRUE);
+	g_mapped_file_unref(map);
+
+	/* Copy records appended in the mean time and replace the data file,
+	 * the old index no longer matches */
+	g_mutex_lock(&pack->lock);
+	ok = ok && _grits_pack_map(pack, pack->size);
+	if (ok && pack->size > end) {
+		data = g_mapped_file_get_contents(pack->map);
+		for (guint64 offset = end; ok && offset < pack->size; ) {
+			guint64 copied = _grits_pack_copy(&next, fp, data, offset);
+			ok      = copied > 0;
+			offset += copied;
+		}
+		ok = ok && !fflush(fp) && !fsync(fileno(fp));
+	}
+
+	/* The new file is locked before it replaces the old one, so that the
+	 * pack is never left unlocked */
+	ok = ok && _grits_pack_lock(pack, fp);
+#ifdef G_OS_WIN32
+	/* Open files can not be replaced on Windows */
+	if (ok) {
+		fclose(pack->fp);
+		pack->fp = NULL;
+	}
+#endif
+	ok = ok && !g_rename(tmp, pack->data_path);
+	pack->compacting = FALSE;
+	if (!ok) {
+		g_warning("GritsPack: compact - error writing %s", tmp);
+		if (fp)
+			fclose(fp);
+		g_remove(tmp);
+		g_hash_table_destroy(next.index);
+		if (!pack->fp)
+			pack->fp = g_fopen(pack->data_path, "r+b");
+		g_free(tmp);
+		g_mutex_unlock(&pack->lock);
+		return FALSE;
+	}
+	if (pack->fp)
+		fclose(pack->fp);
+	pack->fp = fp;
+	g_hash_table_destroy(pack->index);
+	pack->index = next.index;
+	pack->gen   = header.gen;
+	pack->size  = next.size;
+	pack->live  = next.live;
+	GMappedFile *old = pack->map;
+	pack->map    = NULL;
+	pack->mapped = 0;
+	_grits_pack_sync(pack);
+	g_mutex_unlock(&pack->lock);
+
+	/* Releasing the last mapping frees the old data file, which can be
+	 * slow for large packs */
+	if (old)
+		g_mapped_file_unref(old);
+	g_free(tmp);
+	return TRUE;
+}
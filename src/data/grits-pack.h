@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GRITS_PACK_H__
+#define __GRITS_PACK_H__
+
+#include <glib.h>
+
+typedef struct _GritsPack GritsPack;
+
+/**
+ * GritsPackFunc:
+ * @key:       name of the file
+ * @size:      size of the file in bytes
+ * @user_data: user data passed to grits_pack_foreach
+ *
+ * Function called for each file in a pack
+ */
+typedef void (*GritsPackFunc)(const gchar *key, gsize size, gpointer user_data);
+
+GritsPack *grits_pack_open(const gchar *dir);
+
+void grits_pack_close(GritsPack *pack);
+
+gboolean grits_pack_has(GritsPack *pack, const gchar *key);
+
+GBytes *grits_pack_get(GritsPack *pack, const gchar *key);
+
+gboolean grits_pack_put(GritsPack *pack, const gchar *key,
+		gconstpointer data, gsize size);
+
+gboolean grits_pack_remove(GritsPack *pack, const gchar *key);
+
+void grits_pack_foreach(GritsPack *pack, GritsPackFunc func, gpointer user_data);
+
+void grits_pack_get_size(GritsPack *pack, guint64 *live, guint64 *total);
+
+gboolean grits_pack_sync(GritsPack *pack);
+
+gboolean grits_pack_compact(GritsPack *pack);
+
+#endif
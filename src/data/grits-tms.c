@@ -56,21 +56,46 @@ static gchar *_make_uri(GritsTms *tms, GritsTile *tile)
 			tms->uri_prefix, zoom, xtile, ytile, tms->extension);
 }
 
+static gchar *_make_local(GritsTms *tms, GritsTile *tile)
+{
+	gchar *tilep = grits_tile_get_path(tile);
+	gchar *local = g_strdup_printf("%s%s", tilep, tms->extension);
+	g_free(tilep);
+	return local;
+}
+
 gchar *grits_tms_fetch(GritsTms *tms, GritsTile *tile, GritsCacheType mode,
 		GritsChunkCallback callback, gpointer user_data)
 {
 	/* Get file path */
 	gchar *uri   = _make_uri(tms, tile);
-	gchar *tilep = grits_tile_get_path(tile);
-	gchar *local = g_strdup_printf("%s%s", tilep, tms->extension);
+	gchar *local = _make_local(tms, tile);
 	gchar *path  = grits_http_fetch(tms->http, uri, local,
 			mode, callback, user_data);
 	g_free(uri);
-	g_free(tilep);
 	g_free(local);
 	return path;
 }
 
+GBytes *grits_tms_fetch_bytes(GritsTms *tms, GritsTile *tile,
+		GritsCacheType mode, GritsChunkCallback callback, gpointer user_data)
+{
+	gchar  *uri   = _make_uri(tms, tile);
+	gchar  *local = _make_local(tms, tile);
+	GBytes *bytes = grits_http_fetch_bytes(tms->http, uri, local,
+			mode, callback, user_data);
+	g_free(uri);
+	g_free(local);
+	return bytes;
+}
+
+void grits_tms_remove(GritsTms *tms, GritsTile *tile)
+{
+	gchar *local = _make_local(tms, tile);
+	grits_http_remove(tms->http, local);
+	g_free(local);
+}
+
 GritsTms *grits_tms_new(const gchar *uri_prefix,
 		const gchar *prefix, const gchar *extension)
 {
@@ -35,6 +35,11 @@ struct _GritsTms {
 gchar *grits_tms_fetch(GritsTms *tms, GritsTile *tile, GritsCacheType mode,
 		GritsChunkCallback callback, gpointer user_data);
 
+GBytes *grits_tms_fetch_bytes(GritsTms *tms, GritsTile *tile,
+		GritsCacheType mode, GritsChunkCallback callback, gpointer user_data);
+
+void grits_tms_remove(GritsTms *tms, GritsTile *tile);
+
 GritsTms *grits_tms_new(const gchar *uri_prefix, const gchar *cache_prefix, const gchar *extention);
 
 void grits_tms_free(GritsTms *self);
@@ -72,25 +72,17 @@
 #include <config.h>
 #include <stdio.h>
 #include <glib.h>
-#include <locale.h>
 
 #include "grits-wms.h"
 #include "grits-http.h"
 
-static gchar *g_strdup_printf_safe(char *fmt, ...)
-{
-	va_list ap;
-	va_start(ap, fmt);
-	setlocale(LC_ALL, "POSIX.UTF-8");
-	char *str = g_strdup_vprintf(fmt, ap);
-	setlocale(LC_ALL, "");
-	va_end(ap);
-	return str;
-}
-
+/* Format the bounding box without the locale, since setlocale is not thread
+ * safe and tiles are fetched from several threads at once */
 static gchar *_make_uri(GritsWms *wms, GritsTile *tile)
 {
-	return g_strdup_printf_safe(
+	gchar w[G_ASCII_DTOSTR_BUF_SIZE], s[G_ASCII_DTOSTR_BUF_SIZE];
+	gchar e[G_ASCII_DTOSTR_BUF_SIZE], n[G_ASCII_DTOSTR_BUF_SIZE];
+	return g_strdup_printf(
 		"%s?"
 		"SERVICE=WMS&"
 		"VERSION=1.1.0&"
@@ -101,16 +93,24 @@ static gchar *_make_uri(GritsWms *wms, GritsTile *tile)
 		"FORMAT=%s&"
 		"WIDTH=%d&"
 		"HEIGHT=%d&"
-		"BBOX=%f,%f,%f,%f",
+		"BBOX=%s,%s,%s,%s",
 		wms->uri_prefix,
 		wms->uri_layer,
 		wms->uri_format,
 		wms->width,
 		wms->height,
-		tile->edge.w,
-		tile->edge.s,
-		tile->edge.e,
-		tile->edge.n);
+		g_ascii_formatd(w, sizeof(w), "%f", tile->edge.w),
+		g_ascii_formatd(s, sizeof(s), "%f", tile->edge.s),
+		g_ascii_formatd(e, sizeof(e), "%f", tile->edge.e),
+		g_ascii_formatd(n, sizeof(n), "%f", tile->edge.n));
+}
+
+static gchar *_make_local(GritsWms *wms, GritsTile *tile)
+{
+	gchar *tilep = grits_tile_get_path(tile);
+	gchar *local = g_strdup_printf("%s%s", tilep, wms->extension);
+	g_free(tilep);
+	return local;
 }
 
 /**
@@ -129,16 +129,53 @@ gchar *grits_wms_fetch(GritsWms *wms, GritsTile *tile, GritsCacheType mode,
 		GritsChunkCallback callback, gpointer user_data)
 {
 	gchar *uri   = _make_uri(wms, tile);
-	gchar *tilep = grits_tile_get_path(tile);
-	gchar *local = g_strdup_printf("%s%s", tilep, wms->extension);
+	gchar *local = _make_local(wms, tile);
 	gchar *path  = grits_http_fetch(wms->http, uri, local,
 			mode, callback, user_data);
 	g_free(uri);
-	g_free(tilep);
 	g_free(local);
 	return path;
 }
 
+/**
+ * grits_wms_fetch_bytes:
+ * @wms:       the #GritsWms to fetch the data from
+ * @tile:      a #GritsTile representing the area to be fetched
+ * @mode:      the update type to use when fetching data
+ * @callback:  callback to call when a chunk of data is received
+ * @user_data: user data to pass to the callback
+ *
+ * Fetch a image coresponding to a #GritsTile from a WMS server and read it,
+ * see grits_http_fetch_bytes.
+ *
+ * Returns: the contents of the image, or NULL on error
+ */
+GBytes *grits_wms_fetch_bytes(GritsWms *wms, GritsTile *tile,
+		GritsCacheType mode, GritsChunkCallback callback, gpointer user_data)
+{
+	gchar  *uri   = _make_uri(wms, tile);
+	gchar  *local = _make_local(wms, tile);
+	GBytes *bytes = grits_http_fetch_bytes(wms->http, uri, local,
+			mode, callback, user_data);
+	g_free(uri);
+	g_free(local);
+	return bytes;
+}
+
+/**
+ * grits_wms_remove:
+ * @wms:  the #GritsWms the image was fetched from
+ * @tile: a #GritsTile representing the image
+ *
+ * Remove a image from the cache, for instance because it could not be read.
+ */
+void grits_wms_remove(GritsWms *wms, GritsTile *tile)
+{
+	gchar *local = _make_local(wms, tile);
+	grits_http_remove(wms->http, local);
+	g_free(local);
+}
+
 /**
  * grits_wms_new:
  * @uri_prefix: the base URL for the WMS server
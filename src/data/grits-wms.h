@@ -41,6 +41,11 @@ GritsWms *grits_wms_new(
 gchar *grits_wms_fetch(GritsWms *wms, GritsTile *tile, GritsCacheType mode,
 		GritsChunkCallback callback, gpointer user_data);
 
+GBytes *grits_wms_fetch_bytes(GritsWms *wms, GritsTile *tile,
+		GritsCacheType mode, GritsChunkCallback callback, gpointer user_data);
+
+void grits_wms_remove(GritsWms *wms, GritsTile *tile);
+
 void grits_wms_free(GritsWms *wms);
 
 #endif
@@ -13,10 +13,10 @@
  * with g_pqueue_pop(), but deleting entries out of order is possible.
  * </para>
  * <para>
- * The entries <emphasis>cannot</emphasis> be iterated over in any way other
- * than removing them one by one in order of priority, but when doing that,
- * this structure is far more efficient than sorted lists or balanced trees,
- * which on the other hand do not suffer from this restriction.
+ * The entries can be visited with g_pqueue_foreach(), but only in an
+ * unspecified order. To get them in order of priority they have to be
+ * removed one by one, but when doing that, this structure is far more
+ * efficient than sorted lists or balanced trees.
  * </para>
  * <para>
  * You will want to be very careful with calls that use #GPQueueHandle.
@@ -26,26 +26,32 @@
  * </para>
  * <note>
  *   <para>
- *     Internally, #GPQueue currently uses a Fibonacci heap to store
- *     the entries. This implementation detail may change.
+ *     Internally, #GPQueue currently uses an array based 4-ary heap to
+ *     store the entries. Each handle records the position of its entry in
+ *     the array. This implementation detail may change.
  *   </para>
  * </note>
  **/
 
-struct _GPQueueNode {
-  GPQueueNode *next;
-  GPQueueNode *prev;
-  GPQueueNode *parent;
-  GPQueueNode *child;
+/* Children per heap node, 4 keeps siblings in the same cache line */
+#define G_PQUEUE_ARITY 4
 
-  gpointer data;
+/* Number of nodes to allocate at once */
+#define G_PQUEUE_CHUNK 1024
 
-  gint degree;
-  gboolean marked;
+struct _GPQueueNode {
+  gpointer data;
+  guint index;
 };
 
 struct _GPQueue {
-  GPQueueNode *root;
+  GPQueueNode **heap;
+  guint len;
+  guint size;
+
+  GPtrArray *chunks;
+  GPQueueNode *free;
+
   GCompareDataFunc cmp;
   gpointer *cmpdata;
 };
@@ -70,8 +76,8 @@ g_pqueue_new (GCompareDataFunc compare_func,
 {
   g_return_val_if_fail (compare_func != NULL, NULL);
 
-  GPQueue *pqueue = g_slice_new (GPQueue);
-  pqueue->root = NULL;
+  GPQueue *pqueue = g_slice_new0 (GPQueue);
+  pqueue->chunks = g_ptr_array_new ();
   pqueue->cmp = compare_func;
   pqueue->cmpdata = compare_userdata;
   return pqueue;
@@ -90,25 +96,12 @@ g_pqueue_new (GCompareDataFunc compare_func,
 gboolean
 g_pqueue_is_empty (GPQueue *pqueue)
 {
-  return (pqueue->root == NULL);
-}
-
-static void
-g_pqueue_node_foreach (GPQueueNode *node,
-                       GPQueueNode *stop,
-                       GFunc func,
-	               gpointer user_data)
-{
-  if (node == NULL || node == stop) return;
-  func(node->data, user_data);
-  if (stop == NULL) stop = node;
-  g_pqueue_node_foreach (node->next,  stop, func, user_data);
-  g_pqueue_node_foreach (node->child, NULL, func, user_data);
+  return (pqueue->len == 0);
 }
 
 /**
  * g_pqueue_foreach:
- * @pqueue: a #GQueue.
+ * @pqueue: a #GQueue.
  * @func: the function to call for each element's data
  * @user_data: user data to pass to func
  *
@@ -121,17 +114,14 @@ g_pqueue_foreach (GPQueue *pqueue,
                   GFunc func,
 		  gpointer user_data)
 {
-  g_pqueue_node_foreach (pqueue->root, NULL, func, user_data);
+  guint i;
+  for (i = 0; i < pqueue->len; i++)
+    func (pqueue->heap[i]->data, user_data);
 }
 
-static void
-g_pqueue_add_ptr_cb (gpointer obj, GPtrArray *ptrs)
-{
-	g_ptr_array_add(ptrs, obj);
-}
 /**
  * g_pqueue_get_array:
- * @pqueue: a #GQueue.
+ * @pqueue: a #GQueue.
  *
  * Construct a GPtrArray for the items in pqueue. This can be useful when
  * updating the priorities of all the elements in pqueue.
@@ -143,9 +133,11 @@ g_pqueue_add_ptr_cb (gpointer obj, GPtrArray *ptrs)
 GPtrArray *
 g_pqueue_get_array (GPQueue *pqueue)
 {
-	GPtrArray *ptrs = g_ptr_array_new();
-	g_pqueue_foreach(pqueue, (GFunc)g_pqueue_add_ptr_cb, ptrs);
-	return ptrs;
+  guint i;
+  GPtrArray *ptrs = g_ptr_array_sized_new (pqueue->len);
+  for (i = 0; i < pqueue->len; i++)
+    g_ptr_array_add (ptrs, pqueue->heap[i]->data);
+  return ptrs;
 }
 
 static inline gint
@@ -157,38 +149,88 @@ cmp (GPQueue *pqueue,
 }
 
 static inline void
-g_pqueue_node_cut (GPQueueNode *src)
+g_pqueue_set (GPQueue *pqueue,
+              guint index,
+              GPQueueNode *node)
 {
-  src->prev->next = src->next;
-  src->next->prev = src->prev;
-  src->next = src;
-  src->prev = src;
+  pqueue->heap[index] = node;
+  node->index = index;
 }
 
-static inline void
-g_pqueue_node_insert_before (GPQueueNode *dest,
-                             GPQueueNode *src)
+static GPQueueNode*
+g_pqueue_node_new (GPQueue *pqueue,
+                   gpointer data)
 {
-  GPQueueNode *prev;
+  GPQueueNode *node;
+
+  /* Unused nodes are linked through their data pointers */
+  if (pqueue->free == NULL) {
+    GPQueueNode *chunk = g_new (GPQueueNode, G_PQUEUE_CHUNK);
+    gint i;
+    for (i = 0; i < G_PQUEUE_CHUNK; i++)
+      chunk[i].data = (i+1 < G_PQUEUE_CHUNK) ? &chunk[i+1] : NULL;
+    g_ptr_array_add (pqueue->chunks, chunk);
+    pqueue->free = chunk;
+  }
 
-  prev = dest->prev;
-  dest->prev = src->prev;
-  src->prev->next = dest;
-  src->prev = prev;
-  prev->next = src;
+  node = pqueue->free;
+  pqueue->free = node->data;
+  node->data = data;
+  return node;
 }
 
-static inline void
-g_pqueue_node_insert_after (GPQueueNode *dest,
-                            GPQueueNode *src)
+static void
+g_pqueue_node_free (GPQueue *pqueue,
+                    GPQueueNode *node)
 {
-  GPQueueNode *next;
+  node->data = pqueue->free;
+  pqueue->free = node;
+}
+
+static gboolean
+g_pqueue_sift_up (GPQueue *pqueue,
+                  guint index)
+{
+  GPQueueNode *node = pqueue->heap[index];
+  guint start = index;
+
+  while (index > 0) {
+    guint parent = (index - 1) / G_PQUEUE_ARITY;
+    if (cmp (pqueue, node, pqueue->heap[parent]) >= 0)
+      break;
+    g_pqueue_set (pqueue, index, pqueue->heap[parent]);
+    index = parent;
+  }
+  g_pqueue_set (pqueue, index, node);
 
-  next = dest->next;
-  dest->next = src;
-  src->prev->next = next;
-  next->prev = src->prev;
-  src->prev = dest;
+  return index != start;
+}
+
+static void
+g_pqueue_sift_down (GPQueue *pqueue,
+                    guint index)
+{
+  GPQueueNode *node = pqueue->heap[index];
+
+  while (TRUE) {
+    guint first = index * G_PQUEUE_ARITY + 1;
+    guint last  = MIN (first + G_PQUEUE_ARITY, pqueue->len);
+    guint best, child;
+
+    if (first >= pqueue->len)
+      break;
+
+    best = first;
+    for (child = first + 1; child < last; child++)
+      if (cmp (pqueue, pqueue->heap[child], pqueue->heap[best]) < 0)
+        best = child;
+
+    if (cmp (pqueue, pqueue->heap[best], node) >= 0)
+      break;
+    g_pqueue_set (pqueue, index, pqueue->heap[best]);
+    index = best;
+  }
+  g_pqueue_set (pqueue, index, node);
 }
 
 /**
@@ -213,25 +255,16 @@ GPQueueHandle
 g_pqueue_push (GPQueue *pqueue,
                gpointer data)
 {
-  GPQueueNode *e;
-
-  e = g_slice_new (GPQueueNode);
-  e->next = e;
-  e->prev = e;
-  e->parent = NULL;
-  e->child = NULL;
-  e->data = data;
-  e->degree = 0;
-  e->marked = FALSE;
-
-  if (pqueue->root != NULL) {
-    g_pqueue_node_insert_before (pqueue->root, e);
-    if (cmp (pqueue, e, pqueue->root) < 0)
-      pqueue->root = e;
-  } else {
-    pqueue->root = e;
+  GPQueueNode *e = g_pqueue_node_new (pqueue, data);
+
+  if (pqueue->len == pqueue->size) {
+    pqueue->size = MAX (pqueue->size * 2, G_PQUEUE_CHUNK);
+    pqueue->heap = g_renew (GPQueueNode*, pqueue->heap, pqueue->size);
   }
 
+  g_pqueue_set (pqueue, pqueue->len++, e);
+  g_pqueue_sift_up (pqueue, e->index);
+
   return e;
 }
 
@@ -252,130 +285,7 @@ g_pqueue_push (GPQueue *pqueue,
 gpointer
 g_pqueue_peek (GPQueue *pqueue)
 {
-  return (pqueue->root != NULL) ? pqueue->root->data : NULL;
-}
-
-static inline GPQueueNode*
-g_pqueue_make_child (GPQueueNode *a,
-                     GPQueueNode *b)
-{
-  g_pqueue_node_cut(b);
-  if (a->child != NULL) {
-    g_pqueue_node_insert_before (a->child, b);
-    a->degree += 1;
-  } else {
-    a->child = b;
-    a->degree = 1;
-  }
-  b->parent = a;
-  return a;
-}
-
-static inline GPQueueNode*
-g_pqueue_join_trees (GPQueue *pqueue,
-                     GPQueueNode *a,
-                     GPQueueNode *b)
-{
-  if (cmp (pqueue, a, b) < 0)
-    return g_pqueue_make_child (a, b);
-  return g_pqueue_make_child (b, a);
-}
-
-static void
-g_pqueue_fix_rootlist (GPQueue* pqueue)
-{
-  gsize degnode_size;
-  GPQueueNode **degnode;
-  GPQueueNode sentinel;
-  GPQueueNode *current;
-  GPQueueNode *minimum;
-
-  /* We need to iterate over the circular list we are given and do
-   * several things:
-   * - Make sure all the elements are unmarked
-   * - Make sure to return the element in the list with smallest
-   *   priority value
-   * - Find elements of identical degree and join them into trees
-   * The last point is irrelevant for correctness, but essential
-   * for performance. If we did not do this, our data structure would
-   * degrade into an unsorted linked list.
-   */
-
-  degnode_size = (8 * sizeof(gpointer) + 1) * sizeof(gpointer);
-  degnode = g_slice_alloc0 (degnode_size);
-
-  sentinel.next = &sentinel;
-  sentinel.prev = &sentinel;
-  g_pqueue_node_insert_before (pqueue->root, &sentinel);
-
-  current = pqueue->root;
-  while (current != &sentinel) {
-    current->marked = FALSE;
-    current->parent = NULL;
-    gint d = current->degree;
-    if (degnode[d] == NULL) {
-      degnode[d] = current;
-      current = current->next;
-    } else {
-      if (degnode[d] != current) {
-        current = g_pqueue_join_trees (pqueue, degnode[d], current);
-        degnode[d] = NULL;
-      } else {
-        current = current->next;
-      }
-    }
-  }
-
-  current = sentinel.next;
-  minimum = current;
-  while (current != &sentinel) {
-    if (cmp (pqueue, current, minimum) < 0)
-      minimum = current;
-    current = current->next;
-  }
-  pqueue->root = minimum;
-
-  g_pqueue_node_cut (&sentinel);
-
-  g_slice_free1 (degnode_size, degnode);
-}
-
-static void
-g_pqueue_remove_root (GPQueue *pqueue,
-                      GPQueueNode *root)
-{
-  /* This removes a node at the root _level_ of the structure, which can be,
-   * but does not have to be, the actual pqueue->root node. That is why
-   * we require an explicit pointer to the node to be removed instead of just
-   * removing pqueue->root implictly.
-   */
-
-  /* Step one:
-   * If root has any children, pull them up to root level.
-   * At this time, we only deal with their next/prev pointers,
-   * further changes are made later in g_pqueue_fix_rootlist().
-   */
-  if (root->child) {
-    g_pqueue_node_insert_after (root, root->child);
-    root->child = NULL;
-    root->degree = 0;
-  }
-
-  /* Step two:
-   * Cut root out of the list.
-   */
-  if (root->next != root) {
-    pqueue->root = root->next;
-    g_pqueue_node_cut (root);
-    /* Step three:
-     * Clean up the remaining list.
-     */
-    g_pqueue_fix_rootlist (pqueue);
-  } else {
-    pqueue->root = NULL;
-  }
-
-  g_slice_free (GPQueueNode, root);
+  return (pqueue->len > 0) ? pqueue->heap[0]->data : NULL;
 }
 
 /**
@@ -399,70 +309,12 @@ g_pqueue_pop (GPQueue *pqueue)
 {
   gpointer data;
 
-  if (pqueue->root == NULL) return NULL;
-  data = pqueue->root->data;
-  g_pqueue_remove_root (pqueue, pqueue->root);
+  if (pqueue->len == 0) return NULL;
+  data = pqueue->heap[0]->data;
+  g_pqueue_remove (pqueue, pqueue->heap[0]);
   return data;
 }
 
-static inline void
-g_pqueue_make_root (GPQueue *pqueue,
-                    GPQueueNode *entry)
-{
-  /* This moves a node up to the root _level_ of the structure.
-   * It does not always become the actual root element (pqueue->root).
-   */
-
-  GPQueueNode *parent;
-
-  parent = entry->parent;
-  entry->parent = NULL;
-  entry->marked = FALSE;
-  if (parent != NULL) {
-    if (entry->next != entry) {
-      if (parent->child == entry) parent->child = entry->next;
-      g_pqueue_node_cut (entry);
-      parent->degree -= 1;
-    } else {
-      parent->child = NULL;
-      parent->degree = 0;
-    }
-    g_pqueue_node_insert_before (pqueue->root, entry);
-  }
-
-  if (cmp (pqueue, entry, pqueue->root) < 0)
-    pqueue->root = entry;
-}
-
-static void
-g_pqueue_cut_tree (GPQueue *pqueue,
-                   GPQueueNode *entry)
-{
-  /* This function moves an entry up to the root level of the structure.
-   * It extends g_pqueue_make_root() in that the entry's parent, grandparent
-   * etc. may also be moved to the root level if they are "marked". This is
-   * not essential for correctness, it just maintains the so-called "potential"
-   * of the structure, which is necessary for the amortized runtime analysis.
-   */
-
-  GPQueueNode *current;
-  GPQueueNode *parent;
-
-  current = entry;
-  while ((current != NULL) && (current->parent != NULL)) {
-    parent = current->parent;
-    g_pqueue_make_root (pqueue, entry);
-    if (parent->marked) {
-      current = parent;
-    } else {
-      parent->marked = TRUE;
-      current = NULL;
-    }
-  }
-  if (cmp (pqueue, entry, pqueue->root) < 0)
-    pqueue->root = entry;
-}
-
 /**
  * g_pqueue_remove:
  * @pqueue: a #GPQueue.
@@ -480,8 +332,15 @@ void
 g_pqueue_remove (GPQueue* pqueue,
                  GPQueueHandle entry)
 {
-  g_pqueue_cut_tree (pqueue, entry);
-  g_pqueue_remove_root (pqueue, entry);
+  guint index = entry->index;
+  GPQueueNode *last = pqueue->heap[--pqueue->len];
+
+  if (last != entry) {
+    g_pqueue_set (pqueue, index, last);
+    g_pqueue_priority_changed (pqueue, last);
+  }
+
+  g_pqueue_node_free (pqueue, entry);
 }
 
 /**
@@ -498,7 +357,8 @@ g_pqueue_remove (GPQueue* pqueue,
  *
  * Do not attempt to change the priorities of several entries at once.
  * Every time a single object is changed, the #GPQueue needs to be updated
- * by calling g_pqueue_priority_changed() for that object.
+ * by calling g_pqueue_priority_changed() for that object. If the priorities
+ * of most entries have changed use g_pqueue_rebuild() instead.
  *
  * Since: 2.x
  **/
@@ -506,15 +366,8 @@ void
 g_pqueue_priority_changed (GPQueue* pqueue,
                            GPQueueHandle entry)
 {
-  g_pqueue_cut_tree (pqueue, entry);
-
-  if (entry->child) {
-    g_pqueue_node_insert_after (entry, entry->child);
-    entry->child = NULL;
-    entry->degree = 0;
-  }
-
-  g_pqueue_fix_rootlist (pqueue);
+  if (!g_pqueue_sift_up (pqueue, entry->index))
+    g_pqueue_sift_down (pqueue, entry->index);
 }
 
 /**
@@ -531,11 +384,10 @@ g_pqueue_priority_changed (GPQueue* pqueue,
  *
  * <note>
  *   <para>
- *     In the current implementation, an expensive step in
- *     g_pqueue_priority_changed() can be skipped if the new priority is known
- *     to be lower, leading to an amortized running time of O(1) instead of
- *     O(log n). Of course, if the priority is not actually lower, behavior
- *     is undefined.
+ *     In the current implementation, the entry only needs to be moved
+ *     towards the top of the heap if the new priority is known to be lower.
+ *     Of course, if the priority is not actually lower, behavior is
+ *     undefined.
  *   </para>
  * </note>
  *
@@ -545,17 +397,28 @@ void
 g_pqueue_priority_decreased (GPQueue* pqueue,
                              GPQueueHandle entry)
 {
-  g_pqueue_cut_tree (pqueue, entry);
+  g_pqueue_sift_up (pqueue, entry->index);
 }
 
-static void
-g_pqueue_node_free_all (GPQueueNode *node)
+/**
+ * g_pqueue_rebuild:
+ * @pqueue: a #GPQueue.
+ *
+ * Notifies the #GPQueue that the priorities of any number of entries have
+ * changed. The whole queue is reordered in O(n) time, which is faster than
+ * calling g_pqueue_priority_changed() for each entry once more than a small
+ * fraction of them have changed.
+ *
+ * Since: 2.x
+ **/
+void
+g_pqueue_rebuild (GPQueue* pqueue)
 {
-  if (node == NULL) return;
-  g_pqueue_node_free_all (node->child);
-  node->prev->next = NULL;
-  g_pqueue_node_free_all (node->next);
-  g_slice_free (GPQueueNode, node);
+  guint i;
+
+  if (pqueue->len < 2) return;
+  for (i = (pqueue->len - 2) / G_PQUEUE_ARITY + 1; i-- > 0;)
+    g_pqueue_sift_down (pqueue, i);
 }
 
 /**
@@ -569,8 +432,15 @@ g_pqueue_node_free_all (GPQueueNode *node)
 void
 g_pqueue_clear (GPQueue* pqueue)
 {
-  g_pqueue_node_free_all (pqueue->root);
-  pqueue->root = NULL;
+  guint i;
+  for (i = 0; i < pqueue->chunks->len; i++)
+    g_free (pqueue->chunks->pdata[i]);
+  g_ptr_array_set_size (pqueue->chunks, 0);
+  g_free (pqueue->heap);
+  pqueue->heap = NULL;
+  pqueue->len = 0;
+  pqueue->size = 0;
+  pqueue->free = NULL;
 }
 
 /**
@@ -586,5 +456,6 @@ void
 g_pqueue_free (GPQueue* pqueue)
 {
   g_pqueue_clear (pqueue);
+  g_ptr_array_free (pqueue->chunks, TRUE);
   g_slice_free (GPQueue, pqueue);
 }
@@ -52,6 +52,8 @@ void		g_pqueue_priority_changed	(GPQueue* pqueue,
 void		g_pqueue_priority_decreased	(GPQueue* pqueue,
 						 GPQueueHandle entry);
 
+void		g_pqueue_rebuild		(GPQueue* pqueue);
+
 void		g_pqueue_clear			(GPQueue* pqueue);
 
 G_END_DECLS
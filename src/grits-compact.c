@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2009-2011 Andy Spencer <andy753421@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compact packed tile caches, see GritsPack. Packs which are in use by a
+ * running copy of grits are locked, and are skipped. */
+
+#include <config.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "data/grits-pack.h"
+
+static gboolean dry_run = FALSE;
+
+static void compact(const gchar *dir)
+{
+	GritsPack *pack = grits_pack_open(dir);
+	if (!pack) {
+		g_printerr("%s: unable to open pack, it may be in use\n", dir);
+		return;
+	}
+
+	guint64 live, total;
+	grits_pack_get_size(pack, &live, &total);
+	g_print("%s: %"G_GUINT64_FORMAT"k used of %"G_GUINT64_FORMAT"k",
+			dir, live/1024, total/1024);
+	if (!dry_run && live < total) {
+		if (grits_pack_compact(pack)) {
+			grits_pack_get_size(pack, &live, &total);
+			g_print(", compacted to %"G_GUINT64_FORMAT"k", total/1024);
+		} else {
+			g_print(", compaction failed");
+		}
+	}
+	g_print("\n");
+	grits_pack_close(pack);
+}
+
+/* Find packs below a directory */
+static void find(const gchar *dir)
+{
+	GDir *gdir = g_dir_open(dir, 0, NULL);
+	if (!gdir)
+		return;
+	const gchar *name;
+	while ((name = g_dir_read_name(gdir))) {
+		gchar *path = g_build_filename(dir, name, NULL);
+		if (g_str_equal(name, "pack.data"))
+			compact(dir);
+		else if (g_file_test(path, G_FILE_TEST_IS_DIR))
+			find(path);
+		g_free(path);
+	}
+	g_dir_close(gdir);
+}
+
+int main(int argc, char **argv)
+{
+	GOptionEntry entries[] = {
+		{"dry-run", 'n', 0, G_OPTION_ARG_NONE, &dry_run,
+			"Only print the size of each pack", NULL},
+		{NULL}
+	};
+	GError *error = NULL;
+	GOptionContext *context = g_option_context_new("[DIRECTORY...]");
+	g_option_context_set_summary(context,
+		"Compact the packed tile caches below each directory, or below\n"
+		"the grits cache directory by default. Caches which are in\n"
+		"use by grits are skipped.");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	if (argc > 1) {
+		for (int i = 1; i < argc; i++)
+			find(argv[i]);
+	} else {
+		gchar *cache = g_build_filename(g_get_user_cache_dir(),
+				PACKAGE, NULL);
+		find(cache);
+		g_free(cache);
+	}
+	return 0;
+}
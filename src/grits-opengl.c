@@ -172,6 +172,100 @@ static GPtrArray *_objects_to_array(GritsOpenGL *opengl, gboolean ortho)
 	return array;
 }
 
+/* A height function change waiting for the next frame */
+struct HeightUpdate {
+	GritsBounds    bounds;
+	RoamHeightFunc height_func;
+	gpointer       height_data;
+};
+
+/* Apply the queued height functions in a single pass. Each point is moved
+ * once, even when it is inside several of the updated areas, and then the
+ * normals of the triangles around the moved points are recalculated. */
+static void _grits_opengl_apply_heights(GritsOpenGL *opengl)
+{
+	g_mutex_lock(&opengl->heights_lock);
+	GQueue *updates = opengl->heights;
+	opengl->heights = g_queue_new();
+	g_mutex_unlock(&opengl->heights_lock);
+	if (g_queue_is_empty(updates)) {
+		g_queue_free(updates);
+		return;
+	}
+	g_debug("GritsOpenGL: apply_heights - %d updates",
+			g_queue_get_length(updates));
+
+	/* Triangles which only share a corner with the bounds are not returned
+	 * for the exact bounds, so search slightly outside them */
+	const gdouble margin = 1e-6;
+
+	g_mutex_lock(&opengl->sphere_lock);
+	GHashTable *seen      = g_hash_table_new(g_direct_hash, g_direct_equal);
+	GHashTable *moved     = g_hash_table_new(g_direct_hash, g_direct_equal);
+	GPtrArray  *points    = g_ptr_array_new();
+	GPtrArray  *nearby    = g_ptr_array_new();
+	GPtrArray  *triangles = g_ptr_array_new();
+	GPtrArray  *found     = NULL;
+	for (GList *cur = updates->head; cur; cur = cur->next) {
+		struct HeightUpdate *update = cur->data;
+		GritsBounds *bounds = &update->bounds;
+		found = roam_sphere_get_intersect(opengl->sphere, TRUE,
+				bounds->n + margin, bounds->s - margin,
+				bounds->e + margin, bounds->w - margin, found);
+		for (guint t = 0; t < found->len; t++) {
+			RoamTriangle *tri = found->pdata[t];
+			if (!g_hash_table_lookup(seen, tri)) {
+				g_hash_table_insert(seen, tri, tri);
+				g_ptr_array_add(nearby, tri);
+			}
+			RoamPoint *corners[] = {tri->p.l, tri->p.m, tri->p.r, tri->split};
+			for (int i = 0; i < G_N_ELEMENTS(corners); i++) {
+				RoamPoint *point = corners[i];
+				if (bounds->n < point->lat || point->lat < bounds->s ||
+				    bounds->e < point->lon || point->lon < bounds->w)
+					continue;
+				/* Later updates replace the height function */
+				point->height_func = update->height_func;
+				point->height_data = update->height_data;
+				if (!g_hash_table_lookup(moved, point)) {
+					g_hash_table_insert(moved, point, point);
+					g_ptr_array_add(points, point);
+				}
+			}
+		}
+		roam_sphere_touch(opengl->sphere,
+				bounds->n, bounds->s, bounds->e, bounds->w);
+	}
+
+	/* Only triangles using a moved point have changed */
+	for (guint t = 0; t < nearby->len; t++) {
+		RoamTriangle *tri = nearby->pdata[t];
+		if (g_hash_table_lookup(moved, tri->p.l) ||
+		    g_hash_table_lookup(moved, tri->p.m) ||
+		    g_hash_table_lookup(moved, tri->p.r) ||
+		    g_hash_table_lookup(moved, tri->split))
+			g_ptr_array_add(triangles, tri);
+	}
+
+	roam_sphere_update_heights(opengl->sphere,
+			(RoamPoint**)points->pdata, points->len);
+	for (guint t = 0; t < triangles->len; t++)
+		roam_triangle_update_normal(triangles->pdata[t]);
+	roam_sphere_invalidate(opengl->sphere, triangles);
+	g_mutex_unlock(&opengl->sphere_lock);
+
+	g_debug("GritsOpenGL: apply_heights - %d points, %d triangles",
+			points->len, triangles->len);
+	g_hash_table_destroy(seen);
+	g_hash_table_destroy(moved);
+	if (found)
+		g_ptr_array_free(found, TRUE);
+	g_ptr_array_free(points, TRUE);
+	g_ptr_array_free(nearby, TRUE);
+	g_ptr_array_free(triangles, TRUE);
+	g_queue_free_full(updates, g_free);
+}
+
 /*************
  * Callbacks *
  *************/
@@ -373,15 +467,29 @@ static gboolean on_expose(GritsOpenGL *opengl, gpointer data, gpointer _)
 	}
 
 	gtk_gl_begin(GTK_WIDGET(opengl));
+	opengl->frame++;
 
 	_set_settings(opengl);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+	/* Sample new points with the viewer's batch height sampler */
+	GritsViewer *viewer = GRITS_VIEWER(opengl);
+	g_mutex_lock(&opengl->sphere_lock);
+	roam_sphere_set_height_batch(opengl->sphere, viewer->height_func,
+			viewer->height_batch, viewer->height_data);
+	g_mutex_unlock(&opengl->sphere_lock);
+
+	_grits_opengl_apply_heights(opengl);
+
 #ifndef ROAM_DEBUG
 	g_mutex_lock(&opengl->sphere_lock);
 	roam_sphere_update_errors(opengl->sphere);
-	roam_sphere_split_merge(opengl->sphere);
+	gboolean more = roam_sphere_split_merge(opengl->sphere);
 	g_mutex_unlock(&opengl->sphere_lock);
+
+	/* Continue refining on the next frame */
+	if (more)
+		gtk_widget_queue_draw(GTK_WIDGET(opengl));
 #endif
 
 #ifdef ROAM_DEBUG
@@ -486,6 +594,22 @@ GritsViewer *grits_opengl_new(GritsPlugins *plugins, GritsPrefs *prefs)
 	g_debug("GritsOpenGL: new");
 	GritsViewer *opengl = g_object_new(GRITS_TYPE_OPENGL, NULL);
 	grits_viewer_setup(opengl, plugins, prefs);
+
+	/* Threads for ROAM error updates, default to one per CPU */
+	gint threads = grits_prefs_get_integer(prefs, "grits/roam_threads", NULL);
+	roam_sphere_set_threads(GRITS_OPENGL(opengl)->sphere,
+			threads > 0 ? threads : g_get_num_processors());
+
+	/* Level of detail, keep the defaults for unset keys */
+	RoamSphere *sphere = GRITS_OPENGL(opengl)->sphere;
+	gint    polys  = grits_prefs_get_integer(prefs, "grits/roam_polys",  NULL);
+	gint    budget = grits_prefs_get_integer(prefs, "grits/roam_budget", NULL);
+	gdouble error  = grits_prefs_get_double (prefs, "grits/roam_error",  NULL);
+	roam_sphere_set_budget(sphere,
+			polys  > 0 ? polys  : sphere->target,
+			budget > 0 ? budget : sphere->budget,
+			error  > 0 ? error  : sphere->max_error);
+
 	return opengl;
 }
 
@@ -537,31 +661,33 @@ static void grits_opengl_unproject(GritsViewer *_opengl,
 	//	px, py, pz, x, y, z, *lat, *lon, *elev);
 }
 
-static void grits_opengl_set_height_func(GritsViewer *_opengl, GritsBounds *bounds,
-		RoamHeightFunc height_func, gpointer user_data, gboolean update)
+static gboolean grits_opengl_visible(GritsViewer *_opengl,
+		gdouble n, gdouble s, gdouble e, gdouble w)
 {
 	GritsOpenGL *opengl = GRITS_OPENGL(_opengl);
-	/* TODO: get points? */
 	g_mutex_lock(&opengl->sphere_lock);
-	GList *triangles = roam_sphere_get_intersect(opengl->sphere, TRUE,
-			bounds->n, bounds->s, bounds->e, bounds->w);
-	for (GList *cur = triangles; cur; cur = cur->next) {
-		RoamTriangle *tri = cur->data;
-		RoamPoint *points[] = {tri->p.l, tri->p.m, tri->p.r, tri->split};
-		for (int i = 0; i < G_N_ELEMENTS(points); i++) {
-			if (bounds->n >= points[i]->lat && points[i]->lat >= bounds->s &&
-			    bounds->e >= points[i]->lon && points[i]->lon >= bounds->w) {
-				points[i]->height_func = height_func;
-				points[i]->height_data = user_data;
-				roam_point_update_height(points[i]);
-			}
-		}
-	}
-	g_list_free(triangles);
+	gboolean visible = roam_view_visible(opengl->sphere->view, n, s, e, w);
 	g_mutex_unlock(&opengl->sphere_lock);
+	return visible;
 }
 
-static void _grits_opengl_clear_height_func_rec(RoamTriangle *root)
+/* Height functions are usually set from the tile loading threads, so the
+ * mesh is updated from the next frame instead of stalling the renderer */
+static void grits_opengl_set_height_func(GritsViewer *_opengl, GritsBounds *bounds,
+		RoamHeightFunc height_func, gpointer user_data, gboolean update)
+{
+	GritsOpenGL *opengl = GRITS_OPENGL(_opengl);
+	struct HeightUpdate *pending = g_new0(struct HeightUpdate, 1);
+	pending->bounds      = *bounds;
+	pending->height_func = height_func;
+	pending->height_data = user_data;
+	g_mutex_lock(&opengl->heights_lock);
+	g_queue_push_tail(opengl->heights, pending);
+	g_mutex_unlock(&opengl->heights_lock);
+	grits_viewer_queue_draw(_opengl);
+}
+
+static void _grits_opengl_clear_height_func_rec(RoamTriangle *root, RoamSphere *sphere)
 {
 	if (!root)
 		return;
@@ -569,17 +695,28 @@ static void _grits_opengl_clear_height_func_rec(RoamTriangle *root)
 	for (int i = 0; i < G_N_ELEMENTS(points); i++) {
 		points[i]->height_func = NULL;
 		points[i]->height_data = NULL;
-		roam_point_update_height(points[i]);
+		roam_point_update_height(points[i], sphere);
 	}
-	_grits_opengl_clear_height_func_rec(root->kids[0]);
-	_grits_opengl_clear_height_func_rec(root->kids[1]);
+	_grits_opengl_clear_height_func_rec(root->kids[0], sphere);
+	_grits_opengl_clear_height_func_rec(root->kids[1], sphere);
 }
 
 static void grits_opengl_clear_height_func(GritsViewer *_opengl)
 {
 	GritsOpenGL *opengl = GRITS_OPENGL(_opengl);
+
+	/* Drop height functions which have not been applied yet */
+	g_mutex_lock(&opengl->heights_lock);
+	g_queue_free_full(opengl->heights, g_free);
+	opengl->heights = g_queue_new();
+	g_mutex_unlock(&opengl->heights_lock);
+
+	g_mutex_lock(&opengl->sphere_lock);
 	for (int i = 0; i < G_N_ELEMENTS(opengl->sphere->roots); i++)
-		_grits_opengl_clear_height_func_rec(opengl->sphere->roots[i]);
+		_grits_opengl_clear_height_func_rec(opengl->sphere->roots[i],
+				opengl->sphere);
+	roam_sphere_touch(opengl->sphere, 90, -90, 180, -180);
+	g_mutex_unlock(&opengl->sphere_lock);
 }
 
 static gint _objects_find(gconstpointer a, gconstpointer b)
@@ -663,8 +800,10 @@ static void grits_opengl_init(GritsOpenGL *opengl)
 	g_debug("GritsOpenGL: init");
 	opengl->objects = g_queue_new();
 	opengl->sphere  = roam_sphere_new(opengl);
+	opengl->heights = g_queue_new();
 	g_mutex_init(&opengl->objects_lock);
 	g_mutex_init(&opengl->sphere_lock);
+	g_mutex_init(&opengl->heights_lock);
 	gtk_gl_enable(GTK_WIDGET(opengl));
 	gtk_widget_add_events(GTK_WIDGET(opengl), GDK_KEY_PRESS_MASK);
 	g_signal_connect(opengl, "map", G_CALLBACK(on_realize), NULL);
@@ -688,8 +827,10 @@ static void grits_opengl_finalize(GObject *_opengl)
 	g_debug("GritsOpenGL: finalize");
 	GritsOpenGL *opengl = GRITS_OPENGL(_opengl);
 	roam_sphere_free(opengl->sphere);
+	g_queue_free_full(opengl->heights, g_free);
 	g_mutex_clear(&opengl->objects_lock);
 	g_mutex_clear(&opengl->sphere_lock);
+	g_mutex_clear(&opengl->heights_lock);
 	gtk_gl_disable(GTK_WIDGET(opengl));
 	G_OBJECT_CLASS(grits_opengl_parent_class)->finalize(_opengl);
 }
@@ -704,6 +845,7 @@ static void grits_opengl_class_init(GritsOpenGLClass *klass)
 	viewer_class->center_position   = grits_opengl_center_position;
 	viewer_class->project           = grits_opengl_project;
 	viewer_class->unproject         = grits_opengl_unproject;
+	viewer_class->visible           = grits_opengl_visible;
 	viewer_class->clear_height_func = grits_opengl_clear_height_func;
 	viewer_class->set_height_func   = grits_opengl_set_height_func;
 	viewer_class->add               = grits_opengl_add;
@@ -42,7 +42,10 @@ struct _GritsOpenGL {
 	GMutex      objects_lock;
 	RoamSphere *sphere;
 	GMutex      sphere_lock;
+	GQueue     *heights;      /* Height functions waiting for the next frame */
+	GMutex      heights_lock;
 	GdkEventMotion mouse_queue;
+	guint       frame;  /* Frames drawn, for per-frame budgets */
 
 	/* for testing */
 	gboolean    wireframe;
@@ -119,6 +119,24 @@ GritsPrefs *grits_prefs_new(const gchar *config, const gchar *defaults)
 	return prefs;
 }
 
+/**
+ * grits_prefs_has_key:
+ * @prefs: the preference store
+ * @key:   the key, in "group/key" form
+ *
+ * Check if a preference is set. This is needed for preferences where every
+ * value is meaningful, including 0.
+ *
+ * Returns: %TRUE if the key is set
+ */
+gboolean grits_prefs_has_key(GritsPrefs *prefs, const gchar *key)
+{
+	gchar **keys = g_strsplit(key, "/", 2);
+	gboolean has = g_key_file_has_key(prefs->key_file, keys[0], keys[1], NULL);
+	g_strfreev(keys);
+	return has;
+}
+
 #define make_pref_type(name, c_type, g_type)                                         \
 c_type grits_prefs_get_##name##_v(GritsPrefs *prefs,                                 \
 		const gchar *group, const gchar *key, GError **_error)               \
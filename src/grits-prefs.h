@@ -50,6 +50,8 @@ GType grits_prefs_get_type(void);
 /* Methods */
 GritsPrefs *grits_prefs_new(const gchar *config, const gchar *defaults);
 
+gboolean  grits_prefs_has_key      (GritsPrefs *prefs, const gchar *key);
+
 gchar    *grits_prefs_get_string   (GritsPrefs *prefs, const gchar *key, GError **error);
 gboolean  grits_prefs_get_boolean  (GritsPrefs *prefs, const gchar *key, GError **error);
 gint      grits_prefs_get_integer  (GritsPrefs *prefs, const gchar *key, GError **error);
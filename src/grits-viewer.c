@@ -27,6 +27,7 @@
 
 #include <config.h>
 #include <math.h>
+#include <string.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
 
@@ -34,6 +35,8 @@
 #include "grits-viewer.h"
 
 #include "grits-util.h"
+#include "objects/grits-tile.h"
+#include "data/grits-http.h"
 
 
 /* Constants */
@@ -217,6 +220,10 @@ void grits_viewer_setup(GritsViewer *viewer, GritsPlugins *plugins, GritsPrefs *
 	viewer->plugins = plugins;
 	viewer->prefs   = prefs;
 	viewer->offline = grits_prefs_get_boolean(prefs, "grits/offline", NULL);
+
+	/* Settings shared by all viewers */
+	grits_tile_setup_prefs(prefs);
+	grits_http_setup_prefs(prefs);
 }
 
 /**
@@ -521,6 +528,32 @@ void grits_viewer_unproject(GritsViewer *viewer,
 	klass->unproject(viewer, px, py, pz, lat, lon, elev);
 }
 
+/**
+ * grits_viewer_visible:
+ * @viewer: the viewer
+ * @n:      the northern edge of the area
+ * @s:      the southern edge of the area
+ * @e:      the eastern edge of the area
+ * @w:      the western edge of the area
+ *
+ * Check if part of a latitude-longitude box could be drawn with the current
+ * view. Useful for skipping data which is outside the view or beyond the
+ * horizon. E.g. #GritsTile. Everything is visible for viewers which do not
+ * implement this check.
+ *
+ * This function is thread safe and my be called from outside the main thread.
+ *
+ * Returns: %FALSE if no part of the area is visible
+ */
+gboolean grits_viewer_visible(GritsViewer *viewer,
+		gdouble n, gdouble s, gdouble e, gdouble w)
+{
+	GritsViewerClass *klass = GRITS_VIEWER_GET_CLASS(viewer);
+	if (!klass->visible)
+		return TRUE;
+	return klass->visible(viewer, n, s, e, w);
+}
+
 /**
  * grits_viewer_clear_height_func:
  * @viewer: the viewer
@@ -531,6 +564,7 @@ void grits_viewer_unproject(GritsViewer *viewer,
 void grits_viewer_clear_height_func(GritsViewer *viewer)
 {
 	GritsViewerClass *klass = GRITS_VIEWER_GET_CLASS(viewer);
+	grits_viewer_set_height_sampler(viewer, NULL, NULL, NULL);
 	if (!klass->clear_height_func)
 		g_warning("GritsViewer: clear_height_func - Unimplemented");
 	klass->clear_height_func(viewer);
@@ -556,6 +590,70 @@ void grits_viewer_set_height_func(GritsViewer *viewer, GritsBounds *bounds,
 	klass->set_height_func(viewer, bounds, height_func, user_data, update);
 }
 
+/**
+ * grits_viewer_set_height_sampler:
+ * @viewer:      the viewer
+ * @height_func: the height function, as passed to grits_viewer_set_height_func
+ * @batch_func:  function which samples the same surface as @height_func for
+ *               many points at once
+ * @user_data:   user data to pass to the functions
+ *
+ * Set the functions used to find the ground level anywhere on the surface,
+ * for instance to place markers on the ground or drape lines over the
+ * terrain, see grits_viewer_get_heights. Surface points using @height_func
+ * with @user_data are updated together using @batch_func.
+ */
+void grits_viewer_set_height_sampler(GritsViewer *viewer,
+		GritsHeightFunc height_func, GritsHeightBatchFunc batch_func,
+		gpointer user_data)
+{
+	viewer->height_func  = height_func;
+	viewer->height_batch = batch_func;
+	viewer->height_data  = user_data;
+}
+
+/**
+ * grits_viewer_get_heights:
+ * @viewer: the viewer
+ * @lat:    the target latitudes
+ * @lon:    the target longitudes
+ * @elev:   location to store the elevation of each point
+ * @count:  the number of points
+ *
+ * Find the ground level at many points at once. This is much faster than
+ * finding the ground level one point at a time, especially for points which
+ * are near each other. Points are at sea level if no height sampler is set.
+ */
+void grits_viewer_get_heights(GritsViewer *viewer,
+		const gdouble *lat, const gdouble *lon, gdouble *elev, gint count)
+{
+	GritsHeightBatchFunc batch = viewer->height_batch;
+	gpointer             data  = viewer->height_data;
+	if (count <= 0)
+		return;
+	if (batch)
+		batch(lat, lon, elev, count, data);
+	else
+		memset(elev, 0, count * sizeof(gdouble));
+}
+
+/**
+ * grits_viewer_get_height:
+ * @viewer: the viewer
+ * @lat:    the target latitude
+ * @lon:    the target longitude
+ *
+ * Find the ground level at a single point, see grits_viewer_get_heights.
+ *
+ * Returns: the elevation in meters above sea level
+ */
+gdouble grits_viewer_get_height(GritsViewer *viewer, gdouble lat, gdouble lon)
+{
+	gdouble elev;
+	grits_viewer_get_heights(viewer, &lat, &lon, &elev, 1);
+	return elev;
+}
+
 /**
  * grits_viewer_add:
  * @viewer: the viewer
@@ -101,6 +101,20 @@ typedef struct _GritsViewerClass GritsViewerClass;
  */
 typedef gdouble (*GritsHeightFunc)(gdouble lat, gdouble lon, gpointer user_data);
 
+/**
+ * GritsHeightBatchFunc:
+ * @lat:       the target latitudes
+ * @lon:       the target longitudes
+ * @elev:      location to store the elevation of each point
+ * @count:     the number of points
+ * @user_data: user data passed to the function
+ *
+ * Determine the surface elevation at many points at once, see
+ * grits_viewer_set_height_sampler.
+ */
+typedef void (*GritsHeightBatchFunc)(const gdouble *lat, const gdouble *lon,
+		gdouble *elev, gint count, gpointer user_data);
+
 #include "grits-plugin.h"
 #include "grits-prefs.h"
 #include "objects/grits-object.h"
@@ -123,6 +137,11 @@ struct _GritsViewer {
 	/* For queue_draw */
 	guint   draw_source;
 	GMutex  draw_lock;
+
+	/* For get_heights */
+	GritsHeightFunc      height_func;
+	GritsHeightBatchFunc height_batch;
+	gpointer             height_data;
 };
 
 struct _GritsViewerClass {
@@ -138,6 +157,8 @@ struct _GritsViewerClass {
 	void (*unproject)        (GritsViewer *viewer,
 	                          gdouble px, gdouble py,gdouble pz,
 	                          gdouble *lat, gdouble *lon, gdouble *elev);
+	gboolean (*visible)      (GritsViewer *viewer,
+	                          gdouble n, gdouble s, gdouble e, gdouble w);
 
 	void (*clear_height_func)(GritsViewer *viewer);
 	void (*set_height_func)  (GritsViewer *viewer, GritsBounds *bounds,
@@ -181,12 +202,21 @@ void grits_viewer_project(GritsViewer *viewer,
 void grits_viewer_unproject(GritsViewer *viewer,
 		gdouble px, gdouble py, gdouble pz,
 		gdouble *lat, gdouble *lon, gdouble *elev);
+gboolean grits_viewer_visible(GritsViewer *viewer,
+		gdouble n, gdouble s, gdouble e, gdouble w);
 
 void grits_viewer_clear_height_func(GritsViewer *viewer);
 void grits_viewer_set_height_func(GritsViewer *viewer, GritsBounds *bounds,
 		GritsHeightFunc height_func, gpointer user_data,
 		gboolean update);
 
+void grits_viewer_set_height_sampler(GritsViewer *viewer,
+		GritsHeightFunc height_func, GritsHeightBatchFunc batch_func,
+		gpointer user_data);
+void grits_viewer_get_heights(GritsViewer *viewer,
+		const gdouble *lat, const gdouble *lon, gdouble *elev, gint count);
+gdouble grits_viewer_get_height(GritsViewer *viewer, gdouble lat, gdouble lon);
+
 void grits_viewer_add(GritsViewer *viewer, GritsObject *object,
 		gint level, gboolean sort);
 void grits_viewer_remove(GritsViewer *viewer, GritsObject *object);
@@ -27,6 +27,8 @@
 /* Grits data */
 #include <data/grits-data.h>
 #include <data/grits-http.h>
+#include <data/grits-pack.h>
+#include <data/grits-cache.h>
 #include <data/grits-tms.h>
 #include <data/grits-wms.h>
 
@@ -35,12 +35,74 @@
 #define GL_GLEXT_PROTOTYPES
 #include <config.h>
 #include <math.h>
+#include <stddef.h>
 #include <string.h>
 #include "gtkgl.h"
 #include "grits-tile.h"
 
 static guint  grits_tile_mask = 0;
 
+/* Interleaved vertex format used for tile buffers */
+typedef struct {
+	GLfloat xyz[3];
+	GLfloat norm[3];
+	GLfloat tex[2];
+} GritsTileVertex;
+
+/* Reused for each tile drawn, only accessed while drawing */
+static GPtrArray *grits_tile_triangles = NULL;
+static GArray    *grits_tile_vertices  = NULL;
+
+/* Texture upload queue, only accessed while drawing */
+static GPQueue         *grits_tile_queue         = NULL;
+static gint             grits_tile_upload_budget = 4*1024*1024;
+static gboolean         grits_tile_upload_pbo    = FALSE;
+static guint            grits_tile_upload_buffer = 0;
+static guint            grits_tile_upload_frame  = 0;
+static GritsTileUploads grits_tile_uploads       = {};
+
+/* Memory used by tiles, see grits_tile_gc */
+static GritsTileCache grits_tile_cache = {
+	.cpu_budget = 256*1024*1024,
+	.gpu_budget = 256*1024*1024,
+};
+static GMutex grits_tile_cache_lock;
+
+/* Pixel data is loaded from other threads */
+static void _grits_tile_account(gint64 cpu, gint64 gpu)
+{
+	g_mutex_lock(&grits_tile_cache_lock);
+	grits_tile_cache.cpu += cpu;
+	grits_tile_cache.gpu += gpu;
+	g_mutex_unlock(&grits_tile_cache_lock);
+}
+
+/* Tile load scheduler, one pool of worker threads is shared by all loaders,
+ * the queues and the loaders are accessed from the worker threads while
+ * holding grits_tile_loads_lock */
+struct _GritsTileLoader {
+	GritsTileLoadFunc load_func;
+	gpointer          user_data;
+	GPQueue          *queue;
+	gint              limit;
+	GritsTileLoads    loads;
+};
+static GList          *grits_tile_loaders     = NULL;
+static GThreadPool    *grits_tile_workers     = NULL;
+static gint            grits_tile_threads     = 0;
+static GritsTileLoads  grits_tile_loads       = {};
+static GMutex          grits_tile_loads_lock;
+static GCond           grits_tile_loads_cond;
+
+/* Level which is loaded even when it is covered by children, or -1 to load
+ * every level */
+static gint grits_tile_fallback = 2;
+
+static gsize _grits_tile_get_size(GritsTile *tile)
+{
+	return tile->width * tile->height * (tile->alpha ? 4 : 3);
+}
+
 gchar *grits_tile_path_table[2][2] = {
 	{"00.", "01."},
 	{"10.", "11."},
@@ -124,8 +186,9 @@ static gboolean _grits_tile_precise(GritsPoint *eye, GritsBounds *bounds,
 	gdouble lon_dist  = bounds->e - bounds->w;
 	gdouble tile_res  = ll2m(lon_dist, lat_point)/width;
 
-	/* This isn't really right, but it helps with memory since we don't
-	 * (yet?) test if the tile would be drawn */
+	/* This isn't really right, but it helps with memory by using lower
+	 * resolution tiles away from the eye, tiles which are not drawn are
+	 * skipped by grits_tile_update */
 	gdouble scale = eye->elev / min_dist;
 	view_res /= scale;
 	view_res *= 1.8;
@@ -141,6 +204,131 @@ static gboolean _grits_tile_precise(GritsPoint *eye, GritsBounds *bounds,
 	       tile_res < view_res;
 }
 
+/* Screen pixels covered by each texel of the parent, which is drawn until the
+ * tile is loaded, reduced for tiles away from the center of the view */
+static gdouble _grits_tile_load_priority(GritsPoint *eye, GritsBounds *bounds,
+		gint width)
+{
+	gdouble min_dist  = _grits_tile_get_min_dist(eye, bounds);
+	gdouble lat_point = bounds->n < 0 ? bounds->n :
+	                    bounds->s > 0 ? bounds->s : 0;
+	gdouble lon_dist  = bounds->e - bounds->w;
+	gdouble tile_res  = ll2m(lon_dist, lat_point)/width;
+	gdouble error     = 2*tile_res / MPPX(min_dist);
+
+	gdouble a[3], b[3];
+	lle2xyz(eye->lat, eye->lon, 0, a+0, a+1, a+2);
+	lle2xyz((bounds->n+bounds->s)/2, (bounds->e+bounds->w)/2, 0,
+			b+0, b+1, b+2);
+	return error / (1 + distd(a, b)/MAX(eye->elev, 1));
+}
+
+/* Requests with the highest priority are loaded first */
+static gint _grits_tile_load_cmp(GritsTile *a, GritsTile *b, gpointer data)
+{
+	if      (a->priority < b->priority) return  1;
+	else if (a->priority > b->priority) return -1;
+	else                                return  0;
+}
+
+/* Pop the request with the highest priority from the loaders which are below
+ * their limit, while holding grits_tile_loads_lock */
+static GritsTile *_grits_tile_load_next(void)
+{
+	GritsTile *best = NULL;
+	for (GList *cur = grits_tile_loaders; cur; cur = cur->next) {
+		GritsTileLoader *loader = cur->data;
+		if (loader->limit > 0 && loader->loads.running >= loader->limit)
+			continue;
+		GritsTile *tile = g_pqueue_peek(loader->queue);
+		if (tile && (!best || tile->priority > best->priority))
+			best = tile;
+	}
+	if (best)
+		g_pqueue_pop(best->loader->queue);
+	return best;
+}
+
+/* Each request queues one call to this, but the requests which are run may be
+ * different ones since requests are re-ranked and cancelled while queued.
+ * Requests held back by a loader's limit are picked up by the worker which
+ * finishes the loader's previous request. */
+static void _grits_tile_load_thread(gpointer token, gpointer data)
+{
+	GritsTile *tile;
+	g_mutex_lock(&grits_tile_loads_lock);
+	while ((tile = _grits_tile_load_next())) {
+		GritsTileLoader *loader = tile->loader;
+		tile->loader  = NULL;
+		tile->pending = NULL;
+		loader->loads.queued--;
+		loader->loads.running++;
+		loader->loads.loaded++;
+		grits_tile_loads.queued--;
+		grits_tile_loads.running++;
+		grits_tile_loads.loaded++;
+		g_mutex_unlock(&grits_tile_loads_lock);
+
+		gint64 start = g_get_monotonic_time();
+		loader->load_func(tile, loader->user_data);
+		gint64 time  = g_get_monotonic_time() - start;
+
+		g_mutex_lock(&grits_tile_loads_lock);
+		loader->loads.running--;
+		loader->loads.finished++;
+		loader->loads.time += time;
+		grits_tile_loads.running--;
+		grits_tile_loads.finished++;
+		grits_tile_loads.time += time;
+		g_cond_broadcast(&grits_tile_loads_cond);
+	}
+	g_mutex_unlock(&grits_tile_loads_lock);
+}
+
+/* Drop a queued request while holding grits_tile_loads_lock, the tile will be
+ * requested again the next time it is needed */
+static void _grits_tile_cancel_load(GritsTile *tile)
+{
+	GritsTileLoader *loader = tile->loader;
+	g_pqueue_remove(loader->queue, tile->pending);
+	tile->loader  = NULL;
+	tile->pending = NULL;
+	tile->load    = FALSE;
+	loader->loads.queued--;
+	loader->loads.cancelled++;
+	grits_tile_loads.queued--;
+	grits_tile_loads.cancelled++;
+}
+
+static void _grits_tile_cancel_loads_rec(GritsTile *tile)
+{
+	GritsTile *child;
+	if (!tile)
+		return;
+	if (tile->pending)
+		_grits_tile_cancel_load(tile);
+	grits_tile_foreach(tile, child)
+		_grits_tile_cancel_loads_rec(child);
+}
+
+/* Cancel queued requests for a tile and all it's children */
+static void _grits_tile_cancel_loads(GritsTile *tile)
+{
+	g_mutex_lock(&grits_tile_loads_lock);
+	_grits_tile_cancel_loads_rec(tile);
+	g_mutex_unlock(&grits_tile_loads_lock);
+}
+
+/* Set the priority of a tile, re-ranking its request if it is queued */
+static void _grits_tile_set_priority(GritsTile *tile, gdouble priority)
+{
+	g_mutex_lock(&grits_tile_loads_lock);
+	tile->priority = priority;
+	if (tile->pending)
+		g_pqueue_priority_changed(tile->loader->queue, tile->pending);
+	g_mutex_unlock(&grits_tile_loads_lock);
+}
+
 static void _grits_tile_split_latlon(GritsTile *tile)
 {
 	//g_debug("GritsTile: split - %p", tile);
@@ -185,49 +373,37 @@ static void _grits_tile_split_mercator(GritsTile *tile)
 	}
 }
 
-/**
- * grits_tile_update:
- * @root:      the root tile to split
- * @eye:       the point the tile is viewed from, for calculating distances
- * @res:       a maximum resolution in meters per pixel to split tiles to
- * @width:     width in pixels of the image associated with the tile
- * @height:    height in pixels of the image associated with the tile
- * @load_func: function used to load the image when a new tile is created
- * @user_data: user data to past to the load function
- *
- * Recursively split a tile into children of appropriate detail. The resolution
- * of the tile in pixels per meter is compared to the resolution which the tile
- * is being drawn at on the screen. If the screen resolution is insufficient
- * the tile is recursively subdivided until a sufficient resolution is
- * achieved.
- */
-void grits_tile_update(GritsTile *tile, GritsPoint *eye,
+/* Returns TRUE if the parent tile is drawn in place of this one */
+static gboolean _grits_tile_update_rec(GritsTile *tile, gint depth,
+		GritsPoint *eye, GritsTileVisibleFunc visible_func, gpointer visible_data,
 		gdouble res, gint width, gint height,
 		GritsTileLoadFunc load_func, gpointer user_data)
 {
 	GritsTile *child;
 
 	if (tile == NULL)
-		return;
+		return FALSE;
 
 	//g_debug("GritsTile: update - %p->atime = %u",
 	//		tile, (guint)tile->atime);
 
 	/* Is the parent tile's texture high enough
-	 * resolution for this part? */
+	 * resolution for this part, or is it off screen? */
 	gint xs = G_N_ELEMENTS(tile->children);
 	gint ys = G_N_ELEMENTS(tile->children[0]);
-	if (tile->parent && _grits_tile_precise(eye, &tile->edge,
-				res, width/xs, height/ys)) {
+	GritsBounds *edge = &tile->edge;
+	gboolean precise = _grits_tile_precise(eye, edge,
+			res, width/xs, height/ys);
+	gboolean visible = !visible_func || visible_func(
+			edge->n, edge->s, edge->e, edge->w, visible_data);
+	if (tile->parent && (precise || !visible)) {
+		if (!GRITS_OBJECT(tile)->hidden)
+			_grits_tile_cancel_loads(tile);
 		GRITS_OBJECT(tile)->hidden = TRUE;
-		return;
+		return visible;
 	}
-
-	/* Load the tile */
-	if (!tile->load && !tile->data && !tile->tex && !tile->pixels && !tile->pixbuf)
-		load_func(tile, user_data);
 	tile->atime = time(NULL);
-	tile->load  = TRUE;
+	tile->used  = g_get_monotonic_time();
 	GRITS_OBJECT(tile)->hidden = FALSE;
 
 	/* Split tile if needed */
@@ -241,9 +417,99 @@ void grits_tile_update(GritsTile *tile, GritsPoint *eye,
 	}
 
 	/* Update recursively */
+	gboolean drawn = FALSE;
 	grits_tile_foreach(tile, child)
-		grits_tile_update(child, eye, res, width, height,
-				load_func, user_data);
+		if (_grits_tile_update_rec(child, depth+1, eye,
+				visible_func, visible_data,
+				res, width, height, load_func, user_data))
+			drawn = TRUE;
+
+	/* Tiles which are covered by their children are only needed at the
+	 * fallback level, which is drawn while the children load */
+	gboolean needed = drawn || !tile->parent ||
+		grits_tile_fallback < 0 || depth == grits_tile_fallback;
+
+	/* Load the tile, or re-rank its request if it is still queued */
+	if (!tile->data && !tile->tex && !tile->pixels && !tile->pixbuf) {
+		if (needed) {
+			_grits_tile_set_priority(tile,
+				_grits_tile_load_priority(eye, edge, width));
+			if (!tile->load)
+				load_func(tile, user_data);
+			tile->load = TRUE;
+		} else {
+			g_mutex_lock(&grits_tile_loads_lock);
+			if (tile->pending)
+				_grits_tile_cancel_load(tile);
+			g_mutex_unlock(&grits_tile_loads_lock);
+		}
+	}
+	return FALSE;
+}
+
+static gboolean _grits_tile_viewer_visible(gdouble n, gdouble s,
+		gdouble e, gdouble w, gpointer viewer)
+{
+	return grits_viewer_visible(viewer, n, s, e, w);
+}
+
+/**
+ * grits_tile_update:
+ * @root:      the root tile to split
+ * @eye:       the point the tile is viewed from, for calculating distances
+ * @viewer:    the viewer used to draw the tile, or NULL to also split tiles
+ *             which are not visible
+ * @res:       a maximum resolution in meters per pixel to split tiles to
+ * @width:     width in pixels of the image associated with the tile
+ * @height:    height in pixels of the image associated with the tile
+ * @load_func: function used to load the image when a new tile is created
+ * @user_data: user data to past to the load function
+ *
+ * Recursively split a tile into children of appropriate detail. The resolution
+ * of the tile in pixels per meter is compared to the resolution which the tile
+ * is being drawn at on the screen. If the screen resolution is insufficient
+ * the tile is recursively subdivided until a sufficient resolution is
+ * achieved. Tiles which are outside the view or beyond the horizon are not
+ * split or loaded, their parent is drawn if they come into view before the
+ * next update.
+ *
+ * Only the tiles which are drawn are loaded, along with the root and the
+ * fallback level, see grits_tile_set_fallback. Tiles which still need to be
+ * loaded are ranked by how much they would improve the view, requests for
+ * tiles which are no longer needed are cancelled, see grits_tile_loader_push.
+ */
+void grits_tile_update(GritsTile *root, GritsPoint *eye, GritsViewer *viewer,
+		gdouble res, gint width, gint height,
+		GritsTileLoadFunc load_func, gpointer user_data)
+{
+	grits_tile_update_visible(root, eye,
+			viewer ? _grits_tile_viewer_visible : NULL, viewer,
+			res, width, height, load_func, user_data);
+}
+
+/**
+ * grits_tile_update_visible:
+ * @root:         the root tile to split
+ * @eye:          the point the tile is viewed from, for calculating distances
+ * @visible_func: function used to check if a tile is visible, or NULL to
+ *                also split tiles which are not visible
+ * @visible_data: user data to pass to the visible function
+ * @res:          a maximum resolution in meters per pixel to split tiles to
+ * @width:        width in pixels of the image associated with the tile
+ * @height:       height in pixels of the image associated with the tile
+ * @load_func:    function used to load the image when a new tile is created
+ * @user_data:    user data to past to the load function
+ *
+ * Same as grits_tile_update, but with a custom visibility check. Useful for
+ * updating tiles without a viewer, e.g. using roam_view_visible.
+ */
+void grits_tile_update_visible(GritsTile *root, GritsPoint *eye,
+		GritsTileVisibleFunc visible_func, gpointer visible_data,
+		gdouble res, gint width, gint height,
+		GritsTileLoadFunc load_func, gpointer user_data)
+{
+	_grits_tile_update_rec(root, 0, eye, visible_func, visible_data,
+			res, width, height, load_func, user_data);
 }
 
 static void _grits_tile_queue_draw(GritsTile *tile)
@@ -281,6 +547,7 @@ gboolean grits_tile_load_pixels(GritsTile *tile, guchar *pixels,
 	tile->height = height;
 	tile->alpha  = alpha;
 	tile->pixels = pixels;
+	_grits_tile_account(_grits_tile_get_size(tile), 0);
 
 	/* Queue OpenGL texture load/draw */
 	_grits_tile_queue_draw(tile);
@@ -307,6 +574,7 @@ gboolean grits_tile_load_pixbuf(GritsTile *tile, GdkPixbuf *pixbuf)
 	tile->width  = gdk_pixbuf_get_width(pixbuf);
 	tile->height = gdk_pixbuf_get_height(pixbuf);
 	tile->alpha  = gdk_pixbuf_get_has_alpha(pixbuf);
+	_grits_tile_account(_grits_tile_get_size(tile), 0);
 
 	/* Queue OpenGL texture load/draw */
 	_grits_tile_queue_draw(tile);
@@ -335,6 +603,7 @@ gboolean grits_tile_load_file(GritsTile *tile, const gchar *file)
 	tile->width  = gdk_pixbuf_get_width(tile->pixbuf);
 	tile->height = gdk_pixbuf_get_height(tile->pixbuf);
 	tile->alpha  = gdk_pixbuf_get_has_alpha(tile->pixbuf);
+	_grits_tile_account(_grits_tile_get_size(tile), 0);
 
 	/* Queue OpenGL texture load/draw */
 	_grits_tile_queue_draw(tile);
@@ -349,7 +618,7 @@ gboolean grits_tile_load_file(GritsTile *tile, const gchar *file)
  * @lon:  target longitude
  *
  * Locate the subtile with the highest resolution which contains the given
- * lat/lon point.
+ * lat/lon point and has data.
  *
  * Returns: the child tile
  */
@@ -376,58 +645,194 @@ GritsTile *grits_tile_find(GritsTile *root, gdouble lat, gdouble lon)
 
 	if (row < 0 || row >= rows || col < 0 || col >= cols)
 		return NULL;
-	else if (root->children[row][col] && root->children[row][col]->data)
-		return grits_tile_find(root->children[row][col], lat, lon);
+
+	/* Levels between the fallback and the drawn tiles may be skipped */
+	GritsTile *child = root->children[row][col];
+	GritsTile *found = child ? grits_tile_find(child, lat, lon) : NULL;
+	if (found && found->data)
+		return found;
 	else
 		return root;
 }
 
-/**
- * grits_tile_gc:
- * @root:      the root tile to start garbage collection at
- * @atime:     most recent time at which tiles will be kept
- * @free_func: function used to free the image when a new tile is collected
- * @user_data: user data to past to the free function
- *
- * Garbage collect old tiles. This removes and deallocate tiles that have not
- * been used since before @atime.
- *
- * Returns: a pointer to the original tile, or NULL if it was garbage collected
- */
-GritsTile *grits_tile_gc(GritsTile *root, time_t atime,
+/* Remove a tile from the upload queue */
+static void _grits_tile_cancel_upload(GritsTile *tile)
+{
+	g_pqueue_remove(grits_tile_queue, tile->upload);
+	tile->upload = NULL;
+	grits_tile_uploads.queued--;
+}
+
+/* Free everything except the user data associated with a tile */
+static void _grits_tile_release(GritsTile *tile)
+{
+	gint64 cpu = 0, gpu = 0;
+	if (tile->pixbuf || tile->pixels)
+		cpu += _grits_tile_get_size(tile);
+	if (tile->pixbuf)
+		g_object_unref(tile->pixbuf);
+	if (tile->pixels)
+		g_free(tile->pixels);
+	if (tile->upload)
+		_grits_tile_cancel_upload(tile);
+	g_mutex_lock(&grits_tile_loads_lock);
+	if (tile->pending)
+		_grits_tile_cancel_load(tile);
+	g_mutex_unlock(&grits_tile_loads_lock);
+	if (tile->tex) {
+		gpu += tile->width * tile->height * 4;
+		glDeleteTextures(1, &tile->tex);
+	}
+	if (tile->vbo) {
+		gpu += tile->vbo_count * sizeof(GritsTileVertex);
+		glDeleteBuffers(1, &tile->vbo);
+	}
+	tile->pixbuf    = NULL;
+	tile->pixels    = NULL;
+	tile->tex       = 0;
+	tile->vbo       = 0;
+	tile->vbo_count = 0;
+	_grits_tile_account(-cpu, -gpu);
+}
+
+/* Free a tile which has no children */
+static void _grits_tile_evict(GritsTile *tile,
+		GritsTileFreeFunc free_func, gpointer user_data)
+{
+	//g_debug("GritsTile: gc/free - %p", tile);
+	_grits_tile_release(tile);
+	if (tile->data) {
+		if (free_func)
+			free_func(tile, user_data);
+		else
+			g_free(tile->data);
+	}
+	g_object_unref(tile);
+}
+
+static gboolean _grits_tile_over_budget(void)
+{
+	GritsTileCache *cache = &grits_tile_cache;
+	g_mutex_lock(&grits_tile_cache_lock);
+	gboolean over = (cache->cpu_budget > 0 && cache->cpu > cache->cpu_budget) ||
+	                (cache->gpu_budget > 0 && cache->gpu > cache->gpu_budget);
+	g_mutex_unlock(&grits_tile_cache_lock);
+	return over;
+}
+
+/* Tiles in the current view, and all their ancestors, are drawn or used as
+ * fallbacks while their children load */
+static gboolean _grits_tile_needed(GritsTile *tile)
+{
+	for (; tile; tile = tile->parent)
+		if (GRITS_OBJECT(tile)->hidden)
+			return FALSE;
+	return TRUE;
+}
+
+/* Tiles which are still being loaded by another thread can't be freed */
+static gboolean _grits_tile_evictable(GritsTile *tile)
+{
+	gboolean thread_safe = !tile->load || tile->data || tile->tex ||
+		tile->pixels || tile->pixbuf;
+	return tile->parent && thread_safe;
+}
+
+/* Tiles holding memory which is counted in the cache */
+static gboolean _grits_tile_cached(GritsTile *tile)
+{
+	return tile->tex || tile->vbo || tile->pixels || tile->pixbuf;
+}
+
+static gint _grits_tile_lru_cmp(GritsTile *a, GritsTile *b, gpointer data)
+{
+	if      (a->used < b->used) return -1;
+	else if (a->used > b->used) return  1;
+	else                        return  0;
+}
+
+static GritsTile *_grits_tile_gc_rec(GritsTile *root, gboolean needed,
+		time_t atime, GPQueue *lru,
 		GritsTileFreeFunc free_func, gpointer user_data)
 {
 	if (!root)
 		return NULL;
+	needed = needed && !GRITS_OBJECT(root)->hidden;
 	gboolean has_children = FALSE;
 	int x, y;
 	grits_tile_foreach_index(root, x, y) {
-		root->children[x][y] = grits_tile_gc(
-				root->children[x][y], atime,
+		root->children[x][y] = _grits_tile_gc_rec(
+				root->children[x][y], needed, atime, lru,
 				free_func, user_data);
 		if (root->children[x][y])
 			has_children = TRUE;
 	}
 	//g_debug("GritsTile: gc - %p kids=%d time=%d data=%d load=%d",
 	//	root, !!has_children, root->atime < atime, !!root->data, !!root->load);
-	int thread_safe = !root->load || root->data || root->tex || root->pixels || root->pixbuf;
-	if (root->parent && !has_children && root->atime < atime && thread_safe) {
-		//g_debug("GritsTile: gc/free - %p", root);
-		if (root->pixbuf)
-			g_object_unref(root->pixbuf);
-		if (root->pixels)
-			g_free(root->pixels);
-		if (root->tex)
-			glDeleteTextures(1, &root->tex);
-		if (root->data) {
-			if (free_func)
-				free_func(root, user_data);
-			else
-				g_free(root->data);
-		}
-		g_object_unref(root);
+	if (has_children || needed || !_grits_tile_evictable(root))
+		return root;
+	if (!_grits_tile_cached(root) && root->atime < atime) {
+		_grits_tile_evict(root, free_func, user_data);
 		return NULL;
 	}
+	if (_grits_tile_cached(root) && lru)
+		g_pqueue_push(lru, root);
+	return root;
+}
+
+/**
+ * grits_tile_gc:
+ * @root:      the root tile to start garbage collection at
+ * @atime:     most recent time at which empty tiles will be kept
+ * @free_func: function used to free the image when a new tile is collected
+ * @user_data: user data to past to the free function
+ *
+ * Garbage collect old tiles. Tiles without pixels or textures which have not
+ * been used since before @atime are removed. Tiles with pixels or textures are
+ * only removed while the tile cache is over budget, starting with the least
+ * recently used, see grits_tile_set_cache_budget. Tiles in the current view
+ * and their ancestors are never removed.
+ *
+ * Returns: a pointer to the original tile, or NULL if it was garbage collected
+ */
+GritsTile *grits_tile_gc(GritsTile *root, time_t atime,
+		GritsTileFreeFunc free_func, gpointer user_data)
+{
+	GPQueue *lru = _grits_tile_over_budget() ?
+		g_pqueue_new((GCompareDataFunc)_grits_tile_lru_cmp, NULL) : NULL;
+	root = _grits_tile_gc_rec(root, TRUE, atime, lru, free_func, user_data);
+	if (!lru)
+		return root;
+
+	/* Evict the oldest leaves, their parents become leaves in turn */
+	GritsTile *tile;
+	gint evicted = 0;
+	while (_grits_tile_over_budget() && (tile = g_pqueue_pop(lru))) {
+		GritsTile *parent = tile->parent;
+		gboolean has_children = FALSE;
+		int x, y;
+		grits_tile_foreach_index(parent, x, y) {
+			if (parent->children[x][y] == tile)
+				parent->children[x][y] = NULL;
+			else if (parent->children[x][y])
+				has_children = TRUE;
+		}
+		_grits_tile_evict(tile, free_func, user_data);
+		evicted++;
+		if (!has_children && _grits_tile_evictable(parent) &&
+		    _grits_tile_cached(parent) && !_grits_tile_needed(parent))
+			g_pqueue_push(lru, parent);
+	}
+	g_pqueue_free(lru);
+
+	GritsTileCache cache;
+	g_mutex_lock(&grits_tile_cache_lock);
+	grits_tile_cache.evicted += evicted;
+	cache = grits_tile_cache;
+	g_mutex_unlock(&grits_tile_cache_lock);
+	g_debug("GritsTile: gc - evicted=%d cpu=%dk/%dk gpu=%dk/%dk", evicted,
+			(gint)(cache.cpu/1024), (gint)(cache.cpu_budget/1024),
+			(gint)(cache.gpu/1024), (gint)(cache.gpu_budget/1024));
 	return root;
 }
 
@@ -447,11 +852,277 @@ void grits_tile_free(GritsTile *root, GritsTileFreeFunc free_func, gpointer user
 	GritsTile *child;
 	grits_tile_foreach(root, child)
 		grits_tile_free(child, free_func, user_data);
+	_grits_tile_release(root);
 	if (free_func)
 		free_func(root, user_data);
 	g_object_unref(root);
 }
 
+/* Size the worker pool, while holding grits_tile_loads_lock */
+static void _grits_tile_set_workers(void)
+{
+	gint threads = grits_tile_threads > 0 ?
+		grits_tile_threads : g_get_num_processors();
+	if (!grits_tile_workers)
+		grits_tile_workers = g_thread_pool_new(
+				_grits_tile_load_thread, NULL, threads, FALSE, NULL);
+	else
+		g_thread_pool_set_max_threads(grits_tile_workers, threads, NULL);
+	grits_tile_loads.threads = threads;
+}
+
+/**
+ * grits_tile_set_threads:
+ * @threads: number of worker threads, or 0 for one per processor
+ *
+ * Set the number of worker threads which load tiles. The threads are shared
+ * by all loaders, see grits_tile_loader_set_limit to limit the number used
+ * by a single loader.
+ */
+void grits_tile_set_threads(gint threads)
+{
+	g_mutex_lock(&grits_tile_loads_lock);
+	grits_tile_threads = threads;
+	if (grits_tile_workers)
+		_grits_tile_set_workers();
+	g_mutex_unlock(&grits_tile_loads_lock);
+}
+
+/**
+ * grits_tile_loader_new:
+ * @load_func: function called from a worker thread to load a tile
+ * @user_data: user data to pass to the load function
+ *
+ * Create a scheduler for loading tiles. All loaders share one pool of worker
+ * threads, and the requests which would improve the view the most are loaded
+ * first. Requests are re-ranked by grits_tile_update as the eye moves and
+ * cancelled when the tile is no longer needed.
+ *
+ * Returns: the new #GritsTileLoader
+ */
+GritsTileLoader *grits_tile_loader_new(GritsTileLoadFunc load_func,
+		gpointer user_data)
+{
+	GritsTileLoader *loader = g_new0(GritsTileLoader, 1);
+	loader->load_func = load_func;
+	loader->user_data = user_data;
+	loader->queue     = g_pqueue_new(
+			(GCompareDataFunc)_grits_tile_load_cmp, NULL);
+
+	g_mutex_lock(&grits_tile_loads_lock);
+	if (!grits_tile_workers)
+		_grits_tile_set_workers();
+	grits_tile_loaders = g_list_prepend(grits_tile_loaders, loader);
+	g_mutex_unlock(&grits_tile_loads_lock);
+	return loader;
+}
+
+/**
+ * grits_tile_loader_set_limit:
+ * @loader: the loader to limit
+ * @limit:  maximum number of requests loaded at once, or 0 for no limit
+ *
+ * Limit the number of worker threads used by a loader, for instance to avoid
+ * opening too many connections to a single server. Requests held back by the
+ * limit do not block requests from other loaders.
+ */
+void grits_tile_loader_set_limit(GritsTileLoader *loader, gint limit)
+{
+	g_mutex_lock(&grits_tile_loads_lock);
+	loader->limit = limit;
+	loader->loads.threads = limit;
+	g_mutex_unlock(&grits_tile_loads_lock);
+	/* Wake up workers for requests which were held back */
+	g_thread_pool_push(grits_tile_workers, GINT_TO_POINTER(TRUE), NULL);
+}
+
+/**
+ * grits_tile_loader_push:
+ * @loader: the loader to use
+ * @tile:   the tile to load
+ *
+ * Queue a tile to be loaded by a worker thread. This is normally called from
+ * the load function passed to grits_tile_update, which sets the priority of
+ * the tile. If the tile is already queued its request is kept, grits_tile_update
+ * re-ranks queued requests when their priority changes.
+ */
+void grits_tile_loader_push(GritsTileLoader *loader, GritsTile *tile)
+{
+	g_mutex_lock(&grits_tile_loads_lock);
+	if (tile->pending) {
+		g_mutex_unlock(&grits_tile_loads_lock);
+		return;
+	}
+	tile->loader  = loader;
+	tile->pending = g_pqueue_push(loader->queue, tile);
+	loader->loads.queued++;
+	loader->loads.requested++;
+	grits_tile_loads.queued++;
+	grits_tile_loads.requested++;
+	g_mutex_unlock(&grits_tile_loads_lock);
+	g_thread_pool_push(grits_tile_workers, GINT_TO_POINTER(TRUE), NULL);
+}
+
+/**
+ * grits_tile_loader_get_loads:
+ * @loader: the loader to get statistics for
+ * @loads:  location to store a copy of the statistics
+ *
+ * Get statistics about the requests made to a single loader. The statistics
+ * are copied while holding the lock used by the worker threads.
+ */
+void grits_tile_loader_get_loads(GritsTileLoader *loader, GritsTileLoads *loads)
+{
+	g_mutex_lock(&grits_tile_loads_lock);
+	*loads = loader->loads;
+	g_mutex_unlock(&grits_tile_loads_lock);
+}
+
+/**
+ * grits_tile_loader_free:
+ * @loader: the loader to free
+ *
+ * Cancel the loader's queued requests and wait for the running ones to finish.
+ */
+void grits_tile_loader_free(GritsTileLoader *loader)
+{
+	GritsTile *tile;
+	g_mutex_lock(&grits_tile_loads_lock);
+	while ((tile = g_pqueue_peek(loader->queue)))
+		_grits_tile_cancel_load(tile);
+	while (loader->loads.running)
+		g_cond_wait(&grits_tile_loads_cond, &grits_tile_loads_lock);
+	grits_tile_loaders = g_list_remove(grits_tile_loaders, loader);
+	g_mutex_unlock(&grits_tile_loads_lock);
+	g_pqueue_free(loader->queue);
+	g_free(loader);
+}
+
+/**
+ * grits_tile_get_loads:
+ * @loads: location to store a copy of the statistics
+ *
+ * Get statistics about tile loading. The statistics are copied while holding
+ * the lock used by the worker threads.
+ */
+void grits_tile_get_loads(GritsTileLoads *loads)
+{
+	g_mutex_lock(&grits_tile_loads_lock);
+	*loads = grits_tile_loads;
+	g_mutex_unlock(&grits_tile_loads_lock);
+}
+
+/**
+ * grits_tile_set_fallback:
+ * @level: level of the tiles to keep as a fallback, or -1 to load every level
+ *
+ * By default grits_tile_update only loads the tiles which are drawn, skipping
+ * the levels between them and the fallback level. This avoids loading every
+ * level while zooming in, the fallback tiles are drawn until the higher
+ * resolution tiles are ready.
+ */
+void grits_tile_set_fallback(gint level)
+{
+	grits_tile_fallback = level;
+}
+
+/**
+ * grits_tile_set_upload_budget:
+ * @bytes: bytes of texture data to upload per frame, or 0 for no limit
+ * @pbo:   %TRUE to upload through a pixel buffer object
+ *
+ * Limit the amount of texture data uploaded while drawing a frame. Tiles are
+ * uploaded in order of their size on screen and at least one tile is uploaded
+ * each frame. Tiles which are not ready yet are drawn using their parents.
+ */
+void grits_tile_set_upload_budget(gint bytes, gboolean pbo)
+{
+	grits_tile_upload_budget = bytes;
+	grits_tile_upload_pbo    = pbo;
+}
+
+/**
+ * grits_tile_set_cache_budget:
+ * @cpu: bytes of pixel data waiting to be uploaded, or 0 for no limit
+ * @gpu: bytes of textures and vertex buffers, or 0 for no limit
+ *
+ * Limit the memory used by tiles. When the budget is exceeded grits_tile_gc
+ * removes the least recently used tiles which are not part of the current view.
+ */
+void grits_tile_set_cache_budget(gint64 cpu, gint64 gpu)
+{
+	g_mutex_lock(&grits_tile_cache_lock);
+	grits_tile_cache.cpu_budget = cpu;
+	grits_tile_cache.gpu_budget = gpu;
+	g_mutex_unlock(&grits_tile_cache_lock);
+}
+
+/**
+ * grits_tile_get_cache:
+ * @cache: location to store a copy of the statistics
+ *
+ * Get the memory currently used by tiles. The statistics are copied while
+ * holding the lock used by the threads which load tiles.
+ */
+void grits_tile_get_cache(GritsTileCache *cache)
+{
+	g_mutex_lock(&grits_tile_cache_lock);
+	*cache = grits_tile_cache;
+	g_mutex_unlock(&grits_tile_cache_lock);
+}
+
+/**
+ * grits_tile_get_uploads:
+ *
+ * Get statistics about texture uploads.
+ *
+ * Returns: the upload statistics, owned by grits
+ */
+const GritsTileUploads *grits_tile_get_uploads(void)
+{
+	return &grits_tile_uploads;
+}
+
+/**
+ * grits_tile_setup_prefs:
+ * @prefs: the preferences to read
+ *
+ * Configure tile loading, texture uploads and the tile cache from the "grits"
+ * group of @prefs. These settings are shared by all layers, keys which are not
+ * set keep their current values.
+ */
+void grits_tile_setup_prefs(GritsPrefs *prefs)
+{
+	/* Texture uploads, in kilobytes per frame, 0 for no limit */
+	if (grits_prefs_has_key(prefs, "grits/upload_budget"))
+		grits_tile_upload_budget = MAX(grits_prefs_get_integer(prefs,
+				"grits/upload_budget", NULL), 0) * 1024;
+	if (grits_prefs_has_key(prefs, "grits/upload_pbo"))
+		grits_tile_upload_pbo = grits_prefs_get_boolean(prefs,
+				"grits/upload_pbo", NULL);
+
+	/* Tile cache, in megabytes, 0 for no limit */
+	GritsTileCache cache;
+	grits_tile_get_cache(&cache);
+	if (grits_prefs_has_key(prefs, "grits/cache_cpu"))
+		cache.cpu_budget = MAX(grits_prefs_get_integer(prefs,
+				"grits/cache_cpu", NULL), 0) * (gint64)1024*1024;
+	if (grits_prefs_has_key(prefs, "grits/cache_gpu"))
+		cache.gpu_budget = MAX(grits_prefs_get_integer(prefs,
+				"grits/cache_gpu", NULL), 0) * (gint64)1024*1024;
+	grits_tile_set_cache_budget(cache.cpu_budget, cache.gpu_budget);
+
+	/* Threads for loading tiles, 0 for one per CPU */
+	if (grits_prefs_has_key(prefs, "grits/tile_threads"))
+		grits_tile_set_threads(grits_prefs_get_integer(prefs,
+				"grits/tile_threads", NULL));
+
+	/* Tile level loaded while zooming, negative loads every level */
+	if (grits_prefs_has_key(prefs, "grits/tile_fallback"))
+		grits_tile_set_fallback(grits_prefs_get_integer(prefs,
+				"grits/tile_fallback", NULL));
+}
+
 /* Load texture mask so we can draw a texture to just a part of a triangle */
 static guint _grits_tile_load_mask(void)
 {
@@ -475,27 +1146,81 @@ static guint _grits_tile_load_mask(void)
 }
 
 /* Load the texture from saved pixel data */
-static gboolean _grits_tile_load_tex(GritsTile *tile)
+static gint _grits_tile_upload_cmp(GritsTile *a, GritsTile *b, gpointer data)
 {
-	/* Abort for null tiles */
-	if (!tile)
-		return FALSE;
-
-	/* Defer loading of hidden tiles */
-	if (GRITS_OBJECT(tile)->hidden)
-		return FALSE;
+	if      (a->upload_importance < b->upload_importance) return  1;
+	else if (a->upload_importance > b->upload_importance) return -1;
+	else                                                  return  0;
+}
 
-	/* If we're already done loading the text stop */
-	if (tile->tex)
-		return TRUE;
+/* Screen area covered by a tile, used to order uploads */
+static gdouble _grits_tile_importance(GritsTile *tile, GritsOpenGL *opengl)
+{
+	RoamView *view = opengl->sphere->view;
+	gdouble n = tile->edge.n, s = tile->edge.s;
+	gdouble e = tile->edge.e, w = tile->edge.w;
+	gdouble ll[5][2] = {{n,w}, {n,e}, {s,e}, {s,w}, {(n+s)/2,(e+w)/2}};
+	gdouble xyz[5][3], win[5][3];
+	for (int i = 0; i < G_N_ELEMENTS(ll); i++)
+		lle2xyz(ll[i][0], ll[i][1], 0, &xyz[i][0], &xyz[i][1], &xyz[i][2]);
+	roam_view_project(view, xyz, win, G_N_ELEMENTS(xyz));
+
+	/* Bounding box of the points in front of the camera */
+	gdouble min_x = G_MAXDOUBLE, max_x = -G_MAXDOUBLE;
+	gdouble min_y = G_MAXDOUBLE, max_y = -G_MAXDOUBLE;
+	for (int i = 0; i < G_N_ELEMENTS(win); i++) {
+		if (win[i][2] <= 0 || win[i][2] >= 1)
+			continue;
+		min_x = MIN(min_x, win[i][0]); max_x = MAX(max_x, win[i][0]);
+		min_y = MIN(min_y, win[i][1]); max_y = MAX(max_y, win[i][1]);
+	}
+	min_x = MAX(min_x, view->view[0]); max_x = MIN(max_x, view->view[2]);
+	min_y = MAX(min_y, view->view[1]); max_y = MIN(max_y, view->view[3]);
+	if (min_x >= max_x || min_y >= max_y)
+		return 0;
+	return (max_x - min_x) * (max_y - min_y);
+}
 
-	/* Check if the tile has data yet */
-	if (!tile->pixels && !tile->pixbuf)
-		return FALSE;
+/* Add a tile to the upload queue, or update its importance */
+static void _grits_tile_queue_upload(GritsTile *tile, GritsOpenGL *opengl)
+{
+	if (!grits_tile_queue)
+		grits_tile_queue = g_pqueue_new(
+				(GCompareDataFunc)_grits_tile_upload_cmp, NULL);
+	tile->upload_importance = _grits_tile_importance(tile, opengl);
+	tile->upload_frame      = opengl->frame;
+	if (tile->upload) {
+		g_pqueue_priority_changed(grits_tile_queue, tile->upload);
+	} else {
+		tile->upload = g_pqueue_push(grits_tile_queue, tile);
+		grits_tile_uploads.queued++;
+	}
+}
 
+/* Create the texture for a tile and free its pixel data */
+static void _grits_tile_upload(GritsTile *tile)
+{
 	/* Get correct pixel buffer */
 	guchar *pixels = tile->pixels ?:
 		gdk_pixbuf_get_pixels(tile->pixbuf);
+	gsize   size   = _grits_tile_get_size(tile);
+
+	/* Stream through a pixel buffer object so the driver can copy the
+	 * data to the card asynchronously */
+	if (grits_tile_upload_pbo) {
+		if (!grits_tile_upload_buffer)
+			glGenBuffers(1, &grits_tile_upload_buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, grits_tile_upload_buffer);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		gpointer mapped = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+		if (mapped) {
+			memcpy(mapped, pixels, size);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			pixels = NULL;
+		} else {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+	}
 
 	/* Create texture */
 	g_debug("GritsTile: load_tex");
@@ -511,6 +1236,9 @@ static gboolean _grits_tile_load_tex(GritsTile *tile)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
+	if (grits_tile_upload_pbo)
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
 	/* Free data */
 	if (tile->pixbuf) {
 		g_object_unref(tile->pixbuf);
@@ -520,23 +1248,90 @@ static gboolean _grits_tile_load_tex(GritsTile *tile)
 		g_free(tile->pixels);
 		tile->pixels = NULL;
 	}
+	_grits_tile_account(-(gint64)size, tile->width * tile->height * 4);
+}
 
-	return TRUE;
+/* Upload the most important queued tiles until the frame's budget is used,
+ * tiles which were not requested during the last frame are dropped */
+static void _grits_tile_run_uploads(GritsOpenGL *opengl)
+{
+	GritsTileUploads *stats = &grits_tile_uploads;
+	if (grits_tile_upload_frame != opengl->frame) {
+		grits_tile_upload_frame = opengl->frame;
+		stats->uploads = 0;
+		stats->bytes   = 0;
+		stats->time    = 0;
+	}
+	if (!grits_tile_queue)
+		return;
 
+	gint64 start = g_get_monotonic_time();
+	gint uploads = 0;
+	GritsTile *tile;
+	while ((tile = g_pqueue_peek(grits_tile_queue))) {
+		if (tile->upload_frame + 1 < opengl->frame) {
+			_grits_tile_cancel_upload(tile);
+			continue;
+		}
+		gsize size = _grits_tile_get_size(tile);
+		if (grits_tile_upload_budget > 0 && stats->bytes > 0 &&
+		    stats->bytes + size > grits_tile_upload_budget)
+			break;
+		_grits_tile_cancel_upload(tile);
+		_grits_tile_upload(tile);
+		stats->bytes += size;
+		stats->total += size;
+		uploads++;
+	}
+	stats->uploads += uploads;
+	stats->time    += g_get_monotonic_time() - start;
+
+	if (uploads)
+		g_debug("GritsTile: run_uploads - uploads=%d bytes=%d/%d "
+				"time=%dus queued=%d",
+				stats->uploads, (gint)stats->bytes,
+				grits_tile_upload_budget, (gint)stats->time,
+				stats->queued);
+
+	/* Draw the new textures, and continue uploading next frame */
+	if (uploads || stats->queued)
+		grits_viewer_queue_draw(GRITS_VIEWER(opengl));
 }
 
-/* Draw a single tile */
-static void grits_tile_draw_one(GritsTile *tile, GritsOpenGL *opengl, GList *triangles)
+/* Check if a tile's texture is ready, queueing it for upload if needed */
+static gboolean _grits_tile_load_tex(GritsTile *tile, GritsOpenGL *opengl)
 {
-	if (!tile || !tile->tex)
-		return;
-	if (!triangles)
+	/* Abort for null tiles */
+	if (!tile)
+		return FALSE;
+
+	/* Defer loading of hidden tiles */
+	if (GRITS_OBJECT(tile)->hidden)
+		return FALSE;
+
+	/* If we're already done loading the text stop */
+	if (tile->tex)
+		return TRUE;
+
+	/* Check if the tile has data yet */
+	if (!tile->pixels && !tile->pixbuf)
+		return FALSE;
+
+	/* Upload when the budget allows, see _grits_tile_run_uploads */
+	_grits_tile_queue_upload(tile, opengl);
+	return FALSE;
+}
+
+/* Build the vertex buffer for the triangles under a tile. Vertices are stored
+ * relative to the center of the tile so that floats are precise enough. */
+static void grits_tile_update_vbo(GritsTile *tile, GPtrArray *triangles)
+{
+	if (!triangles->len)
 		g_warning("GritsOpenGL: _draw_tiles - No triangles to draw: edges=%f,%f,%f,%f",
 			tile->edge.n, tile->edge.s, tile->edge.e, tile->edge.w);
 
 	//g_message("drawing %4d triangles for tile edges=%7.2f,%7.2f,%7.2f,%7.2f",
-	//		g_list_length(triangles), tile->edge.n, tile->edge.s, tile->edge.e, tile->edge.w);
-	tile->atime = time(NULL);
+	//		triangles->len, tile->edge.n, tile->edge.s, tile->edge.e, tile->edge.w);
 
 	gdouble n = tile->edge.n;
 	gdouble s = tile->edge.s;
@@ -549,10 +1344,17 @@ static void grits_tile_draw_one(GritsTile *tile, GritsOpenGL *opengl, GList *tri
 	gdouble xscale = tile->coords.e - tile->coords.w;
 	gdouble yscale = tile->coords.s - tile->coords.n;
 
-	glPolygonOffset(0, -tile->zindex);
+	gdouble *origin = tile->vbo_origin;
+	lle2xyz((n+s)/2, (e+w)/2, 0, &origin[0], &origin[1], &origin[2]);
 
-	for (GList *cur = triangles; cur; cur = cur->next) {
-		RoamTriangle *tri = cur->data;
+	if (!grits_tile_vertices)
+		grits_tile_vertices = g_array_new(FALSE, FALSE, sizeof(GritsTileVertex));
+	g_array_set_size(grits_tile_vertices, triangles->len*3);
+	GritsTileVertex *verts = (GritsTileVertex*)grits_tile_vertices->data;
+
+	for (guint i = 0; i < triangles->len; i++) {
+		RoamTriangle *tri = triangles->pdata[i];
+		RoamPoint *points[3] = {tri->p.r, tri->p.m, tri->p.l};
 
 		gdouble lat[3] = {tri->p.r->lat, tri->p.m->lat, tri->p.l->lat};
 		gdouble lon[3] = {tri->p.r->lon, tri->p.m->lon, tri->p.l->lon};
@@ -569,39 +1371,78 @@ static void grits_tile_draw_one(GritsTile *tile, GritsOpenGL *opengl, GList *tri
 			{(lon[2]-w)/londist, 1-(lat[2]-s)/latdist},
 		};
 
-		//if ((lat[0] == 90 && (xy[0][0] < 0 || xy[0][0] > 1)) ||
-		//    (lat[1] == 90 && (xy[1][0] < 0 || xy[1][0] > 1)) ||
-		//    (lat[2] == 90 && (xy[2][0] < 0 || xy[2][0] > 1)))
-		//	g_message("w,e=%4.f,%4.f   "
-		//	          "lat,lon,x,y="
-		//	          "%4.1f,%4.0f,%4.2f,%4.2f   "
-		//	          "%4.1f,%4.0f,%4.2f,%4.2f   "
-		//	          "%4.1f,%4.0f,%4.2f,%4.2f   ",
-		//		w,e,
-		//		lat[0], lon[0], xy[0][0], xy[0][1],
-		//		lat[1], lon[1], xy[1][0], xy[1][1],
-		//		lat[2], lon[2], xy[2][0], xy[2][1]);
-
 		/* Fix poles */
 		if (lat[0] == 90 || lat[0] == -90) xy[0][0] = 0.5;
 		if (lat[1] == 90 || lat[1] == -90) xy[1][0] = 0.5;
 		if (lat[2] == 90 || lat[2] == -90) xy[2][0] = 0.5;
 
-		/* Scale to tile coords */
-		for (int i = 0; i < 3; i++) {
-			xy[i][0] = tile->coords.w + xy[i][0]*xscale;
-			xy[i][1] = tile->coords.n + xy[i][1]*yscale;
+		/* Scale to tile coords and store the vertex */
+		for (int j = 0; j < 3; j++) {
+			GritsTileVertex *vert = &verts[i*3+j];
+			vert->xyz[0]  = points[j]->x - origin[0];
+			vert->xyz[1]  = points[j]->y - origin[1];
+			vert->xyz[2]  = points[j]->z - origin[2];
+			vert->norm[0] = points[j]->norm[0];
+			vert->norm[1] = points[j]->norm[1];
+			vert->norm[2] = points[j]->norm[2];
+			vert->tex[0]  = tile->coords.w + xy[j][0]*xscale;
+			vert->tex[1]  = tile->coords.n + xy[j][1]*yscale;
 		}
+	}
+
+	if (!tile->vbo)
+		glGenBuffers(1, &tile->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, tile->vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GritsTileVertex) * triangles->len*3,
+			verts, GL_STATIC_DRAW);
+	_grits_tile_account(0, (gint64)sizeof(GritsTileVertex) *
+			((gint64)triangles->len*3 - tile->vbo_count));
+	tile->vbo_count = triangles->len*3;
+}
 
-		/* Draw triangle */
-		glBindTexture(GL_TEXTURE_2D, tile->tex);
-		glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-		glBegin(GL_TRIANGLES);
-		glNormal3dv(tri->p.r->norm); glMultiTexCoord2dv(GL_TEXTURE0, xy[0]); glMultiTexCoord2dv(GL_TEXTURE1, xy[0]); glVertex3dv((double*)tri->p.r);
-		glNormal3dv(tri->p.m->norm); glMultiTexCoord2dv(GL_TEXTURE0, xy[1]); glMultiTexCoord2dv(GL_TEXTURE1, xy[1]); glVertex3dv((double*)tri->p.m);
-		glNormal3dv(tri->p.l->norm); glMultiTexCoord2dv(GL_TEXTURE0, xy[2]); glMultiTexCoord2dv(GL_TEXTURE1, xy[2]); glVertex3dv((double*)tri->p.l);
-		glEnd();
+/* Draw a single tile */
+static void grits_tile_draw_one(GritsTile *tile, GritsOpenGL *opengl)
+{
+	if (!tile || !tile->tex)
+		return;
+
+	tile->atime = time(NULL);
+	tile->used  = g_get_monotonic_time();
+
+	/* Rebuild the vertex buffer if the mesh has changed */
+	gint version = roam_sphere_get_version(opengl->sphere,
+			tile->edge.n, tile->edge.s, tile->edge.e, tile->edge.w);
+	if (!tile->vbo || tile->vbo_version != version) {
+		grits_tile_triangles = roam_sphere_get_intersect(opengl->sphere,
+				FALSE, tile->edge.n, tile->edge.s, tile->edge.e,
+				tile->edge.w, grits_tile_triangles);
+		grits_tile_update_vbo(tile, grits_tile_triangles);
+		tile->vbo_version = version;
 	}
+
+	glPolygonOffset(0, -tile->zindex);
+
+	glBindTexture(GL_TEXTURE_2D, tile->tex);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+	/* Both texture units use the same coordinates */
+	gsize stride = sizeof(GritsTileVertex);
+	glBindBuffer(GL_ARRAY_BUFFER, tile->vbo);
+	glVertexPointer(3, GL_FLOAT, stride,
+			(gpointer)offsetof(GritsTileVertex, xyz));
+	glNormalPointer(GL_FLOAT, stride,
+			(gpointer)offsetof(GritsTileVertex, norm));
+	glClientActiveTexture(GL_TEXTURE1);
+	glTexCoordPointer(2, GL_FLOAT, stride,
+			(gpointer)offsetof(GritsTileVertex, tex));
+	glClientActiveTexture(GL_TEXTURE0);
+	glTexCoordPointer(2, GL_FLOAT, stride,
+			(gpointer)offsetof(GritsTileVertex, tex));
+
+	glPushMatrix();
+	glTranslated(tile->vbo_origin[0], tile->vbo_origin[1], tile->vbo_origin[2]);
+	glDrawArrays(GL_TRIANGLES, 0, tile->vbo_count);
+	glPopMatrix();
 }
 
 /* Draw the tile */
@@ -612,24 +1453,25 @@ static gboolean grits_tile_draw_rec(GritsTile *tile, GritsOpenGL *opengl)
 	//		tile ? !!tile->load : 0,
 	//		tile ? !!GRITS_OBJECT(tile)->hidden : 0);
 
-	if (!_grits_tile_load_tex(tile))
+	if (!tile || GRITS_OBJECT(tile)->hidden)
 		return FALSE;
 
+	gboolean loaded = _grits_tile_load_tex(tile, opengl);
+
 	GritsTile *child = NULL;
 
-	/* Draw child tiles */
+	/* Draw child tiles, even if this one was skipped */
 	gboolean draw_parent = FALSE;
 	grits_tile_foreach(tile, child)
 		if (!grits_tile_draw_rec(child, opengl))
 			draw_parent = TRUE;
 
-	/* Draw parent tile underneath using depth test */
-	if (draw_parent) {
-		GList *triangles = roam_sphere_get_intersect(opengl->sphere, FALSE,
-				tile->edge.n, tile->edge.s, tile->edge.e, tile->edge.w);
-		grits_tile_draw_one(tile, opengl, triangles);
-		g_list_free(triangles);
-	}
+	/* Draw parent tile underneath using depth test, or let an ancestor
+	 * fill in where this one is not loaded */
+	if (draw_parent && !loaded)
+		return FALSE;
+	if (draw_parent)
+		grits_tile_draw_one(tile, opengl);
 
 	return TRUE;
 }
@@ -661,9 +1503,29 @@ static void grits_tile_draw(GritsObject *tile, GritsOpenGL *opengl)
 		glMaterialfv(GL_FRONT_AND_BACK, GL_EMISSION, material_emission);
 	}
 
+	/* Setup vertex arrays */
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glClientActiveTexture(GL_TEXTURE1);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glClientActiveTexture(GL_TEXTURE0);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+	/* Upload textures requested during the last frame */
+	_grits_tile_run_uploads(opengl);
+
 	/* Draw all tiles */
 	grits_tile_draw_rec(GRITS_TILE(tile), opengl);
 
+	/* Disable vertex arrays */
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glClientActiveTexture(GL_TEXTURE1);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glClientActiveTexture(GL_TEXTURE0);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+
 	/* Disable texture mask */
 	glActiveTexture(GL_TEXTURE1);
 	glDisable(GL_TEXTURE_2D);
@@ -21,6 +21,8 @@
 #include <glib.h>
 #include <glib-object.h>
 #include "grits-object.h"
+#include "grits-prefs.h"
+#include "roam.h"
 
 #define GRITS_TYPE_TILE            (grits_tile_get_type())
 #define GRITS_TILE(obj)            (G_TYPE_CHECK_INSTANCE_CAST((obj),   GRITS_TYPE_TILE, GritsTile))
@@ -29,8 +31,9 @@
 #define GRITS_IS_TILE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE   ((klass), GRITS_TYPE_TILE))
 #define GRITS_TILE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),   GRITS_TYPE_TILE, GritsTileClass))
 
-typedef struct _GritsTile      GritsTile;
-typedef struct _GritsTileClass GritsTileClass;
+typedef struct _GritsTile       GritsTile;
+typedef struct _GritsTileClass  GritsTileClass;
+typedef struct _GritsTileLoader GritsTileLoader;
 
 struct _GritsTile {
 	GritsObject  parent_instance;
@@ -54,6 +57,7 @@ struct _GritsTile {
 
 	/* Last access time (for garbage collection) */
 	time_t atime;
+	gint64 used; /* Monotonic time, for least recently used eviction */
 
 	/* Projection used by tile data */
 	GritsProj proj;
@@ -65,6 +69,22 @@ struct _GritsTile {
 	gint       width;
 	gint       height;
 	gint       alpha;
+
+	/* Vertex buffer for the part of the mesh under the tile */
+	guint      vbo;
+	gint       vbo_count;
+	gint       vbo_version;
+	gdouble    vbo_origin[3];
+
+	/* Pending texture upload */
+	GPQueueHandle upload;
+	gdouble       upload_importance;
+	guint         upload_frame;
+
+	/* Pending load request, see grits_tile_loader_push */
+	GritsTileLoader *loader;
+	GPQueueHandle    pending;
+	gdouble          priority;
 };
 
 struct _GritsTileClass {
@@ -90,6 +110,82 @@ typedef void (*GritsTileLoadFunc)(GritsTile *tile, gpointer user_data);
  */
 typedef void (*GritsTileFreeFunc)(GritsTile *tile, gpointer user_data);
 
+/**
+ * GritsTileVisibleFunc:
+ * @n:         the northern edge of the tile
+ * @s:         the southern edge of the tile
+ * @e:         the eastern edge of the tile
+ * @w:         the western edge of the tile
+ * @user_data: data paseed to the function
+ *
+ * Used to check if part of a tile could be drawn
+ *
+ * Returns: %FALSE if no part of the tile is visible
+ */
+typedef gboolean (*GritsTileVisibleFunc)(gdouble n, gdouble s,
+		gdouble e, gdouble w, gpointer user_data);
+
+/**
+ * GritsTileUploads:
+ * @queued:  tiles waiting to be uploaded
+ * @uploads: tiles uploaded during the last frame
+ * @bytes:   bytes uploaded during the last frame
+ * @time:    microseconds spent uploading during the last frame
+ * @total:   bytes uploaded since startup
+ *
+ * Texture upload statistics, see grits_tile_get_uploads
+ */
+typedef struct {
+	gint   queued;
+	gint   uploads;
+	gint64 bytes;
+	gint64 time;
+	gint64 total;
+} GritsTileUploads;
+
+/**
+ * GritsTileLoads:
+ * @threads:   worker threads which may be used, 0 for no limit
+ * @queued:    requests waiting for a worker thread
+ * @running:   requests being loaded
+ * @requested: requests made since startup
+ * @loaded:    requests which were started since startup
+ * @finished:  requests which finished loading since startup
+ * @cancelled: requests dropped before they started since startup
+ * @time:      microseconds spent loading since startup
+ *
+ * Tile load statistics, see grits_tile_get_loads. The throughput is found by
+ * sampling @finished, the average time per request from @time and @finished.
+ */
+typedef struct {
+	gint   threads;
+	gint   queued;
+	gint   running;
+	gint   requested;
+	gint   loaded;
+	gint   finished;
+	gint   cancelled;
+	gint64 time;
+} GritsTileLoads;
+
+/**
+ * GritsTileCache:
+ * @cpu:        bytes of pixel data waiting to be uploaded
+ * @gpu:        bytes of textures and vertex buffers
+ * @cpu_budget: limit for @cpu, or 0
+ * @gpu_budget: limit for @gpu, or 0
+ * @evicted:    tiles removed to stay within the budget since startup
+ *
+ * Memory used by tiles, see grits_tile_get_cache
+ */
+typedef struct {
+	gint64 cpu;
+	gint64 gpu;
+	gint64 cpu_budget;
+	gint64 gpu_budget;
+	gint   evicted;
+} GritsTileCache;
+
 /* Forech functions */
 /**
  * grits_tile_foreach:
@@ -128,8 +224,14 @@ GritsTile *grits_tile_new(GritsTile *parent,
 gchar *grits_tile_get_path(GritsTile *child);
 
 /* Update a root tile */
-/* Based on eye distance */
-void grits_tile_update(GritsTile *root, GritsPoint *eye,
+/* Based on eye distance, skipping tiles which are not visible */
+void grits_tile_update(GritsTile *root, GritsPoint *eye, GritsViewer *viewer,
+		gdouble res, gint width, gint height,
+		GritsTileLoadFunc load_func, gpointer user_data);
+
+/* Update a root tile using a custom visibility check */
+void grits_tile_update_visible(GritsTile *root, GritsPoint *eye,
+		GritsTileVisibleFunc visible_func, gpointer visible_data,
 		gdouble res, gint width, gint height,
 		GritsTileLoadFunc load_func, gpointer user_data);
 
@@ -146,7 +248,8 @@ gboolean grits_tile_load_file(GritsTile *tile, const gchar *file);
 /* Find the leaf tile containing lat-lon */
 GritsTile *grits_tile_find(GritsTile *root, gdouble lat, gdouble lon);
 
-/* Delete nodes that haven't been accessed since atime */
+/* Delete empty nodes that haven't been accessed since atime, and the least
+ * recently used nodes while over the cache budget */
 GritsTile *grits_tile_gc(GritsTile *root, time_t atime,
 		GritsTileFreeFunc free_func, gpointer user_data);
 
@@ -154,4 +257,45 @@ GritsTile *grits_tile_gc(GritsTile *root, time_t atime,
 void grits_tile_free(GritsTile *root,
 		GritsTileFreeFunc free_func, gpointer user_data);
 
+/* Set the number of worker threads shared by all loaders */
+void grits_tile_set_threads(gint threads);
+
+/* Create a scheduler for loading tiles from worker threads */
+GritsTileLoader *grits_tile_loader_new(GritsTileLoadFunc load_func,
+		gpointer user_data);
+
+/* Limit the number of worker threads used by a loader */
+void grits_tile_loader_set_limit(GritsTileLoader *loader, gint limit);
+
+/* Queue a tile to be loaded, tiles which are already queued are left as they
+ * are, grits_tile_update re-ranks them as their priority changes */
+void grits_tile_loader_push(GritsTileLoader *loader, GritsTile *tile);
+
+/* Get load statistics for a single loader */
+void grits_tile_loader_get_loads(GritsTileLoader *loader, GritsTileLoads *loads);
+
+/* Cancel queued requests and wait for running ones */
+void grits_tile_loader_free(GritsTileLoader *loader);
+
+/* Get tile load statistics */
+void grits_tile_get_loads(GritsTileLoads *loads);
+
+/* Set the level which is loaded while zooming in */
+void grits_tile_set_fallback(gint level);
+
+/* Limit memory used by tiles */
+void grits_tile_set_cache_budget(gint64 cpu, gint64 gpu);
+
+/* Get memory used by tiles */
+void grits_tile_get_cache(GritsTileCache *cache);
+
+/* Limit texture uploads per frame */
+void grits_tile_set_upload_budget(gint bytes, gboolean pbo);
+
+/* Get texture upload statistics */
+const GritsTileUploads *grits_tile_get_uploads(void);
+
+/* Read the settings shared by all tiles from the preferences */
+void grits_tile_setup_prefs(GritsPrefs *prefs);
+
 #endif
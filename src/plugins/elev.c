@@ -26,7 +26,11 @@
  */
 
 #include <time.h>
+#include <string.h>
 #include <glib/gstdio.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include <grits.h>
 
@@ -40,19 +44,144 @@
 #define MAX_RESOLUTION 50
 #define TILE_WIDTH     1024
 #define TILE_HEIGHT    512
+#define LOAD_THREADS   4
 #define TILE_CHANNELS  4
 #define TILE_SIZE      (TILE_WIDTH*TILE_HEIGHT*sizeof(guint16))
+#define MAPPED_BUDGET  256 /* Mapped tiles before packing */
 
-static gdouble _height_func(gdouble lat, gdouble lon, gpointer _elev)
+/****************
+ * Packed tiles *
+ ****************/
+/* Packed tiles are stored as square blocks of samples. Each sample is guessed
+ * from the block's lowest value and its slope, and only the difference from
+ * the guess is stored, using as few bits as possible. Flat blocks, such as the
+ * ocean, do not store any differences. Samples can be read directly without
+ * unpacking the tile. */
+#define BLOCK_SIZE     16
+#define BLOCKS_WIDE    (TILE_WIDTH/BLOCK_SIZE)
+#define BLOCKS_HIGH    (TILE_HEIGHT/BLOCK_SIZE)
+
+typedef struct {
+	guint32 offset; /* Offset of the differences in the packed data */
+	gint16  base;   /* Lowest sample in the block, less the slope */
+	gint16  dx, dy; /* Slope across the block, in 1/16ths per sample */
+	guint8  bits;   /* Bits used for each difference */
+} ElevBlock;
+
+typedef struct {
+	ElevBlock blocks[BLOCKS_HIGH][BLOCKS_WIDE];
+	gsize     size;   /* Total size of the packed tile */
+	guint8    data[]; /* Differences, followed by padding for reads */
+} ElevTile;
+
+static inline gint _tile_guess(const ElevBlock *block, gint lx, gint ly)
 {
-	GritsPluginElev *elev = _elev;
-	if (!elev) return 0;
+	return block->base + ((block->dx*lx + block->dy*ly) >> 4);
+}
+
+static inline gint16 _tile_get(const ElevTile *packed, guint x, guint y)
+{
+	const ElevBlock *block = &packed->blocks[y/BLOCK_SIZE][x/BLOCK_SIZE];
+	gint lx = x%BLOCK_SIZE, ly = y%BLOCK_SIZE;
+	gint guess = _tile_guess(block, lx, ly);
+	if (!block->bits)
+		return guess;
+	guint bit = (ly*BLOCK_SIZE + lx) * block->bits;
+	const guint8 *byte = &packed->data[block->offset + bit/8];
+	guint32 word = byte[0] | byte[1] << 8 | byte[2] << 16;
+	return guess + ((word >> bit%8) & ((1 << block->bits) - 1));
+}
 
-	GritsTile *tile = grits_tile_find(elev->tiles, lat, lon);
-	if (!tile) return 0;
+static ElevTile *_tile_pack(const guint16 *bil)
+{
+	/* Find the range of each block */
+	ElevBlock blocks[BLOCKS_HIGH][BLOCKS_WIDE];
+	gsize len = 0;
+	for (int by = 0; by < BLOCKS_HIGH; by++)
+	for (int bx = 0; bx < BLOCKS_WIDE; bx++) {
+		const guint16 *first = &bil[by*BLOCK_SIZE*TILE_WIDTH + bx*BLOCK_SIZE];
+		gint sx = 0, sy = 0;
+		for (int i = 0; i < BLOCK_SIZE; i++) {
+			sx += (gint16)first[i*TILE_WIDTH + BLOCK_SIZE-1] -
+			      (gint16)first[i*TILE_WIDTH];
+			sy += (gint16)first[(BLOCK_SIZE-1)*TILE_WIDTH + i] -
+			      (gint16)first[i];
+		}
+		/* Predict samples using the slope across the block when that makes
+		 * the differences smaller */
+		gint dx = CLAMP(sx / (BLOCK_SIZE-1), -2048, 2047);
+		gint dy = CLAMP(sy / (BLOCK_SIZE-1), -2048, 2047);
+		gint lo[2] = {G_MAXINT32, G_MAXINT32}, hi[2] = {-G_MAXINT32, -G_MAXINT32};
+		for (int y = 0; y < BLOCK_SIZE; y++)
+		for (int x = 0; x < BLOCK_SIZE; x++) {
+			gint value = (gint16)first[y*TILE_WIDTH + x];
+			gint guess = value - ((dx*x + dy*y) >> 4);
+			lo[0] = MIN(lo[0], value);
+			hi[0] = MAX(hi[0], value);
+			lo[1] = MIN(lo[1], guess);
+			hi[1] = MAX(hi[1], guess);
+		}
+		gint use = hi[1]-lo[1] < hi[0]-lo[0] &&
+		           lo[1] >= G_MININT16 && lo[1] <= G_MAXINT16;
+		ElevBlock *block = &blocks[by][bx];
+		block->dx     = use ? dx : 0;
+		block->dy     = use ? dy : 0;
+		block->base   = lo[use];
+		block->bits   = hi[use] > lo[use] ? g_bit_storage(hi[use] - lo[use]) : 0;
+		block->offset = len;
+		len += BLOCK_SIZE*BLOCK_SIZE * block->bits / 8;
+	}
 
-	guint16 *bil = tile->data;
-	if (!bil)  return 0;
+	/* Pack the differences, bits are stored least significant first */
+	ElevTile *packed = g_malloc0(sizeof(ElevTile) + len + 3);
+	memcpy(packed->blocks, blocks, sizeof(blocks));
+	packed->size = sizeof(ElevTile) + len + 3;
+	for (int y = 0; y < TILE_HEIGHT; y++)
+	for (int x = 0; x < TILE_WIDTH;  x++) {
+		ElevBlock *block = &blocks[y/BLOCK_SIZE][x/BLOCK_SIZE];
+		if (!block->bits)
+			continue;
+		gint    lx   = x%BLOCK_SIZE, ly = y%BLOCK_SIZE;
+		guint32 diff = (gint16)bil[y*TILE_WIDTH + x] -
+		               _tile_guess(block, lx, ly);
+		guint   bit  = (ly*BLOCK_SIZE + lx) * block->bits;
+		guint8 *byte = &packed->data[block->offset + bit/8];
+		diff <<= bit%8;
+		byte[0] |= diff;
+		byte[1] |= diff >> 8;
+		byte[2] |= diff >> 16;
+	}
+	g_debug("GritsPluginElev: _tile_pack - %ld bytes, %.1fx smaller",
+			(glong)packed->size, (gdouble)TILE_SIZE / packed->size);
+	return packed;
+}
+
+/* Tiles are used straight from the memory mapped cache file, which does not
+ * use any heap, until too many tiles are mapped. After that new tiles are
+ * packed onto the heap so the mappings can be released. */
+typedef struct {
+	GBytes        *bytes;  /* Mapped tile, or NULL */
+	const guint16 *bil;    /* Samples in the mapped tile */
+	ElevTile      *packed; /* Packed tile, or NULL */
+} ElevData;
+
+static inline gint16 _data_get(const ElevData *data, guint x, guint y)
+{
+	if (data->bil)
+		return data->bil[y*TILE_WIDTH + x];
+	return _tile_get(data->packed, x, y);
+}
+
+/* Maximum number of points sampled from a tile at once */
+#define SAMPLE_BATCH   64
+
+/* Bilinear interpolation of count points from a single tile. The order of the
+ * floating point operations is the same in both paths, so the results match
+ * exactly whether or not SSE2 is available. */
+static void _sample_tile(GritsTile *tile, const gdouble *lat, const gdouble *lon,
+		gdouble *elev, gint count)
+{
+	const ElevData *data = tile->data;
 
 	gint w = TILE_WIDTH;
 	gint h = TILE_HEIGHT;
@@ -65,52 +194,213 @@ static gdouble _height_func(gdouble lat, gdouble lon, gpointer _elev)
 	gdouble xdist = xmax - xmin;
 	gdouble ydist = ymax - ymin;
 
-	gdouble x =    (lon-xmin)/xdist  * w;
-	gdouble y = (1-(lat-ymin)/ydist) * h;
-
-	gdouble x_rem = x - (int)x;
-	gdouble y_rem = y - (int)y;
-	guint x_flr = (int)x;
-	guint y_flr = (int)y;
-
-	//if (lon == 180 || lon == -180)
-	//	g_message("lon=%f w=%d min=%f max=%f dist=%f x=%f rem=%f flr=%d",
-	//	           lon,   w,  xmin,  xmax,  xdist,   x, x_rem, x_flr);
-
-	/* TODO: Fix interpolation at edges:
-	 *   - Pad these at the edges instead of wrapping/truncating
-	 *   - Figure out which pixels to index (is 0,0 edge, center, etc) */
-	gint16 px00 = bil[MIN((y_flr  ),h-1)*w + MIN((x_flr  ),w-1)];
-	gint16 px10 = bil[MIN((y_flr  ),h-1)*w + MIN((x_flr+1),w-1)];
-	gint16 px01 = bil[MIN((y_flr+1),h-1)*w + MIN((x_flr  ),w-1)];
-	gint16 px11 = bil[MIN((y_flr+1),h-1)*w + MIN((x_flr+1),w-1)];
-
-	return px00 * (1-x_rem) * (1-y_rem) +
-	       px10 * (  x_rem) * (1-y_rem) +
-	       px01 * (1-x_rem) * (  y_rem) +
-	       px11 * (  x_rem) * (  y_rem);
+	gint i = 0;
+#if defined(__SSE2__)
+	__m128d vxmin = _mm_set1_pd(xmin),  vymin = _mm_set1_pd(ymin);
+	__m128d vxdst = _mm_set1_pd(xdist), vydst = _mm_set1_pd(ydist);
+	__m128d vw    = _mm_set1_pd(w),     vh    = _mm_set1_pd(h);
+	__m128d one   = _mm_set1_pd(1);
+	for (; i+1 < count; i += 2) {
+		__m128d x = _mm_mul_pd(_mm_div_pd(
+			_mm_sub_pd(_mm_loadu_pd(&lon[i]), vxmin), vxdst), vw);
+		__m128d y = _mm_mul_pd(_mm_sub_pd(one, _mm_div_pd(
+			_mm_sub_pd(_mm_loadu_pd(&lat[i]), vymin), vydst)), vh);
+
+		__m128i xi = _mm_cvttpd_epi32(x);
+		__m128i yi = _mm_cvttpd_epi32(y);
+		__m128d x_rem = _mm_sub_pd(x, _mm_cvtepi32_pd(xi));
+		__m128d y_rem = _mm_sub_pd(y, _mm_cvtepi32_pd(yi));
+
+		gint32 flr[2][4];
+		_mm_storeu_si128((__m128i*)flr[0], xi);
+		_mm_storeu_si128((__m128i*)flr[1], yi);
+
+		/* Gather the corners with scalar loads */
+		gdouble px[4][2];
+		for (int j = 0; j < 2; j++) {
+			guint x_flr = flr[0][j];
+			guint y_flr = flr[1][j];
+			guint x0 = MIN((x_flr  ),w-1), x1 = MIN((x_flr+1),w-1);
+			guint y0 = MIN((y_flr  ),h-1), y1 = MIN((y_flr+1),h-1);
+			px[0][j] = _data_get(data, x0, y0);
+			px[1][j] = _data_get(data, x1, y0);
+			px[2][j] = _data_get(data, x0, y1);
+			px[3][j] = _data_get(data, x1, y1);
+		}
+
+		__m128d x_inv = _mm_sub_pd(one, x_rem);
+		__m128d y_inv = _mm_sub_pd(one, y_rem);
+		__m128d v00 = _mm_mul_pd(_mm_mul_pd(_mm_loadu_pd(px[0]), x_inv), y_inv);
+		__m128d v10 = _mm_mul_pd(_mm_mul_pd(_mm_loadu_pd(px[1]), x_rem), y_inv);
+		__m128d v01 = _mm_mul_pd(_mm_mul_pd(_mm_loadu_pd(px[2]), x_inv), y_rem);
+		__m128d v11 = _mm_mul_pd(_mm_mul_pd(_mm_loadu_pd(px[3]), x_rem), y_rem);
+		_mm_storeu_pd(&elev[i], _mm_add_pd(_mm_add_pd(_mm_add_pd(
+				v00, v10), v01), v11));
+	}
+#endif
+	for (; i < count; i++) {
+		gdouble x =    (lon[i]-xmin)/xdist  * w;
+		gdouble y = (1-(lat[i]-ymin)/ydist) * h;
+
+		gdouble x_rem = x - (int)x;
+		gdouble y_rem = y - (int)y;
+		guint x_flr = (int)x;
+		guint y_flr = (int)y;
+
+		/* TODO: Fix interpolation at edges:
+		 *   - Pad these at the edges instead of wrapping/truncating
+		 *   - Figure out which pixels to index (is 0,0 edge, center, etc) */
+		gint16 px00 = _data_get(data, MIN((x_flr  ),w-1), MIN((y_flr  ),h-1));
+		gint16 px10 = _data_get(data, MIN((x_flr+1),w-1), MIN((y_flr  ),h-1));
+		gint16 px01 = _data_get(data, MIN((x_flr  ),w-1), MIN((y_flr+1),h-1));
+		gint16 px11 = _data_get(data, MIN((x_flr+1),w-1), MIN((y_flr+1),h-1));
+
+		elev[i] = px00 * (1-x_rem) * (1-y_rem) +
+		          px10 * (  x_rem) * (1-y_rem) +
+		          px01 * (1-x_rem) * (  y_rem) +
+		          px11 * (  x_rem) * (  y_rem);
+	}
+}
+
+/* Find the tile to sample a point from, starting from the previous tile when
+ * the point lies strictly inside of it */
+static GritsTile *_sample_find(GritsPluginElev *elev, GritsTile *last,
+		gdouble lat, gdouble lon)
+{
+	if (last && last->data &&
+	    last->edge.s < lat && lat < last->edge.n &&
+	    last->edge.w < lon && lon < last->edge.e)
+		return grits_tile_find(last, lat, lon);
+	return grits_tile_find(elev->tiles, lat, lon);
+}
+
+static void _height_batch(const gdouble *lat, const gdouble *lon,
+		gdouble *elev, gint count, gpointer _elev)
+{
+	GritsPluginElev *plugin = _elev;
+	if (count <= 0)
+		return;
+	if (!plugin) {
+		memset(elev, 0, count * sizeof(gdouble));
+		return;
+	}
+
+	/* Find the tile for each point, points which are next to each other are
+	 * usually in the same tile so the previous tile is checked first */
+	GHashTable *slots = g_hash_table_new(g_direct_hash, g_direct_equal);
+	GPtrArray  *tiles = g_ptr_array_new();
+	gint       *slot  = g_new(gint, count);
+	GritsTile  *last  = NULL;
+	gint        cur   = -1;
+	for (gint i = 0; i < count; i++) {
+		GritsTile *tile = _sample_find(plugin, last, lat[i], lon[i]);
+		if (!tile || !tile->data) {
+			elev[i] = 0;
+			slot[i] = -1;
+			continue;
+		}
+		if (tile != last) {
+			gpointer found;
+			if (g_hash_table_lookup_extended(slots, tile, NULL, &found)) {
+				cur = GPOINTER_TO_INT(found);
+			} else {
+				cur = tiles->len;
+				g_ptr_array_add(tiles, tile);
+				g_hash_table_insert(slots, tile, GINT_TO_POINTER(cur));
+			}
+			last = tile;
+		}
+		slot[i] = cur;
+	}
+
+	/* Sort the points by tile */
+	gint *start = g_new0(gint, tiles->len+1);
+	gint *order = g_new(gint, count);
+	for (gint i = 0; i < count; i++)
+		if (slot[i] >= 0)
+			start[slot[i]+1]++;
+	for (guint t = 0; t < tiles->len; t++)
+		start[t+1] += start[t];
+	for (gint i = 0; i < count; i++)
+		if (slot[i] >= 0)
+			order[start[slot[i]]++] = i;
+
+	/* Sample each tile in runs, start[t] is now the end of tile t */
+	gdouble run_lat[SAMPLE_BATCH], run_lon[SAMPLE_BATCH], run_elev[SAMPLE_BATCH];
+	gint i = 0;
+	for (guint t = 0; t < tiles->len; t++) {
+		while (i < start[t]) {
+			gint run = MIN(start[t] - i, SAMPLE_BATCH);
+			for (gint k = 0; k < run; k++) {
+				run_lat[k] = lat[order[i+k]];
+				run_lon[k] = lon[order[i+k]];
+			}
+			_sample_tile(tiles->pdata[t], run_lat, run_lon, run_elev, run);
+			for (gint k = 0; k < run; k++)
+				elev[order[i+k]] = run_elev[k];
+			i += run;
+		}
+	}
+
+	g_hash_table_destroy(slots);
+	g_ptr_array_free(tiles, TRUE);
+	g_free(slot);
+	g_free(start);
+	g_free(order);
+}
+
+static gdouble _height_func(gdouble lat, gdouble lon, gpointer _elev)
+{
+	GritsPluginElev *elev = _elev;
+	if (!elev) return 0;
+
+	/* Points are usually near the previous point, for instance when ROAM
+	 * splits triangles, so start looking from the previous tile. This is
+	 * only called from the main thread, along with _free_tile. */
+	GritsTile *tile = _sample_find(elev, elev->last, lat, lon);
+	if (!tile || !tile->data) return 0;
+	elev->last = tile;
+
+	gdouble height;
+	_sample_tile(tile, &lat, &lon, &height, 1);
+	return height;
 }
 
 /**********************
  * Loader and Freeers *
  **********************/
 
-static guint16 *_load_bil(gchar *path)
+/* The bil is used directly from the memory mapped cache file, so that it is
+ * not copied onto the heap and the kernel can reclaim it when it's unused */
+static const guint16 *_load_bil(GBytes *bytes)
 {
 	gsize len;
-	gchar *data = NULL;
-	g_file_get_contents(path, &data, &len, NULL);
+	gconstpointer data = g_bytes_get_data(bytes, &len);
 	g_debug("GritsPluginElev: load_bil %p", data);
 	if (len != TILE_SIZE) {
 		g_warning("GritsPluginElev: _load_bil - unexpected tile size %ld, != %ld",
 				(glong)len, (glong)TILE_SIZE);
-		g_free(data);
 		return NULL;
 	}
-	return (guint16*)data;
+	return data;
+}
+
+static ElevData *_load_data(GritsPluginElev *elev, GBytes *bytes,
+		const guint16 *bil)
+{
+	ElevData *data = g_new0(ElevData, 1);
+	gint mapped = g_atomic_int_add(&elev->mapped, 1);
+	if (elev->max_mapped < 0 || mapped < elev->max_mapped) {
+		data->bytes = g_bytes_ref(bytes);
+		data->bil   = bil;
+	} else {
+		g_atomic_int_add(&elev->mapped, -1);
+		data->packed = _tile_pack(bil);
+	}
+	return data;
 }
 
-static guchar *_load_pixels(guint16 *bil)
+static guchar *_load_pixels(const guint16 *bil)
 {
 	g_assert(TILE_CHANNELS == 4);
 
@@ -146,19 +436,21 @@ static void _load_tile_thread(gpointer _tile, gpointer _elev)
 	}
 
 	/* Download tile */
-	gchar *path = grits_wms_fetch(elev->wms, tile, GRITS_ONCE, NULL, NULL);
-	if (!path)
+	GBytes *bytes = grits_wms_fetch_bytes(elev->wms, tile, GRITS_ONCE, NULL, NULL);
+	if (!bytes)
 		return;
 
 	/* Load bil */
-	guint16 *bil = _load_bil(path);
-	g_free(path);
-	if (!bil)
+	const guint16 *bil = _load_bil(bytes);
+	if (!bil) {
+		g_bytes_unref(bytes);
+		grits_wms_remove(elev->wms, tile);
 		return;
+	}
 
-	/* Set hight function (TODO: from main thread?) */
+	/* Set hight function */
 	if (LOAD_BIL) {
-		tile->data = bil;
+		tile->data = _load_data(elev, bytes, bil);
 		grits_viewer_set_height_func(elev->viewer, &tile->edge,
 				_height_func, elev, TRUE);
 	}
@@ -170,19 +462,34 @@ static void _load_tile_thread(gpointer _tile, gpointer _elev)
 			TILE_WIDTH, TILE_HEIGHT, TILE_CHANNELS==4);
 	}
 
-	/* Free bill if we're not interested in a hight function */
-	if (!LOAD_BIL)
-		g_free(bil);
+	g_bytes_unref(bytes);
 
 	/* Load the GL texture from the main thread */
 	g_debug("GritsPluginElev: _load_tile_thread end %p", g_thread_self());
 }
 
+static void _free_tile(GritsTile *tile, gpointer _elev)
+{
+	GritsPluginElev *elev = _elev;
+	ElevData        *data = tile->data;
+	if (elev->last == tile)
+		elev->last = NULL;
+	if (!data)
+		return;
+	if (data->bytes) {
+		g_bytes_unref(data->bytes);
+		g_atomic_int_add(&elev->mapped, -1);
+	}
+	g_free(data->packed);
+	g_free(data);
+	tile->data = NULL;
+}
+
 static void _load_tile_func(GritsTile *tile, gpointer _elev)
 {
 	g_debug("GritsPluginElev: _load_tile_func - tile=%p", tile);
 	GritsPluginElev *elev = _elev;
-	g_thread_pool_push(elev->threads, tile, NULL);
+	grits_tile_loader_push(elev->loader, tile);
 }
 
 /*************
@@ -192,10 +499,18 @@ static void _on_location_changed(GritsViewer *viewer,
 		gdouble lat, gdouble lon, gdouble elevation, GritsPluginElev *elev)
 {
 	GritsPoint eye = {lat, lon, elevation};
-	grits_tile_update(elev->tiles, &eye,
+	grits_tile_update(elev->tiles, &eye, viewer,
 			MAX_RESOLUTION, TILE_WIDTH, TILE_WIDTH,
 			_load_tile_func, elev);
-	grits_tile_gc(elev->tiles, time(NULL)-10, NULL, elev);
+	grits_tile_gc(elev->tiles, time(NULL)-10, _free_tile, elev);
+}
+
+static void _on_rotation_changed(GritsViewer *viewer,
+		gdouble rx, gdouble ry, gdouble rz, GritsPluginElev *elev)
+{
+	gdouble lat, lon, elevation;
+	grits_viewer_get_location(viewer, &lat, &lon, &elevation);
+	_on_location_changed(viewer, lat, lon, elevation, elev);
 }
 
 /***********
@@ -215,14 +530,43 @@ GritsPluginElev *grits_plugin_elev_new(GritsViewer *viewer)
 	GritsPluginElev *elev = g_object_new(GRITS_TYPE_PLUGIN_ELEV, NULL);
 	elev->viewer = g_object_ref(viewer);
 
+	/* Limit the number of requests to the server at once */
+	gint threads = grits_prefs_get_integer(viewer->prefs,
+			"elev/load_threads", NULL);
+	grits_tile_loader_set_limit(elev->loader, threads > 0 ? threads : LOAD_THREADS);
+
+	/* Store tiles in a single pack instead of one file each */
+	if (grits_prefs_get_boolean(viewer->prefs, "grits/cache_packed", NULL))
+		grits_http_set_packed(elev->wms->http, TRUE);
+
+	/* Disk space for cached tiles in MB, negative for no limit */
+	gint quota = grits_prefs_get_integer(viewer->prefs,
+			"elev/cache_quota", NULL);
+	if (quota != 0)
+		grits_http_set_quota(elev->wms->http,
+				quota > 0 ? quota * (gint64)1024*1024 : -1);
+
+	/* Memory mapped tiles in MB, negative to never pack tiles */
+	gint mapped = grits_prefs_get_integer(viewer->prefs,
+			"elev/mapped_budget", NULL);
+	elev->max_mapped = mapped < 0 ? -1 :
+		mapped > 0 ? mapped * (gint64)1024*1024 / TILE_SIZE : MAPPED_BUDGET;
+
+	/* Let other objects sample the ground */
+	if (LOAD_BIL)
+		grits_viewer_set_height_sampler(viewer,
+				_height_func, _height_batch, elev);
+
 	/* Load initial tiles */
 	gdouble lat, lon, elevation;
 	grits_viewer_get_location(viewer, &lat, &lon, &elevation);
 	_on_location_changed(viewer, lat, lon, elevation, elev);
 
-	/* Connect signals */
-	elev->sigid = g_signal_connect(elev->viewer, "location-changed",
+	/* Connect signals, after the viewer has updated the view */
+	elev->sigid = g_signal_connect_after(elev->viewer, "location-changed",
 			G_CALLBACK(_on_location_changed), elev);
+	elev->rotid = g_signal_connect_after(elev->viewer, "rotation-changed",
+			G_CALLBACK(_on_rotation_changed), elev);
 
 	/* Add renderers */
 	if (LOAD_TEX)
@@ -250,8 +594,10 @@ static void grits_plugin_elev_init(GritsPluginElev *elev)
 {
 	g_debug("GritsPluginElev: init");
 	/* Set defaults */
-	elev->threads = g_thread_pool_new(_load_tile_thread, elev, 1, FALSE, NULL);
+	elev->loader = grits_tile_loader_new(
+			(GritsTileLoadFunc)_load_tile_thread, elev);
 	elev->tiles = grits_tile_new(NULL, NORTH, SOUTH, EAST, WEST);
+	elev->max_mapped = MAPPED_BUDGET;
 	elev->wms   = grits_wms_new(
 		"http://www.nasa.network.com/elev", "mergedSrtm", "application/bil",
 		"srtm/", "bil", TILE_WIDTH, TILE_HEIGHT);
@@ -266,8 +612,9 @@ static void grits_plugin_elev_dispose(GObject *gobject)
 	if (elev->viewer) {
 		GritsViewer *viewer = elev->viewer;
 		g_signal_handler_disconnect(viewer, elev->sigid);
+		g_signal_handler_disconnect(viewer, elev->rotid);
 		grits_http_abort(elev->wms->http);
-		g_thread_pool_free(elev->threads, TRUE, TRUE);
+		grits_tile_loader_free(elev->loader);
 		elev->viewer = NULL;
 		if (LOAD_BIL)
 			grits_viewer_clear_height_func(viewer);
@@ -283,7 +630,7 @@ static void grits_plugin_elev_finalize(GObject *gobject)
 	GritsPluginElev *elev = GRITS_PLUGIN_ELEV(gobject);
 	/* Free data */
 	grits_wms_free(elev->wms);
-	grits_tile_free(elev->tiles, NULL, elev);
+	grits_tile_free(elev->tiles, _free_tile, elev);
 	G_OBJECT_CLASS(grits_plugin_elev_parent_class)->finalize(gobject);
 
 }
@@ -34,12 +34,16 @@ struct _GritsPluginElev {
 	GObject parent_instance;
 
 	/* instance members */
-	GritsViewer *viewer;
-	GritsTile   *tiles;
-	GritsWms    *wms;
-	GThreadPool *threads;
-	gulong       sigid;
-	gboolean     aborted;
+	GritsViewer     *viewer;
+	GritsTile       *tiles;
+	GritsWms        *wms;
+	GritsTileLoader *loader;
+	gulong           sigid;
+	gulong           rotid;
+	gboolean         aborted;
+	gint             mapped;     /* Tiles used straight from the cache */
+	gint             max_mapped; /* Tiles above this are packed, or -1 */
+	GritsTile       *last;       /* Tile found by the last height_func */
 };
 
 struct _GritsPluginElevClass {
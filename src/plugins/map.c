@@ -33,6 +33,7 @@
 #define MAX_RESOLUTION 1
 #define TILE_WIDTH     256
 #define TILE_HEIGHT    256
+#define LOAD_THREADS   2
 
 //#define MAX_RESOLUTION 100
 //#define TILE_WIDTH     1024
@@ -59,19 +60,20 @@ static void _load_tile_thread(gpointer _tile, gpointer _map)
 	}
 
 	/* Download tile */
-	gchar *path = grits_tms_fetch(map->tms, tile, GRITS_ONCE, NULL, NULL);
-	//gchar *path = grits_wms_fetch(map->wms, tile, GRITS_ONCE, NULL, NULL);
-	if (!path) return; // Canceled/error
+	GBytes *bytes = grits_tms_fetch_bytes(map->tms, tile, GRITS_ONCE, NULL, NULL);
+	//GBytes *bytes = grits_wms_fetch_bytes(map->wms, tile, GRITS_ONCE, NULL, NULL);
+	if (!bytes) return; // Canceled/error
 
 	/* Load pixbuf */
-	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file(path, NULL);
+	GInputStream *stream = g_memory_input_stream_new_from_bytes(bytes);
+	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_stream(stream, NULL, NULL);
+	g_object_unref(stream);
+	g_bytes_unref(bytes);
 	if (!pixbuf) {
-		g_warning("GritsPluginMap: _load_tile_thread - Error loading pixbuf %s", path);
-		g_remove(path);
-		g_free(path);
+		g_warning("GritsPluginMap: _load_tile_thread - Error loading pixbuf");
+		grits_tms_remove(map->tms, tile);
 		return;
 	}
-	g_free(path);
 
 #ifdef MAP_MAP_COLORS
 	/* Map texture colors, if needed */
@@ -102,7 +104,7 @@ static void _load_tile_func(GritsTile *tile, gpointer _map)
 {
 	g_debug("GritsPluginMap: _load_tile_func - tile=%p", tile);
 	GritsPluginMap *map = _map;
-	g_thread_pool_push(map->threads, tile, NULL);
+	grits_tile_loader_push(map->loader, tile);
 }
 
 /*************
@@ -112,12 +114,20 @@ static void _on_location_changed(GritsViewer *viewer,
 		gdouble lat, gdouble lon, gdouble elev, GritsPluginMap *map)
 {
 	GritsPoint eye = {lat, lon, elev};
-	grits_tile_update(map->tiles, &eye,
+	grits_tile_update(map->tiles, &eye, viewer,
 			MAX_RESOLUTION, TILE_WIDTH, TILE_WIDTH,
 			_load_tile_func, map);
 	grits_tile_gc(map->tiles, time(NULL)-10, NULL, map);
 }
 
+static void _on_rotation_changed(GritsViewer *viewer,
+		gdouble rx, gdouble ry, gdouble rz, GritsPluginMap *map)
+{
+	gdouble lat, lon, elev;
+	grits_viewer_get_location(viewer, &lat, &lon, &elev);
+	_on_location_changed(viewer, lat, lon, elev, map);
+}
+
 /***********
  * Methods *
  ***********/
@@ -135,14 +145,32 @@ GritsPluginMap *grits_plugin_map_new(GritsViewer *viewer)
 	GritsPluginMap *map = g_object_new(GRITS_TYPE_PLUGIN_MAP, NULL);
 	map->viewer = g_object_ref(viewer);
 
+	/* Limit the number of requests to the server at once */
+	gint threads = grits_prefs_get_integer(viewer->prefs,
+			"map/load_threads", NULL);
+	grits_tile_loader_set_limit(map->loader, threads > 0 ? threads : LOAD_THREADS);
+
+	/* Store tiles in a single pack instead of one file each */
+	if (grits_prefs_get_boolean(viewer->prefs, "grits/cache_packed", NULL))
+		grits_http_set_packed(map->tms->http, TRUE);
+
+	/* Disk space for cached tiles in MB, negative for no limit */
+	gint quota = grits_prefs_get_integer(viewer->prefs,
+			"map/cache_quota", NULL);
+	if (quota != 0)
+		grits_http_set_quota(map->tms->http,
+				quota > 0 ? quota * (gint64)1024*1024 : -1);
+
 	/* Load initial tiles */
 	gdouble lat, lon, elev;
 	grits_viewer_get_location(viewer, &lat, &lon, &elev);
 	_on_location_changed(viewer, lat, lon, elev, map);
 
-	/* Connect signals */
-	map->sigid = g_signal_connect(map->viewer, "location-changed",
+	/* Connect signals, after the viewer has updated the view */
+	map->sigid = g_signal_connect_after(map->viewer, "location-changed",
 			G_CALLBACK(_on_location_changed), map);
+	map->rotid = g_signal_connect_after(map->viewer, "rotation-changed",
+			G_CALLBACK(_on_rotation_changed), map);
 
 	/* Add renderers */
 	grits_viewer_add(viewer, GRITS_OBJECT(map->tiles), GRITS_LEVEL_WORLD, FALSE);
@@ -169,7 +197,8 @@ static void grits_plugin_map_init(GritsPluginMap *map)
 {
 	g_debug("GritsPluginMap: init");
 	/* Set defaults */
-	map->threads = g_thread_pool_new(_load_tile_thread, map, 1, FALSE, NULL);
+	map->loader = grits_tile_loader_new(
+			(GritsTileLoadFunc)_load_tile_thread, map);
 	map->tiles = grits_tile_new(NULL, 85.0511, -85.0511, EAST, WEST);
 	map->tms   = grits_tms_new("http://tile.openstreetmap.org",
 		"osmtile/", "png");
@@ -190,9 +219,10 @@ static void grits_plugin_map_dispose(GObject *gobject)
 	if (map->viewer) {
 		GritsViewer *viewer = map->viewer;
 		g_signal_handler_disconnect(viewer, map->sigid);
+		g_signal_handler_disconnect(viewer, map->rotid);
 		grits_http_abort(map->tms->http);
 		//grits_http_abort(map->wms->http);
-		g_thread_pool_free(map->threads, TRUE, TRUE);
+		grits_tile_loader_free(map->loader);
 		map->viewer = NULL;
 		grits_object_destroy_pointer(&map->tiles);
 		g_object_unref(viewer);
@@ -34,13 +34,14 @@ struct _GritsPluginMap {
 	GObject parent_instance;
 
 	/* instance members */
-	GritsViewer *viewer;
-	GritsTile   *tiles;
-	GritsTms    *tms;
-	GritsWms    *wms;
-	GThreadPool *threads;
-	gulong       sigid;
-	gboolean     aborted;
+	GritsViewer     *viewer;
+	GritsTile       *tiles;
+	GritsTms        *tms;
+	GritsWms        *wms;
+	GritsTileLoader *loader;
+	gulong           sigid;
+	gulong           rotid;
+	gboolean         aborted;
 };
 
 struct _GritsPluginMapClass {
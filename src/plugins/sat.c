@@ -34,6 +34,7 @@
 #define MAX_RESOLUTION 500
 #define TILE_WIDTH     1024
 #define TILE_HEIGHT    512
+#define LOAD_THREADS   4
 
 static void _load_tile_thread(gpointer _tile, gpointer _sat)
 {
@@ -48,18 +49,19 @@ static void _load_tile_thread(gpointer _tile, gpointer _sat)
 	}
 
 	/* Download tile */
-	gchar *path = grits_wms_fetch(sat->wms, tile, GRITS_ONCE, NULL, NULL);
-	if (!path) return; // Canceled/error
+	GBytes *bytes = grits_wms_fetch_bytes(sat->wms, tile, GRITS_ONCE, NULL, NULL);
+	if (!bytes) return; // Canceled/error
 
 	/* Load pixbuf */
-	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file(path, NULL);
+	GInputStream *stream = g_memory_input_stream_new_from_bytes(bytes);
+	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_stream(stream, NULL, NULL);
+	g_object_unref(stream);
+	g_bytes_unref(bytes);
 	if (!pixbuf) {
-		g_warning("GritsPluginSat: _load_tile_thread - Error loading pixbuf %s", path);
-		g_remove(path);
-		g_free(path);
+		g_warning("GritsPluginSat: _load_tile_thread - Error loading pixbuf");
+		grits_wms_remove(sat->wms, tile);
 		return;
 	}
-	g_free(path);
 
 	/* Draw a border */
 #ifdef DRAW_TILE_BORDER
@@ -87,7 +89,7 @@ static void _load_tile_func(GritsTile *tile, gpointer _sat)
 {
 	g_debug("GritsPluginSat: __load_tile_func - tile=%p", tile);
 	GritsPluginSat *sat = _sat;
-	g_thread_pool_push(sat->threads, tile, NULL);
+	grits_tile_loader_push(sat->loader, tile);
 }
 
 /*************
@@ -97,12 +99,20 @@ static void _on_location_changed(GritsViewer *viewer,
 		gdouble lat, gdouble lon, gdouble elev, GritsPluginSat *sat)
 {
 	GritsPoint eye = {lat, lon, elev};
-	grits_tile_update(sat->tiles, &eye,
+	grits_tile_update(sat->tiles, &eye, viewer,
 			MAX_RESOLUTION, TILE_WIDTH, TILE_WIDTH,
 			_load_tile_func, sat);
 	grits_tile_gc(sat->tiles, time(NULL)-10, NULL, sat);
 }
 
+static void _on_rotation_changed(GritsViewer *viewer,
+		gdouble rx, gdouble ry, gdouble rz, GritsPluginSat *sat)
+{
+	gdouble lat, lon, elev;
+	grits_viewer_get_location(viewer, &lat, &lon, &elev);
+	_on_location_changed(viewer, lat, lon, elev, sat);
+}
+
 /***********
  * Methods *
  ***********/
@@ -120,14 +130,32 @@ GritsPluginSat *grits_plugin_sat_new(GritsViewer *viewer)
 	GritsPluginSat *sat = g_object_new(GRITS_TYPE_PLUGIN_SAT, NULL);
 	sat->viewer = g_object_ref(viewer);
 
+	/* Limit the number of requests to the server at once */
+	gint threads = grits_prefs_get_integer(viewer->prefs,
+			"sat/load_threads", NULL);
+	grits_tile_loader_set_limit(sat->loader, threads > 0 ? threads : LOAD_THREADS);
+
+	/* Store tiles in a single pack instead of one file each */
+	if (grits_prefs_get_boolean(viewer->prefs, "grits/cache_packed", NULL))
+		grits_http_set_packed(sat->wms->http, TRUE);
+
+	/* Disk space for cached tiles in MB, negative for no limit */
+	gint quota = grits_prefs_get_integer(viewer->prefs,
+			"sat/cache_quota", NULL);
+	if (quota != 0)
+		grits_http_set_quota(sat->wms->http,
+				quota > 0 ? quota * (gint64)1024*1024 : -1);
+
 	/* Load initial tiles */
 	gdouble lat, lon, elev;
 	grits_viewer_get_location(viewer, &lat, &lon, &elev);
 	_on_location_changed(viewer, lat, lon, elev, sat);
 
-	/* Connect signals */
-	sat->sigid = g_signal_connect(sat->viewer, "location-changed",
+	/* Connect signals, after the viewer has updated the view */
+	sat->sigid = g_signal_connect_after(sat->viewer, "location-changed",
 			G_CALLBACK(_on_location_changed), sat);
+	sat->rotid = g_signal_connect_after(sat->viewer, "rotation-changed",
+			G_CALLBACK(_on_rotation_changed), sat);
 
 	/* Add renderers */
 	grits_viewer_add(viewer, GRITS_OBJECT(sat->tiles), GRITS_LEVEL_WORLD, FALSE);
@@ -154,7 +182,8 @@ static void grits_plugin_sat_init(GritsPluginSat *sat)
 {
 	g_debug("GritsPluginSat: init");
 	/* Set defaults */
-	sat->threads = g_thread_pool_new(_load_tile_thread, sat, 1, FALSE, NULL);
+	sat->loader = grits_tile_loader_new(
+			(GritsTileLoadFunc)_load_tile_thread, sat);
 	sat->tiles = grits_tile_new(NULL, NORTH, SOUTH, EAST, WEST);
 	sat->wms   = grits_wms_new(
 		"http://www.nasa.network.com/wms", "bmng200406", "image/jpeg",
@@ -170,8 +199,9 @@ static void grits_plugin_sat_dispose(GObject *gobject)
 	if (sat->viewer) {
 		GritsViewer *viewer = sat->viewer;
 		g_signal_handler_disconnect(viewer, sat->sigid);
+		g_signal_handler_disconnect(viewer, sat->rotid);
 		grits_http_abort(sat->wms->http);
-		g_thread_pool_free(sat->threads, TRUE, TRUE);
+		grits_tile_loader_free(sat->loader);
 		sat->viewer = NULL;
 		grits_object_destroy_pointer(&sat->tiles);
 		g_object_unref(viewer);
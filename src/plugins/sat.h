@@ -34,12 +34,13 @@ struct _GritsPluginSat {
 	GObject parent_instance;
 
 	/* instance members */
-	GritsViewer *viewer;
-	GritsTile   *tiles;
-	GritsWms    *wms;
-	GThreadPool *threads;
-	gulong       sigid;
-	gboolean     aborted;
+	GritsViewer     *viewer;
+	GritsTile       *tiles;
+	GritsWms        *wms;
+	GritsTileLoader *loader;
+	gulong           sigid;
+	gulong           rotid;
+	gboolean         aborted;
 };
 
 struct _GritsPluginSatClass {
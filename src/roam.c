@@ -31,6 +31,11 @@
 #include <glib.h>
 #include <math.h>
 #include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "gtkgl.h"
 #include "gpqueue.h"
@@ -44,6 +49,11 @@
  *   - Target polygon count/detail
  */
 
+/* Elevation limits used for bounding spheres, deeper than the deepest ocean
+ * and higher than the highest mountain */
+#define ROAM_ELEV_MIN -12000
+#define ROAM_ELEV_MAX  10000
+
 /* For GPQueue comparators */
 static gint tri_cmp(RoamTriangle *a, RoamTriangle *b, gpointer data)
 {
@@ -59,27 +69,371 @@ static gint dia_cmp(RoamDiamond *a, RoamDiamond *b, gpointer data)
 }
 
 
+/************
+ * RoamView *
+ ************/
+/* Normalize a plane equation so that it gives distances */
+static void normd4(gdouble *plane)
+{
+	gdouble len = sqrt(plane[0]*plane[0] + plane[1]*plane[1] +
+	                   plane[2]*plane[2]);
+	for (int i = 0; i < 4; i++)
+		plane[i] /= len;
+}
+
+/* Combine the viewport, projection and model matrices so that projecting a
+ * point is a single matrix multiply followed by a divide. */
+static void roam_view_update_matrix(RoamView *view)
+{
+	gdouble *m = view->model, *p = view->proj, pm[16];
+	for (int c = 0; c < 4; c++)
+	for (int r = 0; r < 4; r++)
+		pm[c*4+r] = p[0*4+r] * m[c*4+0] + p[1*4+r] * m[c*4+1] +
+		            p[2*4+r] * m[c*4+2] + p[3*4+r] * m[c*4+3];
+
+	/* Viewport, as in gluProject */
+	gdouble sx = view->view[2]/2.0, ox = view->view[0] + sx;
+	gdouble sy = view->view[3]/2.0, oy = view->view[1] + sy;
+	for (int c = 0; c < 4; c++) {
+		view->matrix[c*4+0] = sx  * pm[c*4+0] + ox  * pm[c*4+3];
+		view->matrix[c*4+1] = sy  * pm[c*4+1] + oy  * pm[c*4+3];
+		view->matrix[c*4+2] = 0.5 * pm[c*4+2] + 0.5 * pm[c*4+3];
+		view->matrix[c*4+3] =                         pm[c*4+3];
+	}
+
+	/* Clipping planes, from the rows of the projection-model matrix */
+	gdouble rows[4][4];
+	for (int r = 0; r < 4; r++)
+	for (int c = 0; c < 4; c++)
+		rows[r][c] = pm[c*4+r];
+	for (int i = 0; i < 6; i++) {
+		gdouble sign = i%2 ? -1 : 1;
+		for (int c = 0; c < 4; c++)
+			view->planes[i][c] = rows[3][c] + sign*rows[i/2][c];
+	}
+	for (int i = 0; i < 4; i++) {
+		gdouble sign = i%2 ? -2 : 2;
+		for (int c = 0; c < 4; c++)
+			view->center[i][c] = rows[3][c] + sign*rows[i/2][c];
+	}
+	for (int i = 0; i < 6; i++)
+		normd4(view->planes[i]);
+	for (int i = 0; i < 4; i++)
+		normd4(view->center[i]);
+
+	/* Eye position, assuming the model view matrix has no scaling */
+	gdouble *t = &m[12];
+	for (int i = 0; i < 3; i++)
+		view->eye[i] = -(m[i*4+0]*t[0] + m[i*4+1]*t[1] + m[i*4+2]*t[2]);
+	gdouble dist = sqrt(view->eye[0]*view->eye[0] +
+	                    view->eye[1]*view->eye[1] +
+	                    view->eye[2]*view->eye[2]);
+	gdouble low  = elev2rad(ROAM_ELEV_MIN);
+	normd(view->eye);
+	view->horizon = dist > low ? acos(low/dist) : -1;
+	view->hcos    = cos(view->horizon);
+	view->hsin    = sin(view->horizon);
+
+	view->mversion = view->version;
+}
+
+/* Bounding sphere and horizon cone of the part of the globe within the angle
+ * acos(cosa) of dir, and within the elevations lo and hi (as radii) */
+static void roam_view_bound(gdouble *dir, gdouble cosa, gdouble lo, gdouble hi,
+		gdouble *bound, gdouble *cone)
+{
+	/* Horizon cone, see roam_view_classify */
+	cone[0] = dir[0];
+	cone[1] = dir[1];
+	cone[2] = dir[2];
+	gdouble reach = acos(cosa) + acos(elev2rad(ROAM_ELEV_MIN)/hi);
+	cone[3] = cos(reach);
+	cone[4] = sin(reach);
+
+	gdouble mid = (lo*cosa + hi)/2;
+	bound[0] = dir[0] * mid;
+	bound[1] = dir[1] * mid;
+	bound[2] = dir[2] * mid;
+	bound[3] = sqrt(MAX(hi*hi + mid*mid - 2*hi*mid*cosa,
+	                    lo*lo + mid*mid - 2*lo*mid*cosa));
+}
+
+/* Where a triangle and it's descendants are, relative to the view */
+typedef enum {
+	ROAM_OUTSIDE, /* Completely outside the view */
+	ROAM_HIDDEN,  /* Beyond the horizon */
+	ROAM_EDGE,    /* Only near the edges of the view */
+	ROAM_CENTER,  /* In the center half of the view */
+} RoamWhere;
+
+static RoamWhere roam_view_classify(RoamView *view, gdouble *bound,
+		gdouble *cone)
+{
+	/* The earth hides everything further from the eye than the horizon
+	 * plus the angle at which the descendants themselves drop below it */
+	if (view->horizon >= 0) {
+		/* angle(eye,cone) > horizon+reach, using cos and sin of both */
+		gdouble hcos = view->hcos, hsin = view->hsin;
+		gdouble dot  = view->eye[0]*cone[0] + view->eye[1]*cone[1] +
+		               view->eye[2]*cone[2];
+		if (hsin*cone[3] + hcos*cone[4] > 0 &&
+		    dot < hcos*cone[3] - hsin*cone[4])
+			return ROAM_HIDDEN;
+	}
+	for (int i = 0; i < 6; i++) {
+		gdouble *p = view->planes[i];
+		if (p[0]*bound[0] + p[1]*bound[1] + p[2]*bound[2] + p[3] < -bound[3])
+			return ROAM_OUTSIDE;
+	}
+	for (int i = 0; i < 4; i++) {
+		gdouble *p = view->center[i];
+		if (p[0]*bound[0] + p[1]*bound[1] + p[2]*bound[2] + p[3] < -bound[3])
+			return ROAM_EDGE;
+	}
+	return ROAM_CENTER;
+}
+
+/* Check if a triangle and all of it's descendants are inside the view and in
+ * front of the horizon, so that none of them can be culled */
+static gboolean roam_view_contains(RoamView *view, gdouble *bound,
+		gdouble *cone)
+{
+	if (view->horizon >= 0) {
+		/* angle(eye,cone) < horizon-reach */
+		gdouble hcos = view->hcos, hsin = view->hsin;
+		gdouble dot  = view->eye[0]*cone[0] + view->eye[1]*cone[1] +
+		               view->eye[2]*cone[2];
+		if (hsin*cone[3] - hcos*cone[4] <= 0 ||
+		    dot <= hcos*cone[3] + hsin*cone[4])
+			return FALSE;
+	}
+	for (int i = 0; i < 6; i++) {
+		gdouble *p = view->planes[i];
+		if (p[0]*bound[0] + p[1]*bound[1] + p[2]*bound[2] + p[3] < bound[3])
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * roam_view_visible:
+ * @view: the view to test against
+ * @n:    the northern edge of the area
+ * @s:    the southern edge of the area
+ * @e:    the eastern edge of the area
+ * @w:    the western edge of the area
+ *
+ * Check if part of a latitude-longitude box could be drawn with the view,
+ * using the same bounds as the triangles of the mesh. Areas which are outside
+ * the view or beyond the horizon are not visible. Before the view has been
+ * set everything is visible.
+ *
+ * Returns: %FALSE if no part of the area is visible
+ */
+gboolean roam_view_visible(RoamView *view,
+		gdouble n, gdouble s, gdouble e, gdouble w)
+{
+	/* Along the edges of narrower boxes the angle from the center is
+	 * largest at the corners */
+	if (view->version == 0 || e - w >= 180)
+		return TRUE;
+	if (view->mversion != view->version)
+		roam_view_update_matrix(view);
+
+	gdouble ll[4][2] = {{n,w}, {n,e}, {s,e}, {s,w}};
+	gdouble dir[3], corner[3], cosa = 1;
+	lle2xyz((n+s)/2, (e+w)/2, 0, &dir[0], &dir[1], &dir[2]);
+	normd(dir);
+	for (int i = 0; i < G_N_ELEMENTS(ll); i++) {
+		lle2xyz(ll[i][0], ll[i][1], 0,
+				&corner[0], &corner[1], &corner[2]);
+		normd(corner);
+		cosa = MIN(cosa, dir[0]*corner[0] + dir[1]*corner[1] +
+		                 dir[2]*corner[2]);
+	}
+
+	gdouble bound[4], cone[5];
+	roam_view_bound(dir, cosa, elev2rad(ROAM_ELEV_MIN),
+			elev2rad(ROAM_ELEV_MAX), bound, cone);
+	RoamWhere where = roam_view_classify(view, bound, cone);
+	return where != ROAM_OUTSIDE && where != ROAM_HIDDEN;
+}
+
+/**
+ * roam_view_project:
+ * @view:  the view to use when projecting points
+ * @in:    model coordinates of the points
+ * @out:   location to store the window coordinates of the points
+ * @count: number of points to project
+ *
+ * Project an array of points into window coordinates. This gives the same
+ * results as calling gluProject for each point, but the matrices are only
+ * combined once for each version of the view.
+ */
+void roam_view_project(RoamView *view, gdouble (*in)[3], gdouble (*out)[3],
+		gint count)
+{
+	if (view->mversion != view->version)
+		roam_view_update_matrix(view);
+	if (count <= 0)
+		return;
+	gdouble *m = view->matrix;
+#if defined(__AVX2__)
+	__m256d c0 = _mm256_loadu_pd(&m[0]);
+	__m256d c1 = _mm256_loadu_pd(&m[4]);
+	__m256d c2 = _mm256_loadu_pd(&m[8]);
+	__m256d c3 = _mm256_loadu_pd(&m[12]);
+	for (gint i = 0; i < count; i++) {
+		__m256d v = _mm256_add_pd(
+			_mm256_add_pd(_mm256_mul_pd(c0, _mm256_set1_pd(in[i][0])),
+			              _mm256_mul_pd(c1, _mm256_set1_pd(in[i][1]))),
+			_mm256_add_pd(_mm256_mul_pd(c2, _mm256_set1_pd(in[i][2])), c3));
+		__m256d w = _mm256_permute4x64_pd(v, 0xff);
+		gdouble res[4];
+		_mm256_storeu_pd(res, _mm256_div_pd(v, w));
+		out[i][0] = res[0];
+		out[i][1] = res[1];
+		out[i][2] = res[2];
+	}
+#elif defined(__SSE2__)
+	__m128d c0a = _mm_loadu_pd(&m[0]),  c0b = _mm_loadu_pd(&m[2]);
+	__m128d c1a = _mm_loadu_pd(&m[4]),  c1b = _mm_loadu_pd(&m[6]);
+	__m128d c2a = _mm_loadu_pd(&m[8]),  c2b = _mm_loadu_pd(&m[10]);
+	__m128d c3a = _mm_loadu_pd(&m[12]), c3b = _mm_loadu_pd(&m[14]);
+	for (gint i = 0; i < count; i++) {
+		__m128d x = _mm_set1_pd(in[i][0]);
+		__m128d y = _mm_set1_pd(in[i][1]);
+		__m128d z = _mm_set1_pd(in[i][2]);
+		__m128d xy = _mm_add_pd(
+			_mm_add_pd(_mm_mul_pd(c0a, x), _mm_mul_pd(c1a, y)),
+			_mm_add_pd(_mm_mul_pd(c2a, z), c3a));
+		__m128d zw = _mm_add_pd(
+			_mm_add_pd(_mm_mul_pd(c0b, x), _mm_mul_pd(c1b, y)),
+			_mm_add_pd(_mm_mul_pd(c2b, z), c3b));
+		__m128d w = _mm_unpackhi_pd(zw, zw);
+		_mm_storeu_pd(&out[i][0], _mm_div_pd(xy, w));
+		_mm_store_sd (&out[i][2], _mm_div_sd(zw, w));
+	}
+#else
+	for (gint i = 0; i < count; i++) {
+		gdouble x = in[i][0], y = in[i][1], z = in[i][2];
+		gdouble w = m[3]*x + m[7]*y + m[11]*z + m[15];
+		out[i][0] = (m[0]*x + m[4]*y + m[8]*z  + m[12]) / w;
+		out[i][1] = (m[1]*x + m[5]*y + m[9]*z  + m[13]) / w;
+		out[i][2] = (m[2]*x + m[6]*y + m[10]*z + m[14]) / w;
+	}
+#endif
+}
+
+/************
+ * RoamPool *
+ ************/
+/**
+ * roam_pool_init:
+ * @pool:      the pool
+ * @size:      the size of each element
+ * @per_chunk: the number of elements to allocate at once
+ *
+ * Initialize an empty pool of fixed size elements.
+ */
+void roam_pool_init(RoamPool *pool, gsize size, gint per_chunk)
+{
+	memset(pool, 0, sizeof(RoamPool));
+	pool->size      = MAX(size, sizeof(gpointer));
+	pool->per_chunk = per_chunk;
+	pool->chunks    = g_ptr_array_new();
+}
+
+/**
+ * roam_pool_alloc:
+ * @pool: the pool
+ *
+ * Get an unused element from the pool, allocating a new chunk if the free list
+ * is empty. The element is cleared to zero.
+ *
+ * Returns: the new element
+ */
+gpointer roam_pool_alloc(RoamPool *pool)
+{
+	if (!pool->free) {
+		guchar *chunk = g_malloc(pool->size * pool->per_chunk);
+		for (gint i = pool->per_chunk-1; i >= 0; i--) {
+			gpointer *elem = (gpointer*)(chunk + i*pool->size);
+			*elem = pool->free;
+			pool->free = elem;
+		}
+		g_ptr_array_add(pool->chunks, chunk);
+	}
+	gpointer *elem = pool->free;
+	pool->free = *elem;
+	memset(elem, 0, pool->size);
+	pool->allocs++;
+	pool->used++;
+	pool->peak = MAX(pool->peak, pool->used);
+	return elem;
+}
+
+/**
+ * roam_pool_free:
+ * @pool: the pool
+ * @data: an element allocated from @pool
+ *
+ * Return an element to the pool's free list so it can be reused.
+ */
+void roam_pool_free(RoamPool *pool, gpointer data)
+{
+	gpointer *elem = data;
+	*elem = pool->free;
+	pool->free = elem;
+	pool->used--;
+}
+
+/**
+ * roam_pool_clear:
+ * @pool: the pool
+ *
+ * Release all memory associated with the pool, including elements which are
+ * still in use.
+ */
+void roam_pool_clear(RoamPool *pool)
+{
+	g_debug("RoamPool: clear - size=%d used=%d peak=%d allocs=%d chunks=%d",
+			(gint)pool->size, pool->used, pool->peak,
+			pool->allocs, pool->chunks ? pool->chunks->len : 0);
+	if (pool->chunks) {
+		for (guint i = 0; i < pool->chunks->len; i++)
+			g_free(pool->chunks->pdata[i]);
+		g_ptr_array_free(pool->chunks, TRUE);
+	}
+	pool->chunks = NULL;
+	pool->free   = NULL;
+	pool->used   = 0;
+}
+
 /*************
  * RoamPoint *
  *************/
 /**
  * roam_point_new:
- * @lat:  the latitude for the point
- * @lon:  the longitude for the point
- * @elev: the elevation for the point
+ * @lat:    the latitude for the point
+ * @lon:    the longitude for the point
+ * @elev:   the elevation for the point
+ * @sphere: the sphere whose pool the point is allocated from
  *
  * Create a new point at the given locaiton
  *
  * Returns: the new point
  */
-RoamPoint *roam_point_new(gdouble lat, gdouble lon, gdouble elev)
+RoamPoint *roam_point_new(gdouble lat, gdouble lon, gdouble elev,
+		RoamSphere *sphere)
 {
-	RoamPoint *point = g_new0(RoamPoint, 1);
+	RoamPoint *point = roam_pool_alloc(&sphere->point_pool);
 	point->lat  = lat;
 	point->lon  = lon;
 	point->elev = elev;
 	/* For get_intersect */
 	lle2xyz(lat, lon, elev, &point->x, &point->y, &point->z);
+	roam_packed_add_point(&sphere->packed, point);
 	return point;
 }
 
@@ -122,66 +476,70 @@ void roam_point_remove_triangle(RoamPoint *point, RoamTriangle *triangle)
 
 /**
  * roam_point_update_height:
- * @point: the point
+ * @point:  the point
+ * @sphere: the sphere containing the point
  *
  * Update the height (elevation) of a point based on the current height function
  */
-void roam_point_update_height(RoamPoint *point)
+void roam_point_update_height(RoamPoint *point, RoamSphere *sphere)
 {
 	if (point->height_func) {
 		gdouble elev = point->height_func(
 				point->lat, point->lon, point->height_data);
-		lle2xyz(point->lat, point->lon, elev,
-				&point->x, &point->y, &point->z);
+		roam_point_set_height(point, elev, sphere);
 	}
 }
 
+/**
+ * roam_point_set_height:
+ * @point:  the point
+ * @elev:   the elevation of the point
+ * @sphere: the sphere containing the point
+ *
+ * Move a point to a new elevation which was found using its height function,
+ * for instance as part of a batch of points.
+ */
+void roam_point_set_height(RoamPoint *point, gdouble elev, RoamSphere *sphere)
+{
+	lle2xyz(point->lat, point->lon, elev,
+			&point->x, &point->y, &point->z);
+	roam_packed_update_point(&sphere->packed, point);
+}
+
 /**
  * roam_point_update_projection:
  * @point: the point
  * @view:  the view to use when projecting the point
  *
- * Updated the screen-space projection of a point.
+ * Updated the screen-space projection of a point. This may be called from
+ * several threads at once for points which are already projected.
+ *
+ * Returns: %TRUE if the point had to be projected
  */
-void roam_point_update_projection(RoamPoint *point, RoamView *view)
+gboolean roam_point_update_projection(RoamPoint *point, RoamView *view)
 {
-	static int count   = 0;
-	static int version = 0;
-	if (version != view->version) {
-		g_debug("RoamPoint: Projected %d points", count);
-		count   = 0;
-		version = view->version;
-	}
-
-	if (point->pversion != view->version) {
-		/* Cache projection */
-		gluProject(point->x, point->y, point->z,
-			view->model, view->proj, view->view,
-			&point->px, &point->py, &point->pz);
-		point->pversion = view->version;
-		count++;
-	}
+	if (point->pversion == view->version)
+		return FALSE;
+
+	/* Cache projection */
+	roam_view_project(view, (gdouble(*)[3])&point->x,
+			(gdouble(*)[3])&point->px, 1);
+	point->pversion = view->version;
+	return TRUE;
 }
 
 /****************
  * RoamTriangle *
  ****************/
-/**
- * roam_triangle_new:
- * @l: the left point
- * @m: the middle point
- * @r: the right point
- *
- * Create a new triangle consisting of three points. 
- *
- * Returns: the new triangle
- */
-RoamTriangle *roam_triangle_new(RoamPoint *l, RoamPoint *m, RoamPoint *r,
-		RoamDiamond *parent)
+/* Create a triangle, the height of its split point is left for the caller so
+ * that several of them can be updated at once */
+static RoamTriangle *roam_triangle_create(RoamPoint *l, RoamPoint *m, RoamPoint *r,
+		RoamDiamond *parent, RoamSphere *sphere)
 {
-	RoamTriangle *triangle = g_new0(RoamTriangle, 1);
+	RoamTriangle *triangle = roam_pool_alloc(&sphere->triangle_pool);
 
 	triangle->error  = 0;
+	triangle->slot   = -1;
 	triangle->p.l    = l;
 	triangle->p.m    = m;
 	triangle->p.r    = r;
@@ -191,11 +549,11 @@ RoamTriangle *roam_triangle_new(RoamPoint *l, RoamPoint *m, RoamPoint *r,
 		(ABS(l->lat) == 90 ? r->lon :
 		 ABS(r->lat) == 90 ? l->lon :
 		 lon_avg(l->lon, r->lon)),
-		(l->elev + r->elev)/2);
+		(l->elev + r->elev)/2,
+		sphere);
 	/* TODO: Move this back to sphere, or actually use the nesting */
 	triangle->split->height_func = m->height_func;
 	triangle->split->height_data = m->height_data;
-	roam_point_update_height(triangle->split);
 	//if ((float)triangle->split->lat > 44 && (float)triangle->split->lat < 46)
 	//	g_debug("RoamTriangle: new - (l,m,r,split).lats = %7.2f %7.2f %7.2f %7.2f",
 	//			l->lat, m->lat, r->lat, triangle->split->lat);
@@ -210,6 +568,31 @@ RoamTriangle *roam_triangle_new(RoamPoint *l, RoamPoint *m, RoamPoint *r,
 	        (gdouble*)triangle->p.r, triangle->norm);
 	normd(triangle->norm);
 
+	/* Bounding sphere, for update_errors. Descendants stay within the
+	 * largest angle between the corners and the central direction, and
+	 * within the elevation limits. */
+	RoamPoint *c[] = {l,m,r};
+	gdouble dir[3] = {0, 0, 0}, cosa = 1;
+	gdouble lo = ROAM_ELEV_MIN, hi = ROAM_ELEV_MAX;
+	for (int i = 0; i < G_N_ELEMENTS(c); i++) {
+		gdouble len = sqrt(c[i]->x*c[i]->x + c[i]->y*c[i]->y +
+		                   c[i]->z*c[i]->z);
+		dir[0] += c[i]->x / len;
+		dir[1] += c[i]->y / len;
+		dir[2] += c[i]->z / len;
+		lo = MIN(lo, c[i]->elev);
+		hi = MAX(hi, c[i]->elev);
+	}
+	normd(dir);
+	for (int i = 0; i < G_N_ELEMENTS(c); i++) {
+		gdouble len = sqrt(c[i]->x*c[i]->x + c[i]->y*c[i]->y +
+		                   c[i]->z*c[i]->z);
+		cosa = MIN(cosa, (dir[0]*c[i]->x + dir[1]*c[i]->y +
+		                  dir[2]*c[i]->z) / len);
+	}
+	roam_view_bound(dir, cosa, elev2rad(lo), elev2rad(hi),
+			triangle->bound, triangle->cone);
+
 	/* Store bounding box, for get_intersect */
 	RoamPoint *p[] = {l,m,r};
 	triangle->edge.n =  -90; triangle->edge.s =  90;
@@ -238,16 +621,63 @@ RoamTriangle *roam_triangle_new(RoamPoint *l, RoamPoint *m, RoamPoint *r,
 	return triangle;
 }
 
+/**
+ * roam_triangle_new:
+ * @l: the left point
+ * @m: the middle point
+ * @r: the right point
+ * @parent: the diamond containing the triangle, or NULL
+ * @sphere: the sphere whose pool the triangle is allocated from
+ *
+ * Create a new triangle consisting of three points. 
+ *
+ * Returns: the new triangle
+ */
+RoamTriangle *roam_triangle_new(RoamPoint *l, RoamPoint *m, RoamPoint *r,
+		RoamDiamond *parent, RoamSphere *sphere)
+{
+	RoamTriangle *triangle = roam_triangle_create(l, m, r, parent, sphere);
+	roam_point_update_height(triangle->split, sphere);
+	return triangle;
+}
+
 /**
  * roam_triangle_free:
  * @triangle: the triangle
+ * @sphere:   the sphere the triangle was allocated from
  *
  * Free data associated with a triangle
  */
-void roam_triangle_free(RoamTriangle *triangle)
+void roam_triangle_free(RoamTriangle *triangle, RoamSphere *sphere)
 {
-	g_free(triangle->split);
-	g_free(triangle);
+	roam_packed_remove_point(&sphere->packed, triangle->split);
+	roam_pool_free(&sphere->point_pool, triangle->split);
+	roam_pool_free(&sphere->triangle_pool, triangle);
+}
+
+/**
+ * roam_triangle_update_normal:
+ * @triangle: the triangle
+ *
+ * Recalculate the surface normal of a triangle after its points have moved.
+ * If the triangle is in the mesh, the vertex normals of its points are updated
+ * as well, without needing to visit the point's other triangles.
+ */
+void roam_triangle_update_normal(RoamTriangle *triangle)
+{
+	gdouble old[3] = {triangle->norm[0], triangle->norm[1], triangle->norm[2]};
+	crossd3((gdouble*)triangle->p.l,
+	        (gdouble*)triangle->p.m,
+	        (gdouble*)triangle->p.r, triangle->norm);
+	normd(triangle->norm);
+
+	/* Replace the old normal in each vertex's average */
+	if (triangle->slot < 0)
+		return;
+	RoamPoint *p[] = {triangle->p.l, triangle->p.m, triangle->p.r};
+	for (int i = 0; i < G_N_ELEMENTS(p); i++)
+		for (int j = 0; j < 3; j++)
+			p[i]->norm[j] += (triangle->norm[j] - old[j]) / p[i]->tris;
 }
 
 /**
@@ -276,6 +706,8 @@ void roam_triangle_add(RoamTriangle *triangle,
 		roam_triangle_update_errors(triangle, sphere);
 
 	triangle->handle = g_pqueue_push(sphere->triangles, triangle);
+	roam_packed_add_triangle(&sphere->packed, triangle);
+	roam_index_add(&sphere->index, triangle);
 }
 
 /**
@@ -293,6 +725,8 @@ void roam_triangle_remove(RoamTriangle *triangle, RoamSphere *sphere)
 	roam_point_remove_triangle(triangle->p.r, triangle);
 
 	g_pqueue_remove(sphere->triangles, triangle->handle);
+	roam_packed_remove_triangle(&sphere->packed, triangle);
+	roam_index_remove(&sphere->index, triangle);
 }
 
 /* (neight->t.? == old) = new */
@@ -401,14 +835,18 @@ void roam_triangle_split(RoamTriangle *triangle, RoamSphere *sphere)
 	RoamTriangle *s = triangle;      // Self
 	RoamTriangle *b = triangle->t.b; // Base
 
-	RoamDiamond *dia = roam_diamond_new(s, b);
+	RoamDiamond *dia = roam_diamond_new(s, b, sphere);
 
 	/* Add new triangles */
 	RoamPoint *mid = triangle->split;
-	RoamTriangle *sl = s->kids[0] = roam_triangle_new(s->p.m, mid, s->p.l, dia); // Self Left
-	RoamTriangle *sr = s->kids[1] = roam_triangle_new(s->p.r, mid, s->p.m, dia); // Self Right
-	RoamTriangle *bl = b->kids[0] = roam_triangle_new(b->p.m, mid, b->p.l, dia); // Base Left
-	RoamTriangle *br = b->kids[1] = roam_triangle_new(b->p.r, mid, b->p.m, dia); // Base Right
+	RoamTriangle *sl = s->kids[0] = roam_triangle_create(s->p.m, mid, s->p.l, dia, sphere); // Self Left
+	RoamTriangle *sr = s->kids[1] = roam_triangle_create(s->p.r, mid, s->p.m, dia, sphere); // Self Right
+	RoamTriangle *bl = b->kids[0] = roam_triangle_create(b->p.m, mid, b->p.l, dia, sphere); // Base Left
+	RoamTriangle *br = b->kids[1] = roam_triangle_create(b->p.r, mid, b->p.m, dia, sphere); // Base Right
+
+	/* Sample the new split points together, before the errors need them */
+	RoamPoint *splits[] = {sl->split, sr->split, bl->split, br->split};
+	roam_sphere_update_heights(sphere, splits, G_N_ELEMENTS(splits));
 
 	/*                triangle,l,  base,      r,  sphere */
 	roam_triangle_add(sl, sr, s->t.l, br, sphere);
@@ -483,14 +921,16 @@ void roam_triangle_draw_normal(RoamTriangle *triangle)
  * @kid1:    a child triangle
  * @kid2:    a child triangle
  * @kid3:    a child triangle
+ * @sphere:  the sphere whose pool the diamond is allocated from
  *
  * Create a diamond to store information about two split triangles.
  *
  * Returns: the new diamond
  */
-RoamDiamond *roam_diamond_new(RoamTriangle *parent0, RoamTriangle *parent1)
+RoamDiamond *roam_diamond_new(RoamTriangle *parent0, RoamTriangle *parent1,
+		RoamSphere *sphere)
 {
-	RoamDiamond *diamond = g_new0(RoamDiamond, 1);
+	RoamDiamond *diamond = roam_pool_alloc(&sphere->diamond_pool);
 	diamond->parents[0] = parent0;
 	diamond->parents[1] = parent1;
 	return diamond;
@@ -593,11 +1033,11 @@ void roam_diamond_merge(RoamDiamond *diamond, RoamSphere *sphere)
 	         sr->p.m == bl->p.m &&
 	         bl->p.m == br->p.m);
 	g_assert(sl->p.m->tris == 0);
-	roam_triangle_free(sl);
-	roam_triangle_free(sr);
-	roam_triangle_free(bl);
-	roam_triangle_free(br);
-	g_free(diamond);
+	roam_triangle_free(sl, sphere);
+	roam_triangle_free(sr, sphere);
+	roam_triangle_free(bl, sphere);
+	roam_triangle_free(br, sphere);
+	roam_pool_free(&sphere->diamond_pool, diamond);
 }
 
 /**
@@ -615,6 +1055,640 @@ void roam_diamond_update_errors(RoamDiamond *diamond, RoamSphere *sphere)
 	diamond->error = MAX(diamond->parents[0]->error, diamond->parents[1]->error);
 }
 
+/**************
+ * RoamPacked *
+ **************/
+/**
+ * roam_packed_init:
+ * @packed: the packed mesh
+ *
+ * Initialize an empty packed mesh.
+ */
+void roam_packed_init(RoamPacked *packed)
+{
+	memset(packed, 0, sizeof(RoamPacked));
+	packed->enabled = TRUE;
+	packed->unused  = g_array_new(FALSE, FALSE, sizeof(gint));
+	packed->dlist   = g_ptr_array_new();
+	packed->ctlist  = g_ptr_array_new();
+	packed->cdlist  = g_ptr_array_new();
+}
+
+/**
+ * roam_packed_add_point:
+ * @packed: the packed mesh
+ * @point:  the point
+ *
+ * Assign a slot to a newly created point and copy it's model coordinates.
+ */
+void roam_packed_add_point(RoamPacked *packed, RoamPoint *point)
+{
+	if (packed->unused->len > 0) {
+		point->slot = g_array_index(packed->unused, gint,
+				packed->unused->len-1);
+		g_array_set_size(packed->unused, packed->unused->len-1);
+	} else {
+		if (packed->npoints == packed->apoints) {
+			packed->apoints = MAX(packed->apoints*2, 1024);
+			packed->xyz    = g_realloc(packed->xyz,
+					sizeof(*packed->xyz)    * packed->apoints);
+			packed->pxyz   = g_realloc(packed->pxyz,
+					sizeof(*packed->pxyz)   * packed->apoints);
+			packed->points = g_realloc(packed->points,
+					sizeof(*packed->points) * packed->apoints);
+			packed->mark   = g_realloc(packed->mark,
+					sizeof(*packed->mark)   * packed->apoints);
+			packed->plist  = g_realloc(packed->plist,
+					sizeof(*packed->plist)  * packed->apoints);
+		}
+		point->slot = packed->npoints++;
+	}
+	packed->points[point->slot] = point;
+	packed->mark[point->slot]   = 0;
+	roam_packed_update_point(packed, point);
+}
+
+/**
+ * roam_packed_remove_point:
+ * @packed: the packed mesh
+ * @point:  the point
+ *
+ * Release the slot used by a point which is about to be freed.
+ */
+void roam_packed_remove_point(RoamPacked *packed, RoamPoint *point)
+{
+	packed->points[point->slot] = NULL;
+	g_array_append_val(packed->unused, point->slot);
+}
+
+/**
+ * roam_packed_update_point:
+ * @packed: the packed mesh
+ * @point:  the point
+ *
+ * Copy the model coordinates of a point after they have been changed.
+ */
+void roam_packed_update_point(RoamPacked *packed, RoamPoint *point)
+{
+	packed->xyz[point->slot][0] = point->x;
+	packed->xyz[point->slot][1] = point->y;
+	packed->xyz[point->slot][2] = point->z;
+}
+
+/**
+ * roam_packed_add_triangle:
+ * @packed:   the packed mesh
+ * @triangle: the triangle
+ *
+ * Add a triangle which has been added to the mesh to the end of the triangle
+ * arrays.
+ */
+void roam_packed_add_triangle(RoamPacked *packed, RoamTriangle *triangle)
+{
+	if (packed->ntris == packed->atris) {
+		packed->atris = MAX(packed->atris*2, 1024);
+		packed->idx   = g_realloc(packed->idx,
+				sizeof(*packed->idx)  * packed->atris);
+		packed->size  = g_realloc(packed->size,
+				sizeof(*packed->size) * packed->atris);
+		packed->tris  = g_realloc(packed->tris,
+				sizeof(*packed->tris) * packed->atris);
+		packed->tlist = g_realloc(packed->tlist,
+				sizeof(*packed->tlist) * packed->atris);
+	}
+	gint i = triangle->slot = packed->ntris++;
+	packed->idx[i][0] = triangle->p.l->slot;
+	packed->idx[i][1] = triangle->p.m->slot;
+	packed->idx[i][2] = triangle->p.r->slot;
+	packed->idx[i][3] = triangle->split->slot;
+	packed->tris[i]   = triangle;
+
+	/* Triangles are not always evaluated with the rest of the mesh, so
+	 * start with the size from the cached projections */
+	RoamPoint *l = triangle->p.l, *m = triangle->p.m, *r = triangle->p.r;
+	packed->size[i] = -( l->px * (m->py - r->py) +
+	                     m->px * (r->py - l->py) +
+	                     r->px * (l->py - m->py) ) / 2.0;
+}
+
+/**
+ * roam_packed_remove_triangle:
+ * @packed:   the packed mesh
+ * @triangle: the triangle
+ *
+ * Remove a triangle from the triangle arrays, the last triangle is moved into
+ * its slot so that the arrays stay dense.
+ */
+void roam_packed_remove_triangle(RoamPacked *packed, RoamTriangle *triangle)
+{
+	gint i    = triangle->slot;
+	gint last = --packed->ntris;
+	if (i != last) {
+		memcpy(packed->idx[i], packed->idx[last], sizeof(*packed->idx));
+		packed->size[i] = packed->size[last];
+		packed->tris[i] = packed->tris[last];
+		packed->tris[i]->slot = i;
+	}
+	triangle->slot = -1;
+}
+
+/* Project points in [start,end) and copy them back to the RoamPoints
+ * If list is given it holds the slots to use, otherwise slots are used
+ * directly. This is the same for the functions below. */
+static void roam_packed_project(RoamPacked *packed, RoamView *view,
+		gint *list, gint start, gint end)
+{
+	gdouble (*pxyz)[3] = packed->pxyz;
+
+	if (list) {
+		/* Gather listed points so they are still projected in batches */
+		gdouble in[64][3], out[64][3];
+		for (gint k = start; k < end; k += 64) {
+			gint n = MIN(64, end-k);
+			for (gint j = 0; j < n; j++)
+				memcpy(in[j], packed->xyz[list[k+j]], sizeof(in[j]));
+			roam_view_project(view, in, out, n);
+			for (gint j = 0; j < n; j++)
+				memcpy(pxyz[list[k+j]], out[j], sizeof(out[j]));
+		}
+	} else {
+		/* Project points, including unused slots */
+		roam_view_project(view, packed->xyz+start, pxyz+start, end-start);
+	}
+
+	for (gint k = start; k < end; k++) {
+		gint i = list ? list[k] : k;
+		RoamPoint *point = packed->points[i];
+		if (!point)
+			continue;
+		point->px = pxyz[i][0];
+		point->py = pxyz[i][1];
+		point->pz = pxyz[i][2];
+		point->pversion = view->version;
+	}
+}
+
+/* Projected sizes of triangles in [start,end), size < 0 == backface */
+static void roam_packed_update_sizes(RoamPacked *packed,
+		gint *list, gint start, gint end)
+{
+	gdouble (*pxyz)[3] = packed->pxyz;
+	gint    (*idx)[4]  = packed->idx;
+	gdouble  *size     = packed->size;
+
+	for (gint k = start; k < end; k++) {
+		gint i = list ? list[k] : k;
+		gdouble *l = pxyz[idx[i][0]];
+		gdouble *m = pxyz[idx[i][1]];
+		gdouble *r = pxyz[idx[i][2]];
+		size[i] = -( l[0] * (m[1] - r[1]) +
+		             m[0] * (r[1] - l[1]) +
+		             r[0] * (l[1] - m[1]) ) / 2.0;
+	}
+}
+
+/* Check if the triangle in a slot is a backface, from the projected points */
+static inline gboolean roam_packed_backface(RoamPacked *packed, gint i)
+{
+	gdouble *l = packed->pxyz[packed->idx[i][0]];
+	gdouble *m = packed->pxyz[packed->idx[i][1]];
+	gdouble *r = packed->pxyz[packed->idx[i][2]];
+	return l[0] * (m[1] - r[1]) +
+	       m[0] * (r[1] - l[1]) +
+	       r[0] * (l[1] - m[1]) > 0;
+}
+
+/* Errors of triangles in [start,end), see roam_triangle_update_errors
+ * All sizes must be updated first since neighbors are checked for backfaces */
+static void roam_packed_update_range(RoamPacked *packed, RoamView *view,
+		gint *list, gint start, gint end)
+{
+	gdouble (*pxyz)[3] = packed->pxyz;
+	gint    (*idx)[4]  = packed->idx;
+	gdouble  *size     = packed->size;
+
+	gint *vp = view->view;
+	for (gint k = start; k < end; k++) {
+		gint i = list ? list[k] : k;
+		RoamTriangle *triangle = packed->tris[i];
+		gdouble *l     = pxyz[idx[i][0]];
+		gdouble *m     = pxyz[idx[i][1]];
+		gdouble *r     = pxyz[idx[i][2]];
+		gdouble *split = pxyz[idx[i][3]];
+
+		gdouble min_x = MIN(MIN(l[0], m[0]), r[0]);
+		gdouble max_x = MAX(MAX(l[0], m[0]), r[0]);
+		gdouble min_y = MIN(MIN(l[1], m[1]), r[1]);
+		gdouble max_y = MAX(MAX(l[1], m[1]), r[1]);
+		if (max_x < vp[0] || min_x > vp[2] ||
+		    max_y < vp[1] || min_y > vp[3] ||
+		    l[2] <= 0 || m[2] <= 0 || r[2] <= 0 ||
+		    l[2] >= 1 || m[2] >= 1 || r[2] >= 1) {
+			triangle->error = -1;
+			continue;
+		}
+
+		gdouble pxdist = (l[0] + r[0])/2 - split[0];
+		gdouble pydist = (l[1] + r[1])/2 - split[1];
+		gdouble error  = sqrt(pxdist*pxdist + pydist*pydist) * size[i];
+
+		/* Listed triangles can border triangles which were not listed,
+		 * so the sizes of their neighbors are computed here */
+		if (list ? roam_packed_backface(packed, triangle->t.l->slot) ||
+		           roam_packed_backface(packed, triangle->t.b->slot) ||
+		           roam_packed_backface(packed, triangle->t.r->slot)
+		         : size[triangle->t.l->slot] < 0 ||
+		           size[triangle->t.b->slot] < 0 ||
+		           size[triangle->t.r->slot] < 0)
+			error *= 50;
+
+		triangle->error = error;
+	}
+}
+
+/**
+ * roam_packed_update_errors:
+ * @packed: the packed mesh
+ * @view:   the view to use when projecting points
+ *
+ * Project every point and then update the error of every triangle in the mesh.
+ * The cached projections in each #RoamPoint are also updated so that
+ * triangles created by later splits do not need to project them again.
+ */
+void roam_packed_update_errors(RoamPacked *packed, RoamView *view)
+{
+	roam_packed_project(packed, view, NULL, 0, packed->npoints);
+	roam_packed_update_sizes(packed, NULL, 0, packed->ntris);
+	roam_packed_update_range(packed, view, NULL, 0, packed->ntris);
+}
+
+/**
+ * roam_packed_clear:
+ * @packed: the packed mesh
+ *
+ * Free the arrays used by the packed mesh.
+ */
+void roam_packed_clear(RoamPacked *packed)
+{
+	g_free(packed->xyz);
+	g_free(packed->pxyz);
+	g_free(packed->points);
+	g_free(packed->idx);
+	g_free(packed->size);
+	g_free(packed->tris);
+	g_free(packed->mark);
+	g_free(packed->plist);
+	g_free(packed->tlist);
+	g_array_free(packed->unused, TRUE);
+	g_ptr_array_free(packed->dlist,  TRUE);
+	g_ptr_array_free(packed->ctlist, TRUE);
+	g_ptr_array_free(packed->cdlist, TRUE);
+	memset(packed, 0, sizeof(RoamPacked));
+}
+
+/*************
+ * RoamIndex *
+ *************/
+/* Cells are not split beyond this depth, about 1cm at the equator */
+#define ROAM_INDEX_DEPTH 32
+
+/**
+ * roam_index_init:
+ * @index: the index
+ *
+ * Initialize an empty index covering the whole globe.
+ */
+void roam_index_init(RoamIndex *index)
+{
+	roam_pool_init(&index->pool, sizeof(RoamCell), 256);
+	index->root = roam_pool_alloc(&index->pool);
+}
+
+/**
+ * roam_index_add:
+ * @index:    the index
+ * @triangle: the triangle
+ *
+ * Add a triangle to the index using its bounding box.
+ */
+void roam_index_add(RoamIndex *index, RoamTriangle *triangle)
+{
+	gdouble lat  = (triangle->edge.n + triangle->edge.s)/2;
+	gdouble lon  = (triangle->edge.e + triangle->edge.w)/2;
+	gdouble dlat = triangle->edge.n - triangle->edge.s;
+	gdouble dlon = triangle->edge.e - triangle->edge.w;
+
+	/* Descend while the triangle is at most half the size of a sub-cell,
+	 * this keeps a few triangles in each cell so fewer cells are visited */
+	RoamCell *cell = index->root;
+	gdouble n = 90, s = -90, e = 180, w = -180;
+	for (int depth = 0; depth < ROAM_INDEX_DEPTH; depth++) {
+		gdouble mlat = (n+s)/2, mlon = (e+w)/2;
+		if (dlat*2 > mlat-s || dlon*2 > mlon-w)
+			break;
+		gint north = lat >= mlat;
+		gint east  = lon >= mlon;
+		if (north) s = mlat; else n = mlat;
+		if (east)  w = mlon; else e = mlon;
+		cell->count++;
+		gint which = north*2 + east;
+		if (!cell->kids[which]) {
+			RoamCell *kid = roam_pool_alloc(&index->pool);
+			kid->parent = cell;
+			kid->which  = which;
+			cell->kids[which] = kid;
+		}
+		cell = cell->kids[which];
+	}
+	cell->count++;
+
+	if (cell->ntris == cell->atris) {
+		cell->atris = MAX(cell->atris*2, 4);
+		cell->tris  = g_realloc(cell->tris,
+				sizeof(*cell->tris) * cell->atris);
+	}
+	gint slot = cell->ntris++;
+	cell->version = ++index->version;
+	cell->tris[slot].n   = triangle->edge.n;
+	cell->tris[slot].s   = triangle->edge.s;
+	cell->tris[slot].e   = triangle->edge.e;
+	cell->tris[slot].w   = triangle->edge.w;
+	cell->tris[slot].tri = triangle;
+	triangle->index.cell = cell;
+	triangle->index.slot = slot;
+}
+
+/**
+ * roam_index_remove:
+ * @index:    the index
+ * @triangle: the triangle
+ *
+ * Remove a triangle from the index. Cells which become empty are freed.
+ */
+void roam_index_remove(RoamIndex *index, RoamTriangle *triangle)
+{
+	/* Move the last triangle into the empty slot */
+	RoamCell *cell = triangle->index.cell;
+	gint slot = triangle->index.slot;
+	gint last = --cell->ntris;
+	if (slot != last) {
+		cell->tris[slot] = cell->tris[last];
+		cell->tris[slot].tri->index.slot = slot;
+	}
+	cell->version = ++index->version;
+	triangle->index.cell = NULL;
+
+	/* The parent's loose bounds cover the child's, so bumping its version
+	 * keeps get_version correct after the child is freed */
+	while (cell) {
+		RoamCell *parent = cell->parent;
+		if (--cell->count == 0 && parent) {
+			parent->version = ++index->version;
+			parent->kids[cell->which] = NULL;
+			g_free(cell->tris);
+			roam_pool_free(&index->pool, cell);
+		}
+		cell = parent;
+	}
+}
+
+static void roam_index_intersect_rec(RoamCell *cell, GPtrArray *array,
+		gdouble n, gdouble s, gdouble e, gdouble w,
+		gdouble cn, gdouble cs, gdouble ce, gdouble cw)
+{
+	/* Loose bounds contain every triangle stored in the cell */
+	gdouble hlat = (cn-cs)/2, hlon = (ce-cw)/2;
+	if (cn+hlat <= s || cs-hlat >= n || ce+hlon <= w || cw-hlon >= e)
+		return;
+
+	for (gint i = 0; i < cell->ntris; i++)
+		if (!(cell->tris[i].n <= s || cell->tris[i].s >= n ||
+		      cell->tris[i].e <= w || cell->tris[i].w >= e))
+			g_ptr_array_add(array, cell->tris[i].tri);
+
+	gdouble mlat = cs+hlat, mlon = cw+hlon;
+	if (cell->kids[0]) roam_index_intersect_rec(cell->kids[0], array,
+			n, s, e, w, mlat,   cs, mlon,   cw);
+	if (cell->kids[1]) roam_index_intersect_rec(cell->kids[1], array,
+			n, s, e, w, mlat,   cs,   ce, mlon);
+	if (cell->kids[2]) roam_index_intersect_rec(cell->kids[2], array,
+			n, s, e, w,   cn, mlat, mlon,   cw);
+	if (cell->kids[3]) roam_index_intersect_rec(cell->kids[3], array,
+			n, s, e, w,   cn, mlat,   ce, mlon);
+}
+
+/**
+ * roam_index_intersect:
+ * @index: the index
+ * @array: the array to append triangles to
+ * @n:     the northern edge
+ * @s:     the southern edge
+ * @e:     the eastern edge
+ * @w:     the western edge
+ *
+ * Append the triangles whose bounding boxes intersect a lat-lon box.
+ */
+void roam_index_intersect(RoamIndex *index, GPtrArray *array,
+		gdouble n, gdouble s, gdouble e, gdouble w)
+{
+	roam_index_intersect_rec(index->root, array, n, s, e, w,
+			90, -90, 180, -180);
+}
+
+static gint roam_index_version_rec(RoamCell *cell, gint touch,
+		gdouble n, gdouble s, gdouble e, gdouble w,
+		gdouble cn, gdouble cs, gdouble ce, gdouble cw)
+{
+	gdouble hlat = (cn-cs)/2, hlon = (ce-cw)/2;
+	if (cn+hlat < s || cs-hlat > n || ce+hlon < w || cw-hlon > e)
+		return 0;
+	if (touch)
+		cell->version = touch;
+
+	gint version = cell->version;
+	gdouble mlat = cs+hlat, mlon = cw+hlon;
+	gdouble bounds[4][4] = {
+		{mlat,   cs, mlon,   cw}, {mlat,   cs,   ce, mlon},
+		{  cn, mlat, mlon,   cw}, {  cn, mlat,   ce, mlon},
+	};
+	for (int i = 0; i < G_N_ELEMENTS(cell->kids); i++) {
+		if (!cell->kids[i])
+			continue;
+		gint kid = roam_index_version_rec(cell->kids[i], touch,
+				n, s, e, w, bounds[i][0], bounds[i][1],
+				bounds[i][2], bounds[i][3]);
+		version = MAX(version, kid);
+	}
+	return version;
+}
+
+/**
+ * roam_index_get_version:
+ * @index: the index
+ * @n:     the northern edge
+ * @s:     the southern edge
+ * @e:     the eastern edge
+ * @w:     the western edge
+ *
+ * Find the latest version of the cells which may contain triangles touching a
+ * lat-lon box. The version changes whenever a triangle is added or removed in
+ * the box, or the box is touched with roam_index_touch.
+ *
+ * Returns: the version
+ */
+gint roam_index_get_version(RoamIndex *index,
+		gdouble n, gdouble s, gdouble e, gdouble w)
+{
+	return roam_index_version_rec(index->root, 0, n, s, e, w,
+			90, -90, 180, -180);
+}
+
+/**
+ * roam_index_touch:
+ * @index: the index
+ * @n:     the northern edge
+ * @s:     the southern edge
+ * @e:     the eastern edge
+ * @w:     the western edge
+ *
+ * Change the version of a lat-lon box without changing its triangles. Used
+ * when the triangles' points are moved.
+ */
+void roam_index_touch(RoamIndex *index,
+		gdouble n, gdouble s, gdouble e, gdouble w)
+{
+	roam_index_version_rec(index->root, ++index->version, n, s, e, w,
+			90, -90, 180, -180);
+}
+
+static void roam_index_clear_rec(RoamCell *cell)
+{
+	for (int i = 0; i < G_N_ELEMENTS(cell->kids); i++)
+		if (cell->kids[i])
+			roam_index_clear_rec(cell->kids[i]);
+	g_free(cell->tris);
+}
+
+/**
+ * roam_index_clear:
+ * @index: the index
+ *
+ * Free the cells used by the index.
+ */
+
+void roam_index_clear(RoamIndex *index)
+{
+	roam_index_clear_rec(index->root);
+	roam_pool_clear(&index->pool);
+	memset(index, 0, sizeof(RoamIndex));
+}
+
+/***************
+ * RoamWorkers *
+ ***************/
+/* Work is only split between threads when there is at least this much */
+#define ROAM_CHUNK_MIN 1024
+
+typedef enum {
+	ROAM_PHASE_PROJECT,
+	ROAM_PHASE_SIZES,
+	ROAM_PHASE_ERRORS,
+	ROAM_PHASE_DIAMONDS,
+} RoamPhase;
+
+typedef struct {
+	RoamPhase phase;
+	gpointer  data;
+	gint      start, end;
+} RoamTask;
+
+static void roam_sphere_run_task(RoamTask *task, RoamSphere *sphere)
+{
+	switch (task->phase) {
+	case ROAM_PHASE_PROJECT:
+		roam_packed_project(&sphere->packed, sphere->view,
+				task->data, task->start, task->end);
+		break;
+	case ROAM_PHASE_SIZES:
+		roam_packed_update_sizes(&sphere->packed,
+				task->data, task->start, task->end);
+		break;
+	case ROAM_PHASE_ERRORS:
+		roam_packed_update_range(&sphere->packed, sphere->view,
+				task->data, task->start, task->end);
+		break;
+	case ROAM_PHASE_DIAMONDS:
+		for (gint i = task->start; i < task->end; i++)
+			roam_diamond_update_errors(((RoamDiamond**)task->data)[i],
+					sphere);
+		break;
+	}
+}
+
+static void roam_sphere_worker(gpointer _task, gpointer _sphere)
+{
+	RoamSphere *sphere = _sphere;
+	roam_sphere_run_task(_task, sphere);
+	g_mutex_lock(&sphere->workers_lock);
+	if (--sphere->workers_pending == 0)
+		g_cond_signal(&sphere->workers_cond);
+	g_mutex_unlock(&sphere->workers_lock);
+}
+
+/* Split [0,count) between the workers and the calling thread and wait for
+ * all of them to finish */
+static void roam_sphere_parallel(RoamSphere *sphere, RoamPhase phase,
+		gpointer data, gint count)
+{
+	gint threads = CLAMP(count / ROAM_CHUNK_MIN, 1, sphere->threads);
+	RoamTask tasks[threads];
+	for (gint i = 0; i < threads; i++) {
+		tasks[i].phase = phase;
+		tasks[i].data  = data;
+		tasks[i].start = (gint64)count * (i+0) / threads;
+		tasks[i].end   = (gint64)count * (i+1) / threads;
+	}
+
+	sphere->workers_pending = threads-1;
+	for (gint i = 1; i < threads; i++)
+		g_thread_pool_push(sphere->workers, &tasks[i], NULL);
+	roam_sphere_run_task(&tasks[0], sphere);
+
+	g_mutex_lock(&sphere->workers_lock);
+	while (sphere->workers_pending > 0)
+		g_cond_wait(&sphere->workers_cond, &sphere->workers_lock);
+	g_mutex_unlock(&sphere->workers_lock);
+}
+
+/**
+ * roam_sphere_set_threads:
+ * @sphere:  the sphere
+ * @threads: number of threads to use, including the calling thread
+ *
+ * Set the number of threads used by roam_sphere_update_errors. Using more
+ * than one thread requires the packed mesh, since points must be projected
+ * before triangles are evaluated.
+ */
+void roam_sphere_set_threads(RoamSphere *sphere, gint threads)
+{
+	if (sphere->workers)
+		g_thread_pool_free(sphere->workers, FALSE, TRUE);
+	sphere->workers = NULL;
+	sphere->threads = 1;
+	if (threads <= 1)
+		return;
+
+	GError *error = NULL;
+	sphere->workers = g_thread_pool_new(roam_sphere_worker, sphere,
+			threads-1, TRUE, &error);
+	if (!sphere->workers) {
+		g_warning("RoamSphere: set_threads - %s", error->message);
+		g_error_free(error);
+		return;
+	}
+	sphere->threads = threads;
+}
+
 /**************
  * RoamSphere *
  **************/
@@ -632,14 +1706,32 @@ RoamSphere *roam_sphere_new()
 	sphere->triangles   = g_pqueue_new((GCompareDataFunc)tri_cmp, NULL);
 	sphere->diamonds    = g_pqueue_new((GCompareDataFunc)dia_cmp, NULL);
 	sphere->view        = g_new0(RoamView, 1);
+	sphere->view->mversion = -1;
+
+	roam_pool_init(&sphere->point_pool,    sizeof(RoamPoint),    1024);
+	roam_pool_init(&sphere->triangle_pool, sizeof(RoamTriangle), 1024);
+	roam_pool_init(&sphere->diamond_pool,  sizeof(RoamDiamond),  512);
+	roam_packed_init(&sphere->packed);
+	roam_index_init(&sphere->index);
+
+	sphere->incremental = TRUE;
+	sphere->refresh     = 0;
+
+	sphere->target    = 2000;
+	sphere->budget    = 5000;
+	sphere->max_error = 0;
+
+	sphere->threads = 1;
+	g_mutex_init(&sphere->workers_lock);
+	g_cond_init(&sphere->workers_cond);
 
 	RoamPoint *vertexes[] = {
-		roam_point_new( 90,   0,  0), // 0 (North)
-		roam_point_new(-90,   0,  0), // 1 (South)
-		roam_point_new(  0,   0,  0), // 2 (Europe/Africa)
-		roam_point_new(  0,  90,  0), // 3 (Asia,East)
-		roam_point_new(  0, 180,  0), // 4 (Pacific)
-		roam_point_new(  0, -90,  0), // 5 (Americas,West)
+		roam_point_new( 90,   0,  0, sphere), // 0 (North)
+		roam_point_new(-90,   0,  0, sphere), // 1 (South)
+		roam_point_new(  0,   0,  0, sphere), // 2 (Europe/Africa)
+		roam_point_new(  0,  90,  0, sphere), // 3 (Asia,East)
+		roam_point_new(  0, 180,  0, sphere), // 4 (Pacific)
+		roam_point_new(  0, -90,  0, sphere), // 5 (Americas,West)
 	};
 	int _triangles[][2][3] = {
 		/*lv mv rv   ln, bn, rn */
@@ -654,13 +1746,13 @@ RoamSphere *roam_sphere_new()
 	};
 
 	for (int i = 0; i < 6; i++)
-		roam_point_update_height(vertexes[i]);
+		roam_point_update_height(vertexes[i], sphere);
 	for (int i = 0; i < 8; i++)
 		sphere->roots[i] = roam_triangle_new(
 			vertexes[_triangles[i][0][0]],
 			vertexes[_triangles[i][0][1]],
 			vertexes[_triangles[i][0][2]],
-			NULL);
+			NULL, sphere);
 	for (int i = 0; i < 8; i++)
 		roam_triangle_add(sphere->roots[i],
 			sphere->roots[_triangles[i][1][0]],
@@ -689,6 +1781,253 @@ void roam_sphere_update_view(RoamSphere *sphere)
 	glGetDoublev (GL_PROJECTION_MATRIX, sphere->view->proj);
 	glGetIntegerv(GL_VIEWPORT,          sphere->view->view);
 	sphere->view->version++;
+
+	/* So that readers such as roam_view_visible don't modify the view */
+	roam_view_update_matrix(sphere->view);
+}
+
+/* Number of full updates between walks when most of the mesh is in view */
+#define ROAM_SKIP 3
+
+static inline void roam_sphere_list_point(RoamSphere *sphere, RoamPoint *point)
+{
+	RoamPacked *packed = &sphere->packed;
+	if (packed->mark[point->slot] != sphere->view->version) {
+		packed->mark[point->slot] = sphere->view->version;
+		packed->plist[packed->nplist++] = point->slot;
+	}
+}
+
+static void roam_sphere_list_triangle(RoamSphere *sphere, RoamTriangle *triangle)
+{
+	roam_sphere_list_point(sphere, triangle->p.l);
+	roam_sphere_list_point(sphere, triangle->p.m);
+	roam_sphere_list_point(sphere, triangle->p.r);
+	roam_sphere_list_point(sphere, triangle->split);
+}
+
+/* Neighbors are checked for backfaces, so their points are projected too */
+static void roam_sphere_list_neighbor(RoamSphere *sphere, RoamTriangle *triangle)
+{
+	roam_sphere_list_point(sphere, triangle->p.l);
+	roam_sphere_list_point(sphere, triangle->p.m);
+	roam_sphere_list_point(sphere, triangle->p.r);
+}
+
+static void roam_sphere_list_diamond(RoamSphere *sphere, RoamDiamond *diamond)
+{
+	diamond->eversion = sphere->view->version;
+	g_ptr_array_add(sphere->packed.dlist, diamond);
+}
+
+/* Set the error of a subtree which has moved out of the view */
+static void roam_sphere_cull(RoamSphere *sphere, RoamTriangle *triangle)
+{
+	RoamPacked *packed = &sphere->packed;
+	triangle->culled = TRUE;
+	if (!triangle->kids[0]) {
+		if (triangle->error != -1)
+			g_ptr_array_add(packed->ctlist, triangle);
+		triangle->error = -1;
+		return;
+	}
+
+	/* Parents of diamonds become leaves again when merged */
+	triangle->error = -1;
+	roam_sphere_cull(sphere, triangle->kids[0]);
+	roam_sphere_cull(sphere, triangle->kids[1]);
+
+	RoamDiamond *diamond = triangle->kids[0]->parent;
+	if (diamond->active && diamond->error != -1) {
+		diamond->error = -1;
+		g_ptr_array_add(packed->cdlist, diamond);
+	}
+}
+
+/* List every triangle and diamond of a subtree which is inside the view */
+static void roam_sphere_walk_inside(RoamSphere *sphere, RoamTriangle *triangle)
+{
+	RoamPacked *packed  = &sphere->packed;
+	gint        version = sphere->view->version;
+
+	triangle->culled   = FALSE;
+	triangle->partial  = FALSE;
+	triangle->eversion = version;
+	if (!triangle->kids[0]) {
+		packed->tlist[packed->ntlist++] = triangle->slot;
+		return;
+	}
+	roam_sphere_walk_inside(sphere, triangle->kids[0]);
+	roam_sphere_walk_inside(sphere, triangle->kids[1]);
+
+	RoamDiamond *diamond = triangle->kids[0]->parent;
+	if (diamond->active && diamond->eversion != version)
+		roam_sphere_list_diamond(sphere, diamond);
+}
+
+/* Find the triangles and diamonds that need to be evaluated
+ * Fresh subtrees were evaluated recently, only their culled parts are checked
+ * Returns TRUE if any part of the subtree is culled */
+static gboolean roam_sphere_walk(RoamSphere *sphere, RoamTriangle *triangle,
+		gboolean fresh)
+{
+	RoamPacked *packed  = &sphere->packed;
+	gint        version = sphere->view->version;
+
+	if (fresh && !triangle->culled && !triangle->partial)
+		return FALSE;
+
+	/* Nothing below can be culled, so the bounds are not checked again */
+	if (!sphere->refresh && roam_view_contains(sphere->view,
+				triangle->bound, triangle->cone)) {
+		roam_sphere_walk_inside(sphere, triangle);
+		return FALSE;
+	}
+
+	RoamWhere where = roam_view_classify(sphere->view,
+			triangle->bound, triangle->cone);
+	if (where == ROAM_OUTSIDE || where == ROAM_HIDDEN) {
+		if (where == ROAM_OUTSIDE)
+			sphere->culling.frustum++;
+		else
+			sphere->culling.horizon++;
+		/* Already culled subtrees can not have changed, unless they
+		 * were updated by a full update */
+		if (!triangle->culled || packed->recull)
+			roam_sphere_cull(sphere, triangle);
+		return TRUE;
+	}
+
+	/* If refresh is set, triangles near the edges are refreshed less
+	 * often, but triangles coming back into view are always evaluated */
+	gboolean culled = triangle->culled;
+	triangle->culled = FALSE;
+	if (culled)
+		fresh = FALSE;
+	else if (sphere->refresh && where == ROAM_EDGE &&
+	         version - triangle->eversion < sphere->refresh)
+		fresh = TRUE;
+	if (!fresh)
+		triangle->eversion = version;
+
+	if (!triangle->kids[0]) {
+		if (!fresh)
+			packed->tlist[packed->ntlist++] = triangle->slot;
+		triangle->partial = FALSE;
+		return FALSE;
+	}
+
+	gboolean partial0 = roam_sphere_walk(sphere, triangle->kids[0], fresh);
+	gboolean partial1 = roam_sphere_walk(sphere, triangle->kids[1], fresh);
+	triangle->partial = partial0 || partial1;
+
+	/* Culled diamonds must be updated as soon as they are visible */
+	RoamDiamond *diamond = triangle->kids[0]->parent;
+	if (diamond->active && diamond->eversion != version &&
+	    (!fresh || diamond->error == -1))
+		roam_sphere_list_diamond(sphere, diamond);
+	return triangle->partial;
+}
+
+/* Find the points used by the listed triangles and diamonds */
+static void roam_sphere_list_points(RoamSphere *sphere)
+{
+	RoamPacked *packed = &sphere->packed;
+	for (int i = 0; i < packed->ntlist; i++) {
+		RoamTriangle *triangle = packed->tris[packed->tlist[i]];
+		roam_sphere_list_triangle(sphere, triangle);
+		roam_sphere_list_neighbor(sphere, triangle->t.l);
+		roam_sphere_list_neighbor(sphere, triangle->t.b);
+		roam_sphere_list_neighbor(sphere, triangle->t.r);
+	}
+	for (int i = 0; i < packed->dlist->len; i++) {
+		RoamDiamond *diamond = packed->dlist->pdata[i];
+		roam_sphere_list_triangle(sphere, diamond->parents[0]);
+		roam_sphere_list_triangle(sphere, diamond->parents[1]);
+	}
+}
+
+/* Update errors for only the parts of the mesh which may have changed */
+static void roam_sphere_update_incremental(RoamSphere *sphere)
+{
+	RoamPacked *packed = &sphere->packed;
+	RoamView   *view   = sphere->view;
+	if (view->mversion != view->version)
+		roam_view_update_matrix(view);
+
+	packed->nplist = 0;
+	packed->ntlist = 0;
+	g_ptr_array_set_size(packed->dlist,  0);
+	g_ptr_array_set_size(packed->ctlist, 0);
+	g_ptr_array_set_size(packed->cdlist, 0);
+	memset(&sphere->culling, 0, sizeof(sphere->culling));
+	for (int i = 0; i < G_N_ELEMENTS(sphere->roots); i++)
+		roam_sphere_walk(sphere, sphere->roots[i], FALSE);
+	sphere->culling.evaluated = packed->ntlist;
+	sphere->culling.culled    = packed->ctlist->len;
+	packed->recull = FALSE;
+
+	/* Walking the mesh costs more than it saves when most of it is in
+	 * view, so the next few views are updated fully */
+	if (packed->ntlist > packed->ntris/4*3)
+		packed->skip = ROAM_SKIP;
+
+	/* Projecting every point is faster than finding them once most of the
+	 * mesh is listed */
+	gint *plist  = NULL;
+	gint  npoints = packed->npoints;
+	if (packed->ntlist < packed->ntris/2) {
+		roam_sphere_list_points(sphere);
+		plist   = packed->plist;
+		npoints = packed->nplist;
+	}
+
+	if (sphere->threads > 1) {
+		roam_sphere_parallel(sphere, ROAM_PHASE_PROJECT, plist,         npoints);
+		roam_sphere_parallel(sphere, ROAM_PHASE_SIZES,   packed->tlist, packed->ntlist);
+		roam_sphere_parallel(sphere, ROAM_PHASE_ERRORS,  packed->tlist, packed->ntlist);
+	} else {
+		roam_packed_project(packed, view, plist, 0, npoints);
+		roam_packed_update_sizes(packed, packed->tlist, 0, packed->ntlist);
+		roam_packed_update_range(packed, view, packed->tlist, 0, packed->ntlist);
+	}
+
+	/* Diamonds may project points outside the lists, so these stay serial */
+	for (int i = 0; i < packed->dlist->len; i++)
+		roam_diamond_update_errors(packed->dlist->pdata[i], sphere);
+
+	/* Update queues, rebuilding them when most entries have changed */
+	gint ntris = packed->ntlist + packed->ctlist->len;
+	if (ntris > packed->ntris/4) {
+		g_pqueue_rebuild(sphere->triangles);
+	} else {
+		for (int i = 0; i < packed->ntlist; i++)
+			g_pqueue_priority_changed(sphere->triangles,
+				packed->tris[packed->tlist[i]]->handle);
+		for (int i = 0; i < packed->ctlist->len; i++)
+			g_pqueue_priority_changed(sphere->triangles,
+				((RoamTriangle*)packed->ctlist->pdata[i])->handle);
+	}
+
+	gint ndias = packed->dlist->len + packed->cdlist->len;
+	if (ndias > packed->ntris/8) {
+		g_pqueue_rebuild(sphere->diamonds);
+	} else {
+		for (int i = 0; i < packed->dlist->len; i++)
+			g_pqueue_priority_changed(sphere->diamonds,
+				((RoamDiamond*)packed->dlist->pdata[i])->handle);
+		for (int i = 0; i < packed->cdlist->len; i++)
+			g_pqueue_priority_changed(sphere->diamonds,
+				((RoamDiamond*)packed->cdlist->pdata[i])->handle);
+	}
+
+	g_debug("RoamSphere: update_incremental - tris=%d/%d points=%d/%d "
+			"dias=%d culled=%d/%d subtrees=%d+%d",
+			packed->ntlist, packed->ntris,
+			npoints, packed->npoints,
+			packed->dlist->len,
+			packed->ctlist->len, packed->cdlist->len,
+			sphere->culling.frustum, sphere->culling.horizon);
 }
 
 /**
@@ -706,23 +2045,58 @@ void roam_sphere_update_errors(RoamSphere *sphere)
 		return;
 	version = sphere->view->version;
 
-	GPtrArray *tris = g_pqueue_get_array(sphere->triangles);
-	GPtrArray *dias = g_pqueue_get_array(sphere->diamonds);
-
-	for (int i = 0; i < tris->len; i++) {
-		RoamTriangle *triangle = tris->pdata[i];
-		roam_triangle_update_errors(triangle, sphere);
-		g_pqueue_priority_changed(sphere->triangles, triangle->handle);
+	if (sphere->packed.enabled && sphere->incremental) {
+		if (sphere->packed.skip == 0) {
+			roam_sphere_update_incremental(sphere);
+			return;
+		}
+		sphere->packed.skip--;
+		sphere->packed.recull = TRUE;
 	}
 
-	for (int i = 0; i < dias->len; i++) {
-		RoamDiamond *diamond = dias->pdata[i];
-		roam_diamond_update_errors(diamond, sphere);
-		g_pqueue_priority_changed(sphere->diamonds, diamond->handle);
+	memset(&sphere->culling, 0, sizeof(sphere->culling));
+	sphere->culling.evaluated = sphere->packed.ntris;
+
+	gint projected = sphere->packed.npoints;
+	if (sphere->packed.enabled && sphere->threads > 1) {
+		RoamView *view = sphere->view;
+		if (view->mversion != view->version)
+			roam_view_update_matrix(view);
+		roam_sphere_parallel(sphere, ROAM_PHASE_PROJECT, NULL, sphere->packed.npoints);
+		roam_sphere_parallel(sphere, ROAM_PHASE_SIZES,   NULL, sphere->packed.ntris);
+		roam_sphere_parallel(sphere, ROAM_PHASE_ERRORS,  NULL, sphere->packed.ntris);
+	} else if (sphere->packed.enabled) {
+		roam_packed_update_errors(&sphere->packed, sphere->view);
+	} else {
+		GPtrArray *tris = g_pqueue_get_array(sphere->triangles);
+		projected = 0;
+		for (int i = 0; i < tris->len; i++) {
+			RoamTriangle *triangle = tris->pdata[i];
+			projected += roam_point_update_projection(triangle->p.l, sphere->view);
+			projected += roam_point_update_projection(triangle->p.m, sphere->view);
+			projected += roam_point_update_projection(triangle->p.r, sphere->view);
+			roam_triangle_update_errors(triangle, sphere);
+		}
+		g_ptr_array_free(tris, TRUE);
 	}
+	g_pqueue_rebuild(sphere->triangles);
+
+	GPtrArray *dias = g_pqueue_get_array(sphere->diamonds);
+
+	/* Every point has been projected by now, so diamonds only read shared
+	 * data and write to their own parents, and roam_point_update_projection
+	 * does not write to the points */
+	if (sphere->packed.enabled && sphere->threads > 1)
+		roam_sphere_parallel(sphere, ROAM_PHASE_DIAMONDS,
+				dias->pdata, dias->len);
+	else
+		for (int i = 0; i < dias->len; i++)
+			roam_diamond_update_errors(dias->pdata[i], sphere);
+
+	g_pqueue_rebuild(sphere->diamonds);
 
-	g_ptr_array_free(tris, TRUE);
 	g_ptr_array_free(dias, TRUE);
+	g_debug("RoamSphere: update_errors - projected %d points", projected);
 }
 
 /**
@@ -752,48 +2126,207 @@ void roam_sphere_merge_one(RoamSphere *sphere)
 }
 
 /**
- * roam_sphere_split_merge
- * @sphere: the sphere
+ * roam_sphere_set_budget:
+ * @sphere:    the sphere
+ * @polys:     target number of polygons
+ * @budget:    time allowed for each call to split_merge, in microseconds
+ * @max_error: triangles with less error than this are not split
  *
- * Perform a predetermined number split-merge iterations.
+ * Set the limits used by roam_sphere_split_merge.
+ */
+void roam_sphere_set_budget(RoamSphere *sphere, gint polys, gint budget,
+		gdouble max_error)
+{
+	sphere->target    = polys;
+	sphere->budget    = budget;
+	sphere->max_error = max_error;
+}
+
+/**
+ * roam_sphere_set_height_batch:
+ * @sphere:       the sphere
+ * @height_func:  the height function which can be sampled in batches
+ * @height_batch: the batch version of @height_func, or NULL
+ * @height_data:  user data passed to the height functions
  *
- * Returns: the number splits and merges done
+ * Set the batch function used by roam_sphere_update_heights for points whose
+ * height function is @height_func.
  */
-gint roam_sphere_split_merge(RoamSphere *sphere)
+void roam_sphere_set_height_batch(RoamSphere *sphere, RoamHeightFunc height_func,
+		RoamHeightBatchFunc height_batch, gpointer height_data)
 {
-	gint iters = 0, max_iters = 500;
-	//gint target = 20000;
-	//gint target = 4000;
-	gint target = 2000;
-	//gint target = 500;
+	sphere->height_func  = height_func;
+	sphere->height_batch = height_batch;
+	sphere->height_data  = height_data;
+}
 
-	if (!sphere->view)
-		return 0;
+/* Points sampled from the stack by update_heights, larger batches are
+ * allocated */
+#define ROAM_BATCH 64
+
+/* Check if the sphere's batch function can be used for a point */
+static inline gboolean roam_sphere_batched(RoamSphere *sphere, RoamPoint *point)
+{
+	return sphere->height_batch && point->height_func &&
+	       point->height_func == sphere->height_func &&
+	       point->height_data == sphere->height_data;
+}
 
-	if (target - sphere->polys > 100) {
-		//g_debug("RoamSphere: split_merge - Splitting %d - %d > 100", target, sphere->polys);
-		while (sphere->polys < target && iters++ < max_iters)
-			roam_sphere_split_one(sphere);
+/**
+ * roam_sphere_update_heights:
+ * @sphere: the sphere containing the points
+ * @points: the points to update
+ * @count:  the number of points
+ *
+ * Update the height of several points at once. Points which use the sphere's
+ * height function are sampled with a single call to its batch function, see
+ * roam_sphere_set_height_batch, other points are updated one at a time.
+ */
+void roam_sphere_update_heights(RoamSphere *sphere, RoamPoint **points,
+		gint count)
+{
+	gdouble  stack[ROAM_BATCH*3];
+	gdouble *lat = count <= ROAM_BATCH ? stack : g_new(gdouble, count*3);
+	gdouble *lon  = lat + count;
+	gdouble *elev = lon + count;
+	gint nbatch = 0;
+	for (gint i = 0; i < count; i++) {
+		if (roam_sphere_batched(sphere, points[i])) {
+			lat[nbatch]   = points[i]->lat;
+			lon[nbatch++] = points[i]->lon;
+		} else {
+			roam_point_update_height(points[i], sphere);
+		}
 	}
+	if (nbatch > 0)
+		sphere->height_batch(lat, lon, elev, nbatch, sphere->height_data);
+	for (gint i = 0, j = 0; i < count && j < nbatch; i++)
+		if (roam_sphere_batched(sphere, points[i]))
+			roam_point_set_height(points[i], elev[j++], sphere);
+	if (lat != stack)
+		g_free(lat);
+}
 
-	if (sphere->polys - target > 100) {
-		//g_debug("RoamSphere: split_merge - Merging %d - %d > 100", sphere->polys, target);
-		while (sphere->polys > target && iters++ < max_iters)
-			roam_sphere_merge_one(sphere);
+/* Polygons either side of the target which are left alone, so the mesh does
+ * not keep splitting and merging around the target */
+#define ROAM_SLACK 100
+
+/* How much larger a triangle's error must be than a diamond's to move detail
+ * from the diamond to the triangle */
+#define ROAM_SWAP  1.5
+
+/* Unfinished calls to split_merge allowed to balance the errors after the view
+ * or mesh changes, resizing to the target is always allowed */
+#define ROAM_CHASE 60
+
+/* Do a single split, merge or both to move the mesh towards the target.
+ * Returns FALSE once there is nothing left to do */
+static gboolean roam_sphere_split_merge_one(RoamSphere *sphere)
+{
+	RoamTriangle *tri = g_pqueue_peek(sphere->triangles);
+	RoamDiamond  *dia = g_pqueue_peek(sphere->diamonds);
+
+	/* Resize once the mesh leaves the band around the target, and keep
+	 * going until the target is reached */
+	if (sphere->polys > sphere->target + ROAM_SLACK)
+		sphere->resize = -1;
+	if (sphere->polys < sphere->target - ROAM_SLACK)
+		sphere->resize =  1;
+	if (sphere->resize < 0 && (!dia || sphere->polys <= sphere->target))
+		sphere->resize = 0;
+	if (sphere->resize > 0 && (!tri || tri->error <= sphere->max_error ||
+	                           sphere->polys >= sphere->target))
+		sphere->resize = 0;
+
+	/* Too many polygons */
+	if (sphere->resize < 0) {
+		roam_sphere_merge_one(sphere);
+		return TRUE;
+	}
+
+	/* Add detail where it is needed */
+	if (sphere->resize > 0) {
+		roam_sphere_split_one(sphere);
+		return TRUE;
 	}
 
-	while (((RoamTriangle*)g_pqueue_peek(sphere->triangles))->error >
-	       ((RoamDiamond *)g_pqueue_peek(sphere->diamonds ))->error &&
-	       iters++ < max_iters) {
-		//g_debug("RoamSphere: split_merge - Fixing 1 %f > %f && %d < %d",
-		//		((RoamTriangle*)g_pqueue_peek(sphere->triangles))->error,
-		//		((RoamDiamond *)g_pqueue_peek(sphere->diamonds ))->error,
-		//		iters-1, max_iters);
+	/* Give up on balancing the errors until something changes */
+	if (sphere->chasing >= ROAM_CHASE)
+		return FALSE;
+
+	/* Remove detail where it is not */
+	if (dia && dia->error < sphere->max_error) {
+		roam_sphere_merge_one(sphere);
+		return TRUE;
+	}
+
+	/* Move detail from the best diamond to the worst triangle. The diamond
+	 * created by the split has at least the triangle's error, so it is not
+	 * merged again by the next swap. */
+	if (tri && dia && tri->error > MAX(dia->error, 0) * ROAM_SWAP &&
+	    tri->error > sphere->max_error) {
 		roam_sphere_merge_one(sphere);
 		roam_sphere_split_one(sphere);
+		return TRUE;
 	}
 
-	return iters;
+	return FALSE;
+}
+
+/**
+ * roam_sphere_split_merge
+ * @sphere: the sphere
+ *
+ * Split and merge triangles and diamonds until the mesh is within 100
+ * polygons of the target and the errors are balanced, or until the time
+ * budget runs out. Unfinished work is picked up by the next call, the queues
+ * are kept between calls. Errors are only balanced for 60 unfinished calls,
+ * after that the mesh is left as it is until the view changes or part of the
+ * mesh is touched.
+ *
+ * Returns: TRUE if there is work left for the next call
+ */
+gboolean roam_sphere_split_merge(RoamSphere *sphere)
+{
+	if (!sphere->view)
+		return FALSE;
+
+	if (sphere->cversion != sphere->view->version) {
+		sphere->cversion = sphere->view->version;
+		sphere->chasing  = 0;
+	}
+
+	gint64 start = g_get_monotonic_time(), now = start;
+	gint iters = 0;
+	gboolean more;
+	while ((more = roam_sphere_split_merge_one(sphere))) {
+		/* Checking the clock is slow compared to a split */
+		if (++iters % 16 == 0 && (now = g_get_monotonic_time()) -
+				start > sphere->budget)
+			break;
+	}
+	if (iters % 16 != 0)
+		now = g_get_monotonic_time();
+
+	RoamTriangle *tri = g_pqueue_peek(sphere->triangles);
+	sphere->stats.iters = iters;
+	sphere->stats.time  = now - start;
+	sphere->stats.error = tri ? tri->error : 0;
+	sphere->stats.done  = !more;
+	if (more && !sphere->resize)
+		sphere->chasing++;
+
+	g_debug("RoamSphere: split_merge - iters=%d polys=%d/%d "
+			"error=%g time=%dus/%dus %s "
+			"points=%d/%d tris=%d/%d dias=%d/%d",
+			iters, sphere->polys, sphere->target,
+			sphere->stats.error, (gint)sphere->stats.time,
+			sphere->budget, more ? "partial" : "done",
+			sphere->point_pool.used,    sphere->point_pool.peak,
+			sphere->triangle_pool.used, sphere->triangle_pool.peak,
+			sphere->diamond_pool.used,  sphere->diamond_pool.peak);
+
+	return more;
 }
 
 /**
@@ -820,53 +2353,39 @@ void roam_sphere_draw_normals(RoamSphere *sphere)
 	g_pqueue_foreach(sphere->triangles, (GFunc)roam_triangle_draw_normal, NULL);
 }
 
-static GList *_roam_sphere_get_leaves(RoamTriangle *triangle, GList *list, gboolean all)
+static void _roam_sphere_get_leaves(RoamTriangle *triangle, GPtrArray *array)
 {
 	if (triangle->kids[0] && triangle->kids[1]) {
-		if (all) list = g_list_prepend(list, triangle);
-		list = _roam_sphere_get_leaves(triangle->kids[0], list, all);
-		list = _roam_sphere_get_leaves(triangle->kids[1], list, all);
-		return list;
+		g_ptr_array_add(array, triangle);
+		_roam_sphere_get_leaves(triangle->kids[0], array);
+		_roam_sphere_get_leaves(triangle->kids[1], array);
 	} else {
-		return g_list_prepend(list, triangle);
+		g_ptr_array_add(array, triangle);
 	}
 }
 
-static GList *_roam_sphere_get_intersect_rec(RoamTriangle *triangle, GList *list,
-		gboolean all, gdouble n, gdouble s, gdouble e, gdouble w)
+static void _roam_sphere_get_intersect_rec(RoamTriangle *triangle, GPtrArray *array,
+		gdouble n, gdouble s, gdouble e, gdouble w)
 {
 	gdouble tn = triangle->edge.n;
 	gdouble ts = triangle->edge.s;
 	gdouble te = triangle->edge.e;
 	gdouble tw = triangle->edge.w;
 
-	gboolean debug = FALSE  &&
-		n==90 && s==45 && e==-90 && w==-180 &&
-		ts > 44 && ts < 46;
-
-	if (debug)
-		g_message("t=%p: %f < %f || %f > %f || %f < %f || %f > %f",
-		            triangle, tn,   s,   ts,   n,   te,   w,   tw,   e);
 	if (tn <= s || ts >= n || te <= w || tw >= e) {
 		/* No intersect */
-		if (debug) g_message("no intersect");
-		return list;
+		return;
 	} else if (tn <= n && ts >= s && te <= e && tw >= w) {
 		/* Triangle is completely contained */
-		if (debug) g_message("contained");
-		if (all) list = g_list_prepend(list, triangle);
-		return _roam_sphere_get_leaves(triangle, list, all);
+		_roam_sphere_get_leaves(triangle, array);
 	} else if (triangle->kids[0] && triangle->kids[1]) {
 		/* Paritial intersect with children */
-		if (debug) g_message("edge w/ child");
-		if (all) list = g_list_prepend(list, triangle);
-		list = _roam_sphere_get_intersect_rec(triangle->kids[0], list, all, n, s, e, w);
-		list = _roam_sphere_get_intersect_rec(triangle->kids[1], list, all, n, s, e, w);
-		return list;
+		g_ptr_array_add(array, triangle);
+		_roam_sphere_get_intersect_rec(triangle->kids[0], array, n, s, e, w);
+		_roam_sphere_get_intersect_rec(triangle->kids[1], array, n, s, e, w);
 	} else {
 		/* This triangle is an edge case */
-		if (debug) g_message("edge");
-		return g_list_prepend(list, triangle);
+		g_ptr_array_add(array, triangle);
 	}
 }
 
@@ -878,34 +2397,104 @@ static GList *_roam_sphere_get_intersect_rec(RoamTriangle *triangle, GList *list
  * @s: the southern edge 
  * @e: the eastern edge 
  * @w: the western edge 
+ * @array: an array to reuse for the results, or NULL
  *
  * Lookup triangles withing the sphere that intersect a given lat-lon box.
+ * Leaf triangles are found using the sphere's index, so the cost depends
+ * mostly on the number of triangles returned. Non-leaf triangles are found by
+ * walking the mesh from the roots.
  *
- * Returns: the list of intersecting triangles.
+ * Returns: @array, or a new array, containing the intersecting triangles.
  */
 /* Warning: This grabs pointers to triangles which can be changed by other
  * calls, e.g. split_merge. If you use this, you need to do some locking to
  * prevent the returned list from becomming stale. */
-GList *roam_sphere_get_intersect(RoamSphere *sphere, gboolean all,
+GPtrArray *roam_sphere_get_intersect(RoamSphere *sphere, gboolean all,
+		gdouble n, gdouble s, gdouble e, gdouble w, GPtrArray *array)
+{
+	if (!array)
+		array = g_ptr_array_new();
+	g_ptr_array_set_size(array, 0);
+	if (all)
+		for (int i = 0; i < G_N_ELEMENTS(sphere->roots); i++)
+			_roam_sphere_get_intersect_rec(sphere->roots[i],
+					array, n, s, e, w);
+	else
+		roam_index_intersect(&sphere->index, array, n, s, e, w);
+	return array;
+}
+
+/**
+ * roam_sphere_get_version
+ * @sphere: the sphere
+ * @n: the northern edge
+ * @s: the southern edge
+ * @e: the eastern edge
+ * @w: the western edge
+ *
+ * Get a version for the part of the mesh in a lat-lon box. The version
+ * changes whenever the triangles returned by roam_sphere_get_intersect for
+ * the box may have changed.
+ *
+ * Returns: the version
+ */
+gint roam_sphere_get_version(RoamSphere *sphere,
 		gdouble n, gdouble s, gdouble e, gdouble w)
 {
-	/* I think this is correct..
-	 * i_cost = cost for triangle-rectagnle intersect test
-	 * time = n_tiles * 2*tris_per_tile * i_cost
-	 * time = 30      * 2*333           * i_cost = 20000 * i_cost */
-	GList *list = NULL;
-	for (int i = 0; i < G_N_ELEMENTS(sphere->roots); i++)
-		list = _roam_sphere_get_intersect_rec(sphere->roots[i],
-				list, all, n, s, e, w);
-	return list;
+	return roam_index_get_version(&sphere->index, n, s, e, w);
 }
 
-static void roam_sphere_free_tri(RoamTriangle *triangle)
+/**
+ * roam_sphere_touch
+ * @sphere: the sphere
+ * @n: the northern edge
+ * @s: the southern edge
+ * @e: the eastern edge
+ * @w: the western edge
+ *
+ * Mark part of the mesh as changed, e.g. after the heights of the points in a
+ * lat-lon box have been updated.
+ */
+void roam_sphere_touch(RoamSphere *sphere,
+		gdouble n, gdouble s, gdouble e, gdouble w)
 {
-	if (--triangle->p.l->tris == 0) g_free(triangle->p.l);
-	if (--triangle->p.m->tris == 0) g_free(triangle->p.m);
-	if (--triangle->p.r->tris == 0) g_free(triangle->p.r);
-	roam_triangle_free(triangle);
+	roam_index_touch(&sphere->index, n, s, e, w);
+	sphere->chasing = 0;
+}
+
+/* Force re-evaluation of a triangle and the fresh subtrees above it */
+static void roam_sphere_refresh(RoamSphere *sphere, RoamTriangle *triangle,
+		gint stale)
+{
+	if (!triangle || triangle->eversion == stale)
+		return;
+	triangle->eversion = stale;
+	if (triangle->parent) {
+		roam_sphere_refresh(sphere, triangle->parent->parents[0], stale);
+		roam_sphere_refresh(sphere, triangle->parent->parents[1], stale);
+	}
+}
+
+/**
+ * roam_sphere_invalidate
+ * @sphere:    the sphere
+ * @triangles: triangles using points which have moved
+ *
+ * Discard the cached projections and errors of triangles after their points
+ * have moved, e.g. when their heights change. They are evaluated again by the
+ * next call to roam_sphere_update_errors, even if the view has not changed.
+ */
+void roam_sphere_invalidate(RoamSphere *sphere, GPtrArray *triangles)
+{
+	if (triangles->len == 0)
+		return;
+	gint stale = sphere->view->version - MAX(sphere->refresh, 1);
+	for (guint i = 0; i < triangles->len; i++)
+		roam_sphere_refresh(sphere, triangles->pdata[i], stale);
+
+	/* A new view version re-projects listed points and keeps
+	 * update_errors from returning early */
+	sphere->view->version++;
 }
 
 /**
@@ -917,13 +2506,17 @@ static void roam_sphere_free_tri(RoamTriangle *triangle)
 void roam_sphere_free(RoamSphere *sphere)
 {
 	g_debug("RoamSphere: free");
-	/* Slow method, but it should work */
-	while (sphere->polys > 8)
-		roam_sphere_merge_one(sphere);
-	/* TODO: free points */
-	g_pqueue_foreach(sphere->triangles, (GFunc)roam_sphere_free_tri, NULL);
+	/* Points, triangles and diamonds are all released with the pools */
+	roam_sphere_set_threads(sphere, 1);
+	g_mutex_clear(&sphere->workers_lock);
+	g_cond_clear(&sphere->workers_cond);
 	g_pqueue_free(sphere->triangles);
 	g_pqueue_free(sphere->diamonds);
+	roam_pool_clear(&sphere->point_pool);
+	roam_pool_clear(&sphere->triangle_pool);
+	roam_pool_clear(&sphere->diamond_pool);
+	roam_packed_clear(&sphere->packed);
+	roam_index_clear(&sphere->index);
 	g_free(sphere->view);
 	g_free(sphere);
 }
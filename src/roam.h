@@ -21,6 +21,10 @@
 #include "gpqueue.h"
 
 /* Roam */
+typedef struct _RoamPool     RoamPool;
+typedef struct _RoamPacked   RoamPacked;
+typedef struct _RoamCell     RoamCell;
+typedef struct _RoamIndex    RoamIndex;
 typedef struct _RoamView     RoamView;
 typedef struct _RoamPoint    RoamPoint;
 typedef struct _RoamTriangle RoamTriangle;
@@ -38,6 +42,19 @@ typedef struct _RoamSphere   RoamSphere;
  */
 typedef gdouble (*RoamHeightFunc)(gdouble lat, gdouble lon, gpointer user_data);
 
+/**
+ * RoamHeightBatchFunc:
+ * @lat:       the latitudes
+ * @lon:       the longitudes
+ * @elev:      location to store the elevation of each point
+ * @count:     the number of points
+ * @user_data: user data passed to the function
+ *
+ * See #GritsHeightBatchFunc
+ */
+typedef void (*RoamHeightBatchFunc)(const gdouble *lat, const gdouble *lon,
+		gdouble *elev, gint count, gpointer user_data);
+
 /* Misc */
 /**
  * RoamView:
@@ -53,7 +70,53 @@ struct _RoamView {
 	gdouble proj[16];
 	gint view[4];
 	gint version;
+
+	/*< private >*/
+	gdouble matrix[16];  /* Combined viewport-projection-model matrix */
+	gdouble planes[6][4];/* Frustum planes, in model coordinates */
+	gdouble center[4][4];/* Planes around the center half of the view */
+	gdouble eye[3];      /* Direction to the eye, in model coordinates */
+	gdouble horizon;     /* Angle from the eye to the horizon, or -1 */
+	gdouble hcos, hsin;  /* Cos and sin of the horizon angle */
+	gint    mversion;    /* Version of the combined matrix and planes */
+};
+void roam_view_project(RoamView *view, gdouble (*in)[3], gdouble (*out)[3],
+		gint count);
+gboolean roam_view_visible(RoamView *view,
+		gdouble n, gdouble s, gdouble e, gdouble w);
+
+/************
+ * RoamPool *
+ ************/
+/**
+ * RoamPool:
+ * @size:      size of each element in bytes
+ * @per_chunk: number of elements allocated at once
+ * @chunks:    list of allocated chunks
+ * @free:      linked list of unused elements
+ * @used:      number of elements currently in use
+ * @peak:      maximum number of elements used at once
+ * @allocs:    number of calls to roam_pool_alloc
+ *
+ * Fixed size allocator used for points, triangles, diamonds and index cells.
+ * Memory is allocated from the system in large chunks and elements are
+ * recycled through a free list, so splitting and merging does not need to
+ * call malloc. All the memory is released at once when the pool is cleared.
+ */
+struct _RoamPool {
+	/*< private >*/
+	gsize      size;
+	gint       per_chunk;
+	GPtrArray *chunks;
+	gpointer   free;
+	gint       used;
+	gint       peak;
+	gint       allocs;
 };
+void roam_pool_init(RoamPool *pool, gsize size, gint per_chunk);
+gpointer roam_pool_alloc(RoamPool *pool);
+void roam_pool_free(RoamPool *pool, gpointer data);
+void roam_pool_clear(RoamPool *pool);
 
 /*************
  * RoamPoint *
@@ -81,12 +144,17 @@ struct _RoamPoint {
 	/* For terrain */
 	RoamHeightFunc height_func;
 	gpointer       height_data;
+
+	/* Index into RoamPacked */
+	gint     slot;
 };
-RoamPoint *roam_point_new(double lat, double lon, double elev);
+RoamPoint *roam_point_new(double lat, double lon, double elev,
+		RoamSphere *sphere);
 void roam_point_add_triangle(RoamPoint *point, RoamTriangle *triangle);
 void roam_point_remove_triangle(RoamPoint *point, RoamTriangle *triangle);
-void roam_point_update_height(RoamPoint *point);
-void roam_point_update_projection(RoamPoint *point, RoamView *view);
+void roam_point_update_height(RoamPoint *point, RoamSphere *sphere);
+void roam_point_set_height(RoamPoint *point, gdouble elev, RoamSphere *sphere);
+gboolean roam_point_update_projection(RoamPoint *point, RoamView *view);
 
 /****************
  * RoamTriangle *
@@ -120,15 +188,28 @@ struct _RoamTriangle {
 
 	/* For get_intersect */
 	struct { gdouble n,s,e,w; } edge;
+	struct { RoamCell *cell; gint slot; } index;
+
+	/* Index into RoamPacked */
+	gint slot;
+
+	/* For incremental update_errors */
+	gdouble  bound[4];     /* Bounding sphere of all descendants */
+	gdouble  cone[5];      /* Direction, cos and sin of the angular reach
+	                          of descendants */
+	gint     eversion;     /* View version of the last evaluation */
+	gboolean culled;       /* Descendants were outside the view */
+	gboolean partial;      /* Some descendants were outside the view */
 };
 RoamTriangle *roam_triangle_new(RoamPoint *l, RoamPoint *m, RoamPoint *r,
-		RoamDiamond *parent);
-void roam_triangle_free(RoamTriangle *triangle);
+		RoamDiamond *parent, RoamSphere *sphere);
+void roam_triangle_free(RoamTriangle *triangle, RoamSphere *sphere);
 void roam_triangle_add(RoamTriangle *triangle,
 		RoamTriangle *left, RoamTriangle *base, RoamTriangle *right,
 		RoamSphere *sphere);
 void roam_triangle_remove(RoamTriangle *triangle, RoamSphere *sphere);
 void roam_triangle_update_errors(RoamTriangle *triangle, RoamSphere *sphere);
+void roam_triangle_update_normal(RoamTriangle *triangle);
 void roam_triangle_split(RoamTriangle *triangle, RoamSphere *sphere);
 void roam_triangle_draw(RoamTriangle *triangle);
 void roam_triangle_draw_normal(RoamTriangle *triangle);
@@ -153,13 +234,115 @@ struct _RoamDiamond {
 	double error;             /* Screen space error */
 	gboolean active;          /* For internal use */
 	GPQueueHandle handle;
+	gint eversion;            /* View version of the last evaluation */
 };
-RoamDiamond *roam_diamond_new(RoamTriangle *parent0, RoamTriangle *parent1);
+RoamDiamond *roam_diamond_new(RoamTriangle *parent0, RoamTriangle *parent1,
+		RoamSphere *sphere);
 void roam_diamond_add(RoamDiamond *diamond, RoamSphere *sphere);
 void roam_diamond_remove(RoamDiamond *diamond, RoamSphere *sphere);
 void roam_diamond_merge(RoamDiamond *diamond, RoamSphere *sphere);
 void roam_diamond_update_errors(RoamDiamond *diamond, RoamSphere *sphere);
 
+/**************
+ * RoamPacked *
+ **************/
+/**
+ * RoamPacked:
+ * @enabled: %TRUE to use the packed arrays when updating errors
+ *
+ * A structure-of-arrays copy of the mesh which is used when updating errors.
+ * Every point is given a slot in the point arrays when it is created, and every
+ * triangle in the mesh is given a slot in the triangle arrays when it is added.
+ * The triangle arrays are kept dense so that updating errors can stream
+ * through memory linearly instead of following pointers between triangles
+ * and points.
+ */
+struct _RoamPacked {
+	gboolean enabled;
+
+	/*< private >*/
+	/* Points, slots may be unused */
+	gint         npoints;   /* Number of point slots */
+	gint         apoints;   /* Allocated point slots */
+	gdouble    (*xyz)[3];   /* Model coordinates */
+	gdouble    (*pxyz)[3];  /* Projected coordinates */
+	RoamPoint  **points;    /* Point in each slot */
+	GArray      *unused;    /* Unused point slots */
+
+	/* Triangles, always dense */
+	gint           ntris;   /* Number of triangles */
+	gint           atris;   /* Allocated triangle slots */
+	gint         (*idx)[4]; /* Left, middle, right and split points */
+	gdouble       *size;    /* Projected size */
+	RoamTriangle **tris;    /* Triangle in each slot */
+
+	/* Work lists for incremental updates */
+	gint          *mark;    /* View version each point was listed */
+	gint          *plist;   /* Point slots to project */
+	gint           nplist;
+	gint          *tlist;   /* Triangle slots to evaluate */
+	gint           ntlist;
+	GPtrArray     *dlist;   /* Diamonds to evaluate */
+	GPtrArray     *ctlist;  /* Triangles newly culled */
+	GPtrArray     *cdlist;  /* Diamonds newly culled */
+	gint           skip;    /* Full updates left before the next walk */
+	gboolean       recull;  /* Culled subtrees were updated fully */
+};
+void roam_packed_init(RoamPacked *packed);
+void roam_packed_add_point(RoamPacked *packed, RoamPoint *point);
+void roam_packed_remove_point(RoamPacked *packed, RoamPoint *point);
+void roam_packed_update_point(RoamPacked *packed, RoamPoint *point);
+void roam_packed_add_triangle(RoamPacked *packed, RoamTriangle *triangle);
+void roam_packed_remove_triangle(RoamPacked *packed, RoamTriangle *triangle);
+void roam_packed_update_errors(RoamPacked *packed, RoamView *view);
+void roam_packed_clear(RoamPacked *packed);
+
+/*************
+ * RoamIndex *
+ *************/
+/**
+ * RoamIndex:
+ *
+ * A loose quadtree over the latitude and longitude of the triangles in the
+ * mesh. Each triangle is stored in the deepest cell which is at least twice
+ * as large as its bounding box, and each cell's bounds are expanded by half its
+ * size so that a triangle only needs to be placed by its center. Triangles are
+ * added and removed as the mesh is split and merged, so looking up the
+ * triangles in an area only visits cells near that area.
+ *
+ * Cells also record a version which changes whenever their triangles change,
+ * so callers can cache data derived from the triangles in an area.
+ */
+struct _RoamCell {
+	/*< private >*/
+	RoamCell  *parent;  /* Parent cell, or NULL for the root */
+	RoamCell  *kids[4]; /* Sub-cells, indexed by north*2 + east */
+	gint       which;   /* Index in the parent's kids */
+	gint       count;   /* Triangles in this cell and its sub-cells */
+	gint       version; /* Index version when the triangles last changed */
+
+	/* Triangles stored in this cell, with a copy of their edges */
+	gint       ntris;
+	gint       atris;
+	struct { gdouble n,s,e,w; RoamTriangle *tri; } *tris;
+};
+struct _RoamIndex {
+	/*< private >*/
+	RoamCell *root;
+	RoamPool  pool;
+	gint      version; /* Incremented for each change */
+};
+void roam_index_init(RoamIndex *index);
+void roam_index_add(RoamIndex *index, RoamTriangle *triangle);
+void roam_index_remove(RoamIndex *index, RoamTriangle *triangle);
+void roam_index_intersect(RoamIndex *index, GPtrArray *array,
+		gdouble n, gdouble s, gdouble e, gdouble w);
+gint roam_index_get_version(RoamIndex *index,
+		gdouble n, gdouble s, gdouble e, gdouble w);
+void roam_index_touch(RoamIndex *index,
+		gdouble n, gdouble s, gdouble e, gdouble w);
+void roam_index_clear(RoamIndex *index);
+
 /**************
  * RoamSphere *
  **************/
@@ -180,17 +363,73 @@ struct _RoamSphere {
 
 	/* For get_intersect */
 	RoamTriangle *roots[8]; /* Original 8 triangles */
+	RoamIndex     index;    /* Triangles in the mesh by location */
+
+	/* Memory pools */
+	RoamPool point_pool;
+	RoamPool triangle_pool;
+	RoamPool diamond_pool;
+
+	/* For update_errors */
+	RoamPacked packed;
+	gboolean   incremental; /* Skip subtrees which are outside the view */
+	gint       refresh;     /* Views between updates of subtrees near the
+	                           edges of the view, 0 to update every view */
+
+	/* For update_heights */
+	RoamHeightFunc      height_func;  /* Height function sampled in batches */
+	RoamHeightBatchFunc height_batch; /* Batch version of height_func */
+	gpointer            height_data;
+
+	/* For split_merge */
+	gint     target;    /* Target polygon count */
+	gint     budget;    /* Time allowed per call, in microseconds */
+	gdouble  max_error; /* Triangles below this error are not split */
+	gint     resize;    /* Splitting (1) or merging (-1) to the target */
+	gint     chasing;   /* Unfinished calls since the view or mesh changed */
+	gint     cversion;  /* View version when chasing was last reset */
+	struct {
+		gint     iters; /* Splits and merges done */
+		gint64   time;  /* Time taken, in microseconds */
+		gdouble  error; /* Largest error remaining */
+		gboolean done;  /* Reached the target */
+	} stats;            /* Results of the last split_merge */
+	struct {
+		gint evaluated; /* Triangles evaluated */
+		gint frustum;   /* Subtrees outside the view */
+		gint horizon;   /* Subtrees beyond the horizon */
+		gint culled;    /* Triangles which became hidden */
+	} culling;          /* Results of the last update_errors */
+
+	/* Worker threads for update_errors */
+	gint         threads;
+	GThreadPool *workers;
+	GMutex       workers_lock;
+	GCond        workers_cond;
+	gint         workers_pending;
 };
 RoamSphere *roam_sphere_new();
+void roam_sphere_set_threads(RoamSphere *sphere, gint threads);
 void roam_sphere_update_view(RoamSphere *sphere);
 void roam_sphere_update_errors(RoamSphere *sphere);
 void roam_sphere_split_one(RoamSphere *sphere);
 void roam_sphere_merge_one(RoamSphere *sphere);
-gint roam_sphere_split_merge(RoamSphere *sphere);
+void roam_sphere_set_budget(RoamSphere *sphere, gint polys, gint budget,
+		gdouble max_error);
+void roam_sphere_set_height_batch(RoamSphere *sphere, RoamHeightFunc height_func,
+		RoamHeightBatchFunc height_batch, gpointer height_data);
+void roam_sphere_update_heights(RoamSphere *sphere, RoamPoint **points,
+		gint count);
+gboolean roam_sphere_split_merge(RoamSphere *sphere);
 void roam_sphere_draw(RoamSphere *sphere);
 void roam_sphere_draw_normals(RoamSphere *sphere);
-GList *roam_sphere_get_intersect(RoamSphere *sphere, gboolean all,
+GPtrArray *roam_sphere_get_intersect(RoamSphere *sphere, gboolean all,
+		gdouble n, gdouble s, gdouble e, gdouble w, GPtrArray *array);
+gint roam_sphere_get_version(RoamSphere *sphere,
+		gdouble n, gdouble s, gdouble e, gdouble w);
+void roam_sphere_touch(RoamSphere *sphere,
 		gdouble n, gdouble s, gdouble e, gdouble w);
+void roam_sphere_invalidate(RoamSphere *sphere, GPtrArray *triangles);
 void roam_sphere_free(RoamSphere *sphere);
 
 #endif